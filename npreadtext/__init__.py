@@ -1,4 +1,4 @@
-from ._readers import read
+from ._readers import read, Checkpoint
 from ._loadtxt import _loadtxt
 
 
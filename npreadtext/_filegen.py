@@ -1,24 +1,33 @@
-
 class FileGen:
     """
     Class that wraps a generator to make it look file-like.
+
+    The generator yields the lines, without the line terminators.  The
+    object can not be rewound, so the reader spools the data if it has to
+    read it twice.
     """
     def __init__(self, gen):
         self._gen = gen
-        self._position = 0
 
     def readline(self):
         try:
             line = next(self._gen)
-            self._position += len(line)
-            line += '\n'
+            line += '\n' if isinstance(line, str) else b'\n'
         except StopIteration:
             line = ''
         return line
 
-    def seek(self, pos, whence=0):
-        # For this class, seek(pos) is a no-op.
-        return self._position
-
-    def tell(self):
-        return self._position
+    def read(self, size=-1):
+        # Return whole lines, at least `size` characters (unless the
+        # generator is exhausted).
+        lines = []
+        n = 0
+        for line in self._gen:
+            lines.append(line)
+            n += len(line) + 1
+            if 0 <= size <= n:
+                break
+        if not lines:
+            return ''
+        nl = '\n' if isinstance(lines[0], str) else b'\n'
+        return nl.join(lines) + nl
@@ -1,14 +1,77 @@
 
 import os
+import io
+import mmap
 import codecs
+import socket
 import types
-from pathlib import Path
+from collections import namedtuple
 import operator
 import numpy as np
 from ._filegen import FileGen
 from . import _flatten_dtype
 from ._readtextmodule import (_readtext_from_filename,
-                              _readtext_from_file_object)
+                              _readtext_from_file_object,
+                              have_lzma, have_bz2,
+                              HINT_SEQUENTIAL, HINT_WILLNEED,
+                              HINT_DONTNEED, HINT_HUGE_PAGES)
+
+
+# Normalized names (as given by codecs.lookup(name).name) of the encodings
+# that are decoded natively by the C file streams.
+_NATIVE_ENCODINGS = ['utf-8', 'iso8859-1', 'ascii']
+
+# Extensions of compressed files that the C reader can not decompress, so
+# they are opened in Python.  (gzip is always supported; xz and bzip2 are
+# optional at build time.  The legacy .lzma format has no magic number, so
+# the C reader can not recognize it.)
+_PYTHON_DECOMPRESSED = (['.lzma'] + ([] if have_lzma else ['.xz']) +
+                        ([] if have_bz2 else ['.bz2']))
+
+# The values of the `access_hints` argument of read(), and the corresponding
+# flags of the C reader.
+_ACCESS_HINTS = {'sequential': HINT_SEQUENTIAL,
+                 'willneed': HINT_WILLNEED,
+                 'dontneed': HINT_DONTNEED,
+                 'hugepages': HINT_HUGE_PAGES}
+
+
+Checkpoint = namedtuple('Checkpoint', ['byte_offset', 'line_number'])
+Checkpoint.__doc__ = """\
+A position in a file, as returned by read(..., return_checkpoint=True).
+
+byte_offset is the offset of the position from the start of the data, and
+line_number is the (1-based) number of the line that starts there.  The
+offset is only meaningful for the same file read in the same way (e.g. for
+a file object opened in text mode it counts the bytes of the text encoded
+as UTF-8).
+"""
+
+
+def _unseekable_fd(file):
+    """
+    If `file` is a binary file object that reads from a blocking file
+    descriptor that can not be repositioned (a pipe, socket or terminal),
+    return (fd, prefix), where `prefix` holds the bytes that the file object
+    has already read from fd into its buffer.  Otherwise return (-1, b'').
+    """
+    if not isinstance(file, (io.RawIOBase, io.BufferedReader)):
+        return -1, b''
+    try:
+        if file.seekable():
+            return -1, b''
+        fd = file.fileno()
+        if not os.get_blocking(fd):
+            # E.g. a socket with a timeout.
+            return -1, b''
+    except (OSError, ValueError):
+        return -1, b''
+    prefix = b''
+    if isinstance(file, io.BufferedReader):
+        # peek() returns the buffered bytes (reading from fd only if there
+        # are none), and read1() takes them out of the buffer.
+        prefix = file.read1(len(file.peek()))
+    return fd, prefix
 
 
 def _check_nonneg_int(value, name="argument"):
@@ -20,21 +83,42 @@ def _check_nonneg_int(value, name="argument"):
         raise ValueError(f"{name} must be nonnegative")
 
 
+def _access_hint_flags(access_hints):
+    if isinstance(access_hints, str):
+        access_hints = [access_hints]
+    flags = 0
+    for hint in access_hints:
+        try:
+            flags |= _ACCESS_HINTS[hint]
+        except (KeyError, TypeError):
+            raise ValueError(f"invalid access hint {hint!r}; the hints are "
+                             f"{', '.join(map(repr, _ACCESS_HINTS))}") from None
+    return flags
+
+
 def read(file, *, delimiter=',', comment='#', quote='"',
-         decimal='.', sci='E', imaginary_unit='j',
+         decimal='.', sci='E', imaginary_unit='j', ignore_blank_lines=True,
          usecols=None, skiprows=0,
          max_rows=None, converters=None, ndmin=None, unpack=False,
-         dtype=None, encoding=None):
+         dtype=None, encoding=None, readahead=0, uring=0, direct_io=False,
+         access_hints=(), checkpoint=None, return_checkpoint=False):
     r"""
     Read a NumPy array from a text file.
 
     Parameters
     ----------
-    file : str or file object
-        The filename or the file to be read.
+    file : str, os.PathLike, file object, or bytes-like object
+        The filename (e.g. a str or a pathlib.Path) or the file to be read.
+        A bytes-like object (bytes, bytearray, memoryview or mmap.mmap)
+        holds the data to be read; it is parsed in place, without copying.
+        A binary file object that reads from a pipe, socket or terminal
+        (e.g. ``sys.stdin.buffer`` or the stdout of a subprocess), or a
+        socket, is read directly from its file descriptor.
     delimiter : str, optional
         Field delimiter of the fields in line of the file.
-        Default is a comma, ','.
+        Default is a comma, ','.  A space, ' ', means that the fields are
+        separated by runs of spaces and tabs, and that the spaces and tabs
+        at the start and end of a line are ignored.
     comment : str, optional
         Character that begins a comment.  All text from the comment
         character to the end of the line is ignored.
@@ -50,6 +134,11 @@ def read(file, *, delimiter=',', comment='#', quote='"',
     imaginary_unit : str, optional
         Character that represent the imaginay unit `sqrt(-1)`.
         Default is 'j'.
+    ignore_blank_lines : bool, optional
+        Only used when `delimiter` is ' ', i.e. the fields are separated by
+        runs of spaces and tabs.  If True (the default), the lines that are
+        empty or contain only spaces and tabs are skipped.  If False, such
+        a line is a row with no fields.
     usecols : array_like, optional
         A one-dimensional array of integer column numbers.  These are the
         columns from the file to be included in the array.  If this value
@@ -70,12 +159,61 @@ def read(file, *, delimiter=',', comment='#', quote='"',
         If not given, the data type is inferred from the values found
         in the file.
     encoding : str, optional
-        Specifies the encoding of the input file.
+        Specifies the encoding of the input file.  When `file` is a
+        filename or a binary file object, UTF-8, Latin-1 and ASCII are
+        decoded by the C reader; other encodings are decoded in Python,
+        which is slower.  If not given, a file named by `file` is read as
+        raw bytes, with each byte being one character, and a binary file
+        object or bytes-like object is read as UTF-8.
+    readahead : int, optional
+        Only used when `file` is a filename, or is read from its file
+        descriptor (see `file`).  If positive, the file is
+        read (and decompressed, if it is compressed) by a background
+        thread that keeps up to `readahead` blocks of 2 MiB ahead of the
+        parser, so that slow I/O (e.g. a network file system) overlaps
+        with parsing.  The default, 0, reads the file in the calling
+        thread (uncompressed regular files are memory-mapped).
+    uring : int, optional
+        Only used when `file` is the name of an uncompressed regular file.
+        If positive, the file is read with up to `uring` reads of 2 MiB
+        in flight at the same time, using io_uring on Linux (or pread()
+        where io_uring is not available).  This can help to saturate fast
+        storage such as NVMe arrays.  Default is 0 (not used).
+    direct_io : bool, optional
+        Only used with `uring`.  If True, the file is opened with O_DIRECT
+        (where supported), so reading it does not fill the page cache.
+    access_hints : str or sequence of str, optional
+        Only used when `file` is a filename.  Hints about the way the file
+        is read, given to the operating system (they are ignored where they
+        are not supported):
+
+        - 'sequential': the file is read from start to end, so the kernel
+          can read ahead more aggressively.
+        - 'willneed': start reading the whole file into the page cache.
+        - 'dontneed': drop the pages of the file from the page cache once
+          they have been parsed, so reading a file larger than the memory
+          does not evict other data.  The file is then not memory-mapped.
+        - 'hugepages': use transparent huge pages for the large buffers
+          (the read buffers, and the result when `dtype` is given).
+
+        Default is no hints.
+    checkpoint : Checkpoint, optional
+        Start reading at this position instead of at the start of the
+        file.  `skiprows` and `max_rows` are counted from the checkpoint,
+        and the line numbers in error messages are those of the file.
+        For a compressed file, or a file object opened in text mode, the
+        data before the checkpoint is read (but not parsed) again.
+    return_checkpoint : bool, optional
+        If True, also return the Checkpoint after the last row read.  With
+        `max_rows`, this allows a large file to be read in pieces, and the
+        reading to be resumed after a failure.  Default is False.
 
     Returns
     -------
     ndarray
         NumPy array.
+    Checkpoint
+        Only returned if `return_checkpoint` is True.
 
     Examples
     --------
@@ -105,6 +243,10 @@ def read(file, *, delimiter=',', comment='#', quote='"',
     if encoding is not None:
         # This will raise a LookupError if the encoding is unknown.
         codec = codecs.lookup(encoding)
+    # Files with one of these encodings (or with no encoding given) can be
+    # decoded by the C file streams.
+    native_encoding = codec is None or codec.name in _NATIVE_ENCODINGS
+    enc = codec.name if codec is not None else None
 
     if dtype is not None and not isinstance(dtype, np.dtype):
         dtype = np.dtype(dtype)
@@ -158,6 +300,9 @@ def read(file, *, delimiter=',', comment='#', quote='"',
         raise ValueError('len(imaginary_unit) must be 1.')
 
     _check_nonneg_int(skiprows)
+    _check_nonneg_int(readahead, 'readahead')
+    _check_nonneg_int(uring, 'uring')
+    hints = _access_hint_flags(access_hints)
     if max_rows is not None:
         _check_nonneg_int(max_rows)
     else:
@@ -183,83 +328,126 @@ def read(file, *, delimiter=',', comment='#', quote='"',
         codes = None
         sizes = None
 
+    if isinstance(file, os.PathLike):
+        # A pathlib.Path (or any path-like object, including one whose path
+        # is bytes) is read by the C reader, like a str filename.  (A bytes
+        # object itself holds data, not a filename.)  os.fsdecode() is
+        # undone by the C reader, so undecodable names are preserved.
+        file = os.fsdecode(file)
+
     # XXX Reorganize these nested ifs...
-    # XXX Not everything is handled correctly at the moment.
-    #     A Path could contain a .gz file, for example...
     if isinstance(file, str):
         fname, ext = os.path.splitext(file)
-        if ext not in ['.bz2', '.gz', '.xz', '.lzma'] and encoding is None:
+        # Compressed files are recognized by the C reader from their
+        # magic bytes.
+        if ext not in _PYTHON_DECOMPRESSED and native_encoding:
             arr = _readtext_from_filename(file, delimiter=delimiter,
                                           comment=comment, quote=quote,
                                           decimal=decimal, sci=sci,
                                           imaginary_unit=imaginary_unit,
+                                          ignore_blank_lines=ignore_blank_lines,
                                           usecols=usecols, skiprows=skiprows,
                                           max_rows=max_rows,
                                           converters=converters,
                                           dtype=dtype,
                                           codes=codes, sizes=sizes,
-                                          encoding=encoding)
+                                          encoding=enc,
+                                          readahead=readahead,
+                                          uring=uring,
+                                          direct_io=direct_io,
+                                          hints=hints,
+                                          checkpoint=checkpoint,
+                                          return_checkpoint=return_checkpoint)
         else:
-            f = np.lib._datasource.open(fname, 'rt', encoding=encoding)
+            f = np.lib._datasource.open(file, 'rt', encoding=encoding)
             try:
-                enc = encoding.encode('ascii') if encoding is not None else None
                 arr = _readtext_from_file_object(f, delimiter=delimiter,
                                                  comment=comment, quote=quote,
                                                  decimal=decimal, sci=sci,
                                                  imaginary_unit=imaginary_unit,
+                                                 ignore_blank_lines=ignore_blank_lines,
                                                  usecols=usecols,
                                                  skiprows=skiprows,
                                                  max_rows=max_rows,
                                                  converters=converters,
                                                  dtype=dtype, codes=codes,
-                                                 sizes=sizes, encoding=enc)
+                                                 sizes=sizes, encoding=enc,
+                                                 checkpoint=checkpoint,
+                                                 return_checkpoint=return_checkpoint)
             finally:
                 f.close()
-    elif isinstance(file, Path):
-        with open(file, encoding=encoding) as f:
-            enc = encoding.encode('ascii') if encoding is not None else None
-            arr = _readtext_from_file_object(f, delimiter=delimiter,
-                                             comment=comment, quote=quote,
-                                             decimal=decimal, sci=sci,
-                                             imaginary_unit=imaginary_unit,
-                                             usecols=usecols,
-                                             skiprows=skiprows,
-                                             max_rows=max_rows,
-                                             converters=converters,
-                                             dtype=dtype,
-                                             codes=codes, sizes=sizes,
-                                             encoding=enc)
+    elif isinstance(file, (bytes, bytearray, memoryview, mmap.mmap)):
+        if not native_encoding:
+            # Decode in Python, through the file object reader.
+            file = io.BytesIO(file)
+        arr = _readtext_from_file_object(file, delimiter=delimiter,
+                                         comment=comment, quote=quote,
+                                         decimal=decimal, sci=sci,
+                                         imaginary_unit=imaginary_unit,
+                                         ignore_blank_lines=ignore_blank_lines,
+                                         usecols=usecols,
+                                         skiprows=skiprows,
+                                         max_rows=max_rows,
+                                         converters=converters,
+                                         dtype=dtype,
+                                         codes=codes, sizes=sizes,
+                                         encoding=enc,
+                                         checkpoint=checkpoint,
+                                         return_checkpoint=return_checkpoint)
     elif isinstance(file, types.GeneratorType):
-        if dtype is None:
-            raise ValueError('dtype must be given when reading from '
-                             'a generator')
-        # Wrap the generator in a class with a readline() method.
+        # Wrap the generator in a class with a read() method.  Without a
+        # dtype, the data is spooled by the reader for its second pass.
         fg = FileGen(file)
-        enc = encoding.encode('ascii') if encoding is not None else None
         arr = _readtext_from_file_object(fg, delimiter=delimiter,
                                          comment=comment, quote=quote,
                                          decimal=decimal, sci=sci,
                                          imaginary_unit=imaginary_unit,
+                                         ignore_blank_lines=ignore_blank_lines,
                                          usecols=usecols,
                                          skiprows=skiprows,
                                          max_rows=max_rows,
                                          converters=converters,
                                          dtype=dtype,
                                          codes=codes, sizes=sizes,
-                                         encoding=enc)
+                                         encoding=enc,
+                                         checkpoint=checkpoint,
+                                         return_checkpoint=return_checkpoint)
     else:
-        # Assume file is a file object.
-        enc = encoding.encode('ascii') if encoding is not None else None
-        arr = _readtext_from_file_object(file, delimiter=delimiter,
-                                         comment=comment,
-                                         quote=quote, decimal=decimal, sci=sci,
-                                         imaginary_unit=imaginary_unit,
-                                         usecols=usecols, skiprows=skiprows,
-                                         max_rows=max_rows,
-                                         converters=converters,
-                                         dtype=dtype, codes=codes, sizes=sizes,
-                                         encoding=enc)
+        # Assume file is a file object (or a socket).
+        f = file.makefile('rb') if isinstance(file, socket.socket) else file
+        try:
+            if native_encoding:
+                fd, prefix = _unseekable_fd(f)
+            else:
+                fd, prefix = -1, b''
+            arr = _readtext_from_file_object(f, delimiter=delimiter,
+                                             comment=comment,
+                                             quote=quote, decimal=decimal,
+                                             sci=sci,
+                                             imaginary_unit=imaginary_unit,
+                                             ignore_blank_lines=ignore_blank_lines,
+                                             usecols=usecols,
+                                             skiprows=skiprows,
+                                             max_rows=max_rows,
+                                             converters=converters,
+                                             dtype=dtype, codes=codes,
+                                             sizes=sizes, encoding=enc,
+                                             checkpoint=checkpoint,
+                                             return_checkpoint=return_checkpoint,
+                                             fd=fd, prefix=prefix,
+                                             readahead=readahead)
+        finally:
+            if f is not file:
+                f.close()
+
+    if return_checkpoint:
+        arr, end = arr
+        result = _postprocess(arr, ndmin, unpack)
+        return result, Checkpoint(*end)
+    return _postprocess(arr, ndmin, unpack)
+
 
+def _postprocess(arr, ndmin, unpack):
     if ndmin is not None:
         # Handle non-None ndmin like np.loadtxt.  Might change this eventually?
         # Tweak the size and shape of the arrays - remove extraneous dimensions
@@ -1,9 +1,16 @@
+import os
 from os import path
-from io import StringIO
+import gzip
+import socket
+import subprocess
+import sys
+import threading
+from io import StringIO, BytesIO
+from pathlib import Path
 import pytest
 import numpy as np
 from numpy.testing import assert_array_equal, assert_equal
-from npreadtext import read
+from npreadtext import read, Checkpoint
 
 
 def _get_full_name(basename):
@@ -95,6 +102,39 @@ def test_quoted_field():
     assert_array_equal(a, expected)
 
 
+@pytest.mark.parametrize('wrap', [StringIO, lambda s: BytesIO(s.encode()),
+                                  lambda s: _SmallChunks(StringIO(s), 5)])
+@pytest.mark.parametrize('delimiter', [',', ';', ' '])
+def test_quoted_field_contents(wrap, delimiter):
+    # The inside of a quoted field is scanned in bulk, up to a quote or a
+    # control character; the rules for those must not change.
+    fields = ['"plain text, long enough to span blocks of the scan"',
+              '"tab\there"', '"doubled ""quotes"" inside"',
+              '"closed"then_text', '"new\r\nline"', '"Zoë, Åsa"', '""']
+    txt = delimiter.join(fields) + '\n' + delimiter.join(['"x"'] * 7)
+    a = read(wrap(txt), delimiter=delimiter, dtype='U60')
+    assert_equal(a, [['plain text, long enough to span blocks of the scan',
+                      'tab\there', 'doubled "quotes" inside',
+                      'closedthen_text', 'new\nline', 'Zoë, Åsa', ''],
+                     ['x'] * 7])
+
+
+@pytest.mark.parametrize('wrap', [StringIO, lambda s: BytesIO(s.encode())])
+@pytest.mark.parametrize('delimiter', [',', ' '])
+def test_doubled_quote_after_other_fields(wrap, delimiter):
+    # After a doubled quote, the field is stored apart from the input; the
+    # fields before it (in this row and the previous ones) must not end up
+    # inside it, whether the input is used up (a non-ASCII character) or
+    # ends right after the field.
+    d = delimiter
+    txt = f'a{d}b{d}c\nname{d}"say ""Zoë"""{d}1\nabc{d}"""x"{d}2'
+    a = read(wrap(txt), delimiter=delimiter, dtype='U30')
+    assert_equal(a, [['a', 'b', 'c'], ['name', 'say "Zoë"', '1'],
+                     ['abc', '"x', '2']])
+    a = read(wrap(f'abc{d}"""x"'), delimiter=delimiter, dtype='U30')
+    assert_equal(a, [['abc', '"x']])
+
+
 @pytest.mark.parametrize('explicit_dtype', [False, True])
 @pytest.mark.parametrize('skiprows', [0, 1, 3])
 def test_dtype_and_skiprows(explicit_dtype: bool, skiprows: int):
@@ -198,6 +238,50 @@ def test_blank_lines():
                              dtype=np.uint8))
 
 
+@pytest.mark.parametrize('wrap', [StringIO, lambda s: s.encode(),
+                                  lambda s: _SmallChunks(BytesIO(s.encode()),
+                                                         5)])
+def test_whitespace_delimiter_blanks(wrap):
+    # With delimiter=' ', any run of spaces and tabs separates the fields,
+    # and the blanks at the start and end of a line are ignored.
+    txt = (' \t1.5\t\t 2 \t  "a b"\n'
+           '3' + ' ' * 40 + '4\t\t\t\t' + '\t' * 40 + '"c\td"  \t\r\n'
+           '\t \n'
+           '5 6\tx\t\t')
+    a = read(wrap(txt), delimiter=' ', dtype='U')
+    assert_equal(a, [['1.5', '2', 'a b'], ['3', '4', 'c\td'],
+                     ['5', '6', 'x']])
+
+
+def test_whitespace_delimiter_ignore_blank_lines():
+    txt = '1 2\n\n3 4\n \t \n5 6\n'
+    a = read(StringIO(txt), delimiter=' ', ignore_blank_lines=True)
+    assert_equal(a, [[1, 2], [3, 4], [5, 6]])
+    # Otherwise a blank line is a row with no fields.
+    with pytest.raises(ValueError, match='Number of fields changed'):
+        read(StringIO(txt), delimiter=' ', ignore_blank_lines=False)
+    a = read(StringIO('1 2\n3 4\n'), delimiter=' ',
+             ignore_blank_lines=False)
+    assert_equal(a, [[1, 2], [3, 4]])
+
+
+@pytest.mark.parametrize('wrap', [StringIO, lambda s: BytesIO(s.encode()),
+                                  lambda s: _SmallChunks(StringIO(s), 7)])
+def test_skiprows_and_comment_lines_count_lines(wrap):
+    # The skipped lines are found in bulk, but the line numbers must still
+    # be counted.
+    txt = (''.join('# comment %d\n' % i for i in range(1000)) +
+           ''.join('%d,%d\r\n' % (i, i) for i in range(300)) + '1,x\n')
+    a = read(wrap(txt), dtype=np.float64, skiprows=1100, max_rows=2)
+    assert_equal(a, [[100, 100], [101, 101]])
+    a = read(wrap(txt), dtype=np.float64, skiprows=1301)
+    assert_equal(a.size, 0)
+    with pytest.raises(RuntimeError, match='line 1301, field 2'):
+        read(wrap(txt), dtype=np.float64)
+    with pytest.raises(RuntimeError, match='line 1301, field 2'):
+        read(wrap(txt), dtype=np.float64, skiprows=1299)
+
+
 def test_max_rows():
     txt = StringIO('1.5,2.5\n3.0,4.0\n5.5,6.0')
     a = read(txt, dtype=np.float64, max_rows=2)
@@ -205,6 +289,17 @@ def test_max_rows():
     assert_equal(a, np.array([[1.5, 2.5], [3.0, 4.0]]))
 
 
+def test_max_rows_blank_column():
+    # With dtype=None, only max_rows rows are analyzed; a column that is
+    # blank in all of them is read as strings.
+    a = read(StringIO(' \nfoo\n'), max_rows=1)
+    assert_equal(a, np.array([[b' ']]))
+    a = read(StringIO('1,,3\n4,5,6\n'), max_rows=1)
+    assert a.dtype.names == ('f0', 'f1', 'f2')
+    assert a.dtype['f1'] == np.dtype('S1')
+    assert_equal(a.tolist(), [(1, b'', 3)])
+
+
 @pytest.mark.parametrize('dtype', [np.dtype('f8'), np.dtype('i2')])
 def test_bad_values(dtype):
     txt = StringIO('1.5,2.5\n3.0,XXX\n5.5,6.0')
@@ -226,6 +321,57 @@ def test_converters_and_usecols():
     assert_equal(a, [[1.5, 3.5], [3.0, np.nan], [5.5, 7.5]])
 
 
+@pytest.mark.parametrize('wrap', [StringIO,
+                                  lambda s: _SmallChunks(StringIO(s), 3)])
+@pytest.mark.parametrize('delimiter', [',', ';', ' '])
+def test_usecols_skips_unused_fields(wrap, delimiter):
+    # The fields after the last column in usecols are skipped, but the
+    # quoted newlines and comments in them must still be honoured.
+    rows = [['1', 'a', '2', '"x{d}\n""y"""', '3'],
+            ['4', '"b{d}c"', '5', '6 # c{d}c"'],
+            ['7', 'd', '8', '"', '9"'],
+            ['10', 'e', '11']]
+    txt = '\n'.join(delimiter.join(row) for row in rows).format(d=delimiter)
+    a = read(wrap(txt), delimiter=delimiter, dtype='U3', usecols=[2, 0])
+    assert_equal(a, [['2', '1'], ['5', '4'], ['8', '7'], ['11', '10']])
+    a = read(wrap(txt), delimiter=delimiter, dtype=np.float64,
+             usecols=[0, 0])
+    assert_equal(a, [[1, 1], [4, 4], [7, 7], [10, 10]])
+    with pytest.raises(RuntimeError, match='invalid column index'):
+        read(wrap(txt), delimiter=delimiter, dtype='U3', usecols=[0, 3])
+
+
+@pytest.mark.parametrize('max_rows', [None, 9000])
+def test_rows_converted_in_batches(max_rows):
+    # The rows are tokenized and converted in batches of many rows; the
+    # results, and the line of the first error, must not depend on where
+    # the batches end.
+    n = 10000
+    txt = ''.join(f'{i},{i / 4},{i % 7}\n' for i in range(n))
+    dt = np.dtype([('a', np.int32), ('b', np.float64), ('c', np.uint8)])
+    a = read(StringIO(txt), dtype=dt, max_rows=max_rows)
+    m = n if max_rows is None else max_rows
+    assert_equal(a['a'], np.arange(m))
+    assert_equal(a['b'], np.arange(m) / 4)
+    assert_equal(a['c'], np.arange(m) % 7)
+    a = read(StringIO(txt), dtype=np.int64, usecols=[2, 0],
+             max_rows=max_rows)
+    assert_equal(a, np.column_stack((np.arange(m) % 7, np.arange(m))))
+
+    # A string dtype without a length grows with a field late in the file.
+    a = read(StringIO(txt + 'abcdefghijkl,1,2\n'), dtype='S')
+    assert a.dtype == np.dtype('S12')
+    assert_equal(a[-1], [b'abcdefghijkl', b'1', b'2'])
+    assert_equal(a[:n, 0], np.arange(n).astype('S12'))
+
+    with pytest.raises(RuntimeError, match='line 5001, field 2'):
+        read(StringIO(txt[:txt.index('5000,')] + '1,x,3\n' + txt),
+             dtype=np.float64)
+    with pytest.raises(ValueError, match='changed, line 5002'):
+        read(StringIO(txt[:txt.index('5000,')] + '1,2\n' + txt),
+             dtype=np.float64)
+
+
 def test_unicode_with_converter():
     txt = StringIO('cat,dog\nαβγ,δεζ\nabc,def\n')
     conv = {0: lambda s: s.upper()}
@@ -329,3 +475,582 @@ def test_read_from_generator_2():
     data = read(gen(), dtype='i,d', delimiter=' ')
     expected = np.array([(0, 0.0), (1, 0.25), (2, 0.5)], dtype='i,d')
     assert_equal(data, expected)
+
+
+def test_read_from_generator_without_dtype():
+
+    def gen():
+        for i in range(100000):
+            yield f'{i},{i / 4}'
+
+    # The generator is consumed once; the data is spooled for the second
+    # pass.
+    a = read(gen())
+    assert_equal(a['f0'], np.arange(100000))
+    assert_equal(a['f1'], np.arange(100000) / 4)
+
+
+def test_read_filename_crlf(tmp_path):
+    filename = tmp_path / 'crlf.csv'
+    filename.write_bytes(b'1.5,2.5\r\n3.0,4.0\r\n5.5,6.0\r\n')
+    a = read(str(filename))
+    assert_equal(a, [[1.5, 2.5], [3.0, 4.0], [5.5, 6.0]])
+
+
+def test_read_filename_empty(tmp_path):
+    filename = tmp_path / 'empty.csv'
+    filename.write_bytes(b'')
+    a = read(str(filename))
+    assert a.shape == (0, 0)
+
+
+@pytest.mark.skipif(not hasattr(os, 'mkfifo'), reason='requires os.mkfifo')
+def test_read_filename_fifo(tmp_path):
+    # A FIFO can not be memory-mapped, so this exercises the fallback
+    # to the buffered file stream.
+    filename = tmp_path / 'fifo'
+    os.mkfifo(filename)
+
+    # The writer must be a separate process: the reader holds the GIL
+    # while it waits for the FIFO to be opened.
+    code = f"open({str(filename)!r}, 'w').write('1,2,3\\n4,5,6\\n')"
+    writer = subprocess.Popen([sys.executable, '-c', code])
+    a = read(str(filename), dtype=np.int32)
+    writer.wait()
+    assert_equal(a, [[1, 2, 3], [4, 5, 6]])
+
+
+@pytest.mark.parametrize('encoding', ['utf-8', 'UTF8', 'latin-1', 'cp1252'])
+def test_read_filename_encoding(tmp_path, encoding):
+    filename = tmp_path / 'unicode.csv'
+    content = 'Åsa,1.5\nDvořák,2.5\nZoë,3.5\n'
+    if encoding == 'cp1252' or encoding == 'latin-1':
+        content = content.replace('ř', 'r')
+    filename.write_text(content, encoding=encoding)
+    dt = np.dtype([('name', 'U8'), ('x', np.float64)])
+    a = read(str(filename), dtype=dt, encoding=encoding)
+    expected = np.array([tuple(line.split(',')) for line
+                         in content.splitlines()], dtype=dt)
+    assert_equal(a, expected)
+
+
+def test_read_filename_utf8_analyze(tmp_path):
+    filename = tmp_path / 'unicode.csv'
+    filename.write_text('1,αβγ\n2,δ\n', encoding='utf-8')
+    a = read(str(filename), encoding='utf-8')
+    assert_equal(a['f0'], [1, 2])
+    # 'S' fields hold one byte per character.
+    assert a.dtype['f1'] == np.dtype('S3')
+
+
+@pytest.mark.parametrize('dtype', [None, 'U8'])
+@pytest.mark.parametrize('encoding,data', [('utf-8', b'1,abc\n2,\xe9t\xe9\n'),
+                                           ('ascii', b'1,abc\n2,caf\xc3\xa9\n')])
+def test_read_filename_invalid_encoded_data(tmp_path, dtype, encoding, data):
+    filename = tmp_path / 'bad.csv'
+    filename.write_bytes(data)
+    with pytest.raises(UnicodeError):
+        read(str(filename), dtype=dtype, encoding=encoding)
+
+
+class _SmallChunks:
+    # File-like object whose read() returns at most `size` items, so the
+    # lines (and multibyte characters) straddle the chunk boundaries.
+    def __init__(self, f, size):
+        self._f = f
+        self._size = size
+
+    def read(self, n=-1):
+        return self._f.read(min(n, self._size))
+
+
+@pytest.mark.parametrize('size', [1, 3, 7])
+@pytest.mark.parametrize('wrap', [StringIO, lambda s: BytesIO(s.encode())])
+def test_read_file_object_small_chunks(size, wrap):
+    content = '1.5,Åsa\n2.5,Dvořák\n3.5,Zoë\n'
+    f = _SmallChunks(wrap(content), size)
+    dt = np.dtype([('x', np.float64), ('name', 'U8')])
+    a = read(f, dtype=dt, encoding='utf-8')
+    expected = np.array([(1.5, 'Åsa'), (2.5, 'Dvořák'), (3.5, 'Zoë')],
+                        dtype=dt)
+    assert_equal(a, expected)
+
+
+def test_read_file_object_unseekable_analyze():
+    # Without a dtype, the data is read twice; a file that can not be
+    # rewound is spooled during the first pass.
+    f = _SmallChunks(StringIO('1,2\n3,4\n'), 100)
+    assert_equal(read(f), [[1, 2], [3, 4]])
+
+
+@pytest.mark.parametrize('encoding', ['utf-8', 'latin-1', 'cp1252'])
+def test_read_binary_file_object_encoding(encoding):
+    content = 'Åsa,1\nZoë,2\n€,3\n'
+    if encoding == 'latin-1':
+        content = content.replace('€', 'E')
+    f = BytesIO(content.encode(encoding))
+    a = read(f, encoding=encoding)
+    assert_equal(a['f1'], [1, 2, 3])
+    dt = np.dtype([('name', 'U4'), ('x', np.int32)])
+    f.seek(0)
+    a = read(f, dtype=dt, encoding=encoding)
+    assert_equal(a['name'], [line.split(',')[0]
+                             for line in content.splitlines()])
+
+
+@pytest.mark.parametrize('wrap', [bytes, bytearray, memoryview])
+def test_read_bytes_like(wrap):
+    data = wrap(b'1.5,2.5\n# comment\n3.5,4.5\n')
+    a = read(data)
+    assert_equal(a, [[1.5, 2.5], [3.5, 4.5]])
+    a = read(data, dtype=np.float32, skiprows=1)
+    assert_equal(a, np.array([[3.5, 4.5]], dtype=np.float32))
+
+
+def test_read_bytes_like_mmap(tmp_path):
+    import mmap
+    filename = tmp_path / 'data.csv'
+    filename.write_bytes(b'1,2,3\n4,5,6\n')
+    with open(filename, 'rb') as f:
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+            a = read(m, dtype=np.int32)
+    assert_equal(a, [[1, 2, 3], [4, 5, 6]])
+
+
+@pytest.mark.parametrize('encoding', [None, 'utf-8', 'cp1252'])
+def test_read_bytes_encoding(encoding):
+    content = 'Zoë,1\n€,2\n'
+    data = content.encode(encoding or 'utf-8')
+    dt = np.dtype([('name', 'U4'), ('x', np.int32)])
+    a = read(data, dtype=dt, encoding=encoding)
+    assert_equal(a['name'], ['Zoë', '€'])
+    assert_equal(a['x'], [1, 2])
+
+
+def test_read_bytes_not_contiguous():
+    data = memoryview(b'1,2\n3,4\n')[::2]
+    with pytest.raises(BufferError):
+        read(data)
+
+
+@pytest.mark.parametrize('name', ['data.csv.gz', 'data.csv'])
+def test_read_gzip(tmp_path, name):
+    import gzip
+    filename = tmp_path / name
+    content = ''.join(f'{i},{i / 4}\n' for i in range(5000))
+    # Two gzip members, concatenated.
+    filename.write_bytes(gzip.compress(content[:1000].encode()) +
+                         gzip.compress(content[1000:].encode()))
+    a = read(str(filename))
+    assert_equal(a['f0'], np.arange(5000))
+    assert_equal(a['f1'], np.arange(5000) / 4)
+
+
+def test_read_gzip_empty(tmp_path):
+    import gzip
+    filename = tmp_path / 'empty.csv.gz'
+    filename.write_bytes(gzip.compress(b''))
+    a = read(str(filename))
+    assert a.shape == (0, 0)
+
+
+def test_read_gzip_truncated(tmp_path):
+    import gzip
+    filename = tmp_path / 'truncated.csv.gz'
+    data = gzip.compress(b'1,2\n3,4\n' * 1000)
+    filename.write_bytes(data[:len(data) // 2])
+    with pytest.raises(RuntimeError):
+        read(str(filename), dtype=np.int32)
+
+
+@pytest.mark.parametrize('module,ext', [('lzma', '.xz'), ('bz2', '.bz2')])
+def test_read_xz_bz2(tmp_path, module, ext):
+    mod = pytest.importorskip(module)
+    filename = tmp_path / ('data.csv' + ext)
+    content = ''.join(f'{i},{i / 4}\n' for i in range(5000))
+    # Two compressed streams, concatenated.
+    filename.write_bytes(mod.compress(content[:1000].encode()) +
+                         mod.compress(content[1000:].encode()))
+    a = read(str(filename))
+    assert_equal(a['f0'], np.arange(5000))
+    assert_equal(a['f1'], np.arange(5000) / 4)
+
+
+@pytest.mark.parametrize('module', ['lzma', 'bz2'])
+def test_read_xz_bz2_truncated(tmp_path, module):
+    from npreadtext import _readtextmodule
+    if not getattr(_readtextmodule, 'have_' + module):
+        pytest.skip(f'built without {module} support')
+    mod = pytest.importorskip(module)
+    filename = tmp_path / 'truncated.csv'
+    data = mod.compress(b'1,2\n3,4\n' * 1000)
+    filename.write_bytes(data[:len(data) // 2])
+    with pytest.raises(RuntimeError):
+        read(str(filename), dtype=np.int32)
+
+
+@pytest.mark.parametrize('compress', [False, True])
+def test_read_readahead(tmp_path, compress):
+    import gzip
+    filename = tmp_path / 'data.csv'
+    # Several read-ahead blocks (2 MiB each) of data.
+    content = ''.join(f'{i},{i / 4}\n' for i in range(300000))
+    data = content.encode()
+    if compress:
+        data = gzip.compress(data)
+    filename.write_bytes(data)
+    a = read(str(filename), readahead=2)
+    assert_equal(a['f0'], np.arange(300000))
+    assert_equal(a['f1'], np.arange(300000) / 4)
+
+
+def test_read_readahead_fifo(tmp_path):
+    if not hasattr(os, 'mkfifo'):
+        pytest.skip('requires os.mkfifo')
+    filename = tmp_path / 'fifo'
+    os.mkfifo(filename)
+    code = f"open({str(filename)!r}, 'w').write('1,2,3\\n4,5,6\\n')"
+    writer = subprocess.Popen([sys.executable, '-c', code])
+    a = read(str(filename), dtype=np.int32, readahead=4)
+    writer.wait()
+    assert_equal(a, [[1, 2, 3], [4, 5, 6]])
+
+
+def test_read_readahead_negative():
+    with pytest.raises(ValueError):
+        read('unused.csv', readahead=-1)
+
+
+@pytest.mark.parametrize('direct_io', [False, True])
+@pytest.mark.parametrize('depth', [1, 3])
+def test_read_uring(tmp_path, depth, direct_io):
+    filename = tmp_path / 'data.csv'
+    # Several 2 MiB blocks, and a size that is not a multiple of 4096.
+    content = ''.join(f'{i},{i / 4}\n' for i in range(300001))
+    filename.write_text(content)
+    a = read(str(filename), uring=depth, direct_io=direct_io)
+    assert_equal(a['f0'], np.arange(300001))
+    assert_equal(a['f1'], np.arange(300001) / 4)
+
+
+@pytest.mark.parametrize('dtype', [None, np.float64])
+@pytest.mark.parametrize('compress', [False, True])
+@pytest.mark.parametrize('access_hints', ['sequential',
+                                          ['willneed', 'hugepages'],
+                                          ('sequential', 'dontneed')])
+def test_read_access_hints(tmp_path, access_hints, compress, dtype):
+    filename = tmp_path / 'data.csv'
+    # Larger than a huge page (2 MiB).
+    content = ''.join(f'{i}.0,{i / 4}\n' for i in range(200000))
+    data = content.encode()
+    if compress:
+        data = gzip.compress(data)
+    filename.write_bytes(data)
+    a = read(str(filename), dtype=dtype, access_hints=access_hints)
+    assert_equal(a[:, 0], np.arange(200000))
+    assert_equal(a[:, 1], np.arange(200000) / 4)
+
+
+def test_read_access_hints_invalid():
+    with pytest.raises(ValueError, match='invalid access hint'):
+        read('unused.csv', access_hints=['sequential', 'random'])
+
+
+@pytest.mark.parametrize('kind', ['filename', 'bytes', 'StringIO'])
+def test_read_long_fields(tmp_path, kind):
+    # Runs of plain characters of every length up to a few vector blocks,
+    # ended by each of the characters that the bulk scanner stops at.
+    lines = []
+    expected = []
+    for i in range(130):
+        end = '\r\n' if i % 2 else '\n'
+        if i % 3 == 0:
+            end = '#x' + end
+        lines.append(f'{"a" * i}{i};{"b" * (130 - i)}é;"q,{"c" * i}"{end}')
+        expected.append([f'{"a" * i}{i}', 'b' * (130 - i) + 'é',
+                         'q,' + 'c' * i])
+    content = ''.join(lines)
+    if kind == 'filename':
+        filename = tmp_path / 'data.csv'
+        filename.write_text(content, encoding='utf-8')
+        file = str(filename)
+    elif kind == 'bytes':
+        file = content.encode()
+    else:
+        file = StringIO(content)
+    a = read(file, delimiter=';', dtype='U', encoding='utf-8')
+    assert_equal(a, np.array(expected))
+
+
+@pytest.mark.parametrize('kind', ['filename', 'bytes', 'StringIO'])
+@pytest.mark.parametrize('encoding', ['utf-8', 'latin-1'])
+def test_read_non_ascii_fields(tmp_path, kind, encoding):
+    # The tokenizer stores the fields as UTF-8, whatever the encoding of
+    # the input.  The lengths of 'U' fields count characters, and 'S'
+    # fields keep one byte per character (as in Latin-1).
+    content = 'café,1.5,¿qué?\nété,2.5,x\n'
+
+    def make_file():
+        if kind == 'filename':
+            filename = tmp_path / 'data.csv'
+            filename.write_text(content, encoding=encoding)
+            return str(filename)
+        elif kind == 'bytes':
+            return content.encode(encoding)
+        return StringIO(content)
+
+    a = read(make_file(), dtype='U', encoding=encoding)
+    assert a.dtype == np.dtype('U5')
+    assert_equal(a, [['café', '1.5', '¿qué?'], ['été', '2.5', 'x']])
+
+    a = read(make_file(), encoding=encoding)
+    assert a.dtype == np.dtype([('f0', 'S4'), ('f1', 'f8'), ('f2', 'S5')])
+    assert_equal(a['f0'], ['café'.encode('latin-1'), 'été'.encode('latin-1')])
+    assert_equal(a['f1'], [1.5, 2.5])
+    assert_equal(a['f2'], ['¿qué?'.encode('latin-1'), b'x'])
+
+
+def test_unicode_converter_and_quotes():
+    txt = StringIO('"é,😀",1\n"x",2\n')
+    a = read(txt, dtype='U3', converters={0: lambda s: s[::-1]})
+    assert_equal(a, [['😀,é', '1'], ['x', '2']])
+
+
+@pytest.mark.parametrize('size', [None, 1, 5, 64])
+@pytest.mark.parametrize('delimiter', [',', ' '])
+def test_read_fields_in_place_and_copied(size, delimiter):
+    # Plain fields are used where they are in the input; fields with
+    # doubled quotes, or split over two reads, are copied.
+    d = delimiter
+    rows = [['12.5', 'abc', 'x"y', 'AB'],
+            ['-3', 'a b\nc', '""', 'AB   CD'],
+            ['7e3', 'é', 'q', '"']]
+    lines = [f'12.5{d}abc{d}"x""y"{d}"A"B',
+             f'-3{d}"a b\nc"{d}""""""{d}"AB   CD"',
+             f'7e3{d}é{d}"q"{d}""""']
+    content = ''.join(line + '\n' for line in lines) * 3
+    f = BytesIO(content.encode())
+    if size is not None:
+        f = _SmallChunks(f, size)
+    a = read(f, delimiter=delimiter, dtype='U', encoding='utf-8')
+    assert_equal(a, np.array(rows * 3))
+
+    f = BytesIO(content.encode())
+    if size is not None:
+        f = _SmallChunks(f, size)
+    a = read(f, delimiter=delimiter, dtype=np.float64, usecols=[0],
+             encoding='utf-8')
+    assert_equal(a, np.array([[12.5], [-3], [7e3]] * 3))
+
+
+@pytest.mark.parametrize('delimiter', [',', ' '])
+@pytest.mark.parametrize('dtype', [np.int64, None])
+def test_read_token_index_grows(delimiter, dtype):
+    # The rows' fields are stored in one array, reused for every row and
+    # grown when a row has more fields than any before it.
+    ncols = [1, 40, 3, 700, 5]
+    lines = [delimiter.join(str(100*i + k) for k in range(n))
+             for i, n in enumerate(ncols)]
+    for i, n in enumerate(ncols):
+        txt = StringIO('\n'.join(lines[:i] + [lines[i]] * 2) + '\n')
+        a = read(txt, delimiter=delimiter, dtype=dtype, usecols=[0])
+        assert_equal(a[:, 0], [100*j for j in range(i)] + [100*i] * 2)
+
+    txt = StringIO((lines[3] + '\n') * 3)
+    a = read(txt, delimiter=delimiter, dtype=dtype)
+    assert_equal(a, np.tile(np.arange(300, 1000), (3, 1)))
+
+
+@pytest.mark.parametrize('wrap', [lambda s: s.encode(), StringIO,
+                                  lambda s: _SmallChunks(BytesIO(s.encode()),
+                                                         1000)])
+def test_read_no_field_or_row_length_limit(wrap):
+    # There is no fixed limit on the number of fields in a row, or on the
+    # length of the text of a row.
+    n = 50000
+    line = ','.join(str(k) for k in range(n)) + '\n'
+    a = read(wrap(line * 2), dtype=np.int32)
+    assert_equal(a, np.tile(np.arange(n, dtype=np.int32), (2, 1)))
+
+    # Fields with doubled quotes are copied (whatever the input), and the
+    # buffer holding them grows while the row is read.
+    fields = ['x' * 5000 + '"', 'y' * 20000, '"' * 3 + 'z' * 30000, 'w']
+    line = ','.join('"' + f.replace('"', '""') + '"' for f in fields) + '\n'
+    a = read(wrap(line * 2), dtype='U')
+    assert_equal(a, np.array([fields] * 2))
+
+
+@pytest.mark.parametrize('delimiter', [',', ';'])
+@pytest.mark.parametrize('quote', ['"', "'", ''])
+@pytest.mark.parametrize('comment', ['#', '//', ''])
+def test_read_tokenizer_variants(delimiter, quote, comment):
+    # Each combination is read by a tokenizer specialized for it (quotes or
+    # not, no comment, one or two characters); all must agree.
+    d, q, c = delimiter, quote, comment
+    txt = ((f'{c} a comment line\n' if c else '') +
+           f'1{d}{q}a b{q}{d}z\n'
+           f'2{d}"p"{d}r\n'
+           f'3{d}v{d}s#t\n'
+           f'4{d}v{d}s/t//u\n'
+           f"5{d}'x''y'{d}w\n")
+    expected = [['1', 'a b', 'z'],
+                ['2', 'p' if q == '"' else '"p"', 'r'],
+                ['3', 'v', 's' if c == '#' else 's#t'],
+                ['4', 'v', 's/t' if c == '//' else 's/t//u'],
+                ['5', "x'y" if q == "'" else "'x''y'", 'w']]
+    a = read(StringIO(txt), delimiter=d, quote=q, comment=c, dtype='U')
+    assert_equal(a, np.array(expected))
+
+
+def test_float_conversion_many_digits():
+    # Numbers for which the fast path of the float parser applies (at most
+    # 2**53 and a power of ten up to 22), and numbers just outside of it.
+    rng = np.random.default_rng(12345)
+    x = rng.uniform(-1e6, 1e6, size=2000)
+    strings = [repr(v) for v in x]
+    strings += [f'{v:.3f}' for v in x[:500]]
+    strings += [f'{v:.10e}' for v in x[:500]]
+    strings += ['9007199254740993', '9007199254740992e-22', '1e23',
+                '123456789012345678901', '0.000000000000000000000001',
+                '4.9e-324', '1.7976931348623157e308']
+    txt = StringIO('\n'.join(strings))
+    a = read(txt, dtype=np.float64)
+    expected = np.array([float(s) for s in strings]).reshape((len(strings), 1))
+    assert_equal(a, expected)
+
+
+def _read_in_pieces(make_file, rows_per_piece, **kwargs):
+    pieces = []
+    cp = None
+    while True:
+        a, cp = read(make_file(), checkpoint=cp, max_rows=rows_per_piece,
+                     return_checkpoint=True, **kwargs)
+        if len(a) == 0:
+            return np.concatenate(pieces), cp
+        pieces.append(a)
+
+
+@pytest.mark.parametrize('dtype', [None, np.float64])
+@pytest.mark.parametrize('kind', ['filename', 'gzip', 'bytes', 'StringIO',
+                                  'BytesIO'])
+def test_read_checkpoint_pieces(tmp_path, kind, dtype):
+    content = '# header\n' + ''.join(f'{i}.0,{i / 2}\n' for i in range(1000))
+    filename = tmp_path / 'data.csv'
+    if kind == 'gzip':
+        filename = tmp_path / 'data.csv.gz'
+        with gzip.open(filename, 'wt') as f:
+            f.write(content)
+    else:
+        filename.write_text(content)
+    make_file = {'filename': lambda: str(filename),
+                 'gzip': lambda: str(filename),
+                 'bytes': lambda: content.encode(),
+                 'StringIO': lambda: StringIO(content),
+                 'BytesIO': lambda: BytesIO(content.encode())}[kind]
+    a, cp = _read_in_pieces(make_file, 300, dtype=dtype)
+    assert_equal(a, np.column_stack((np.arange(1000), np.arange(1000) / 2)))
+    assert cp == Checkpoint(len(content), 1002)
+
+
+def test_read_checkpoint_line_numbers():
+    content = b'1,2\n3,4\n5,6\nx,8\n'
+    a, cp = read(content, max_rows=2, dtype=float, return_checkpoint=True)
+    assert_equal(a, [[1, 2], [3, 4]])
+    assert cp == (8, 3)
+    with pytest.raises(RuntimeError, match='line 4'):
+        read(content, checkpoint=cp, dtype=float)
+
+
+def test_read_checkpoint_out_of_range():
+    with pytest.raises(ValueError):
+        read(b'1,2\n', checkpoint=Checkpoint(100, 1))
+    with pytest.raises(ValueError):
+        read(b'1,2\n', checkpoint=Checkpoint(0, 0))
+
+
+class _BytesPath:
+    # A path-like object whose path is bytes.
+    def __init__(self, path):
+        self._path = os.fsencode(path)
+
+    def __fspath__(self):
+        return self._path
+
+
+@pytest.mark.parametrize('wrap', [Path, _BytesPath])
+@pytest.mark.parametrize('compressed', [False, True])
+def test_read_pathlike(tmp_path, wrap, compressed):
+    content = '1,2,3\n4,5,6\n'
+    if compressed:
+        filename = tmp_path / 'data.csv.gz'
+        with gzip.open(filename, 'wt') as f:
+            f.write(content)
+    else:
+        filename = tmp_path / 'data.csv'
+        filename.write_text(content)
+    a = read(wrap(filename), dtype=np.int32)
+    assert_equal(a, [[1, 2, 3], [4, 5, 6]])
+
+
+def test_read_pathlike_undecodable_name(tmp_path):
+    if sys.platform == 'win32':
+        pytest.skip('requires bytes file names')
+    dirname = os.fsencode(tmp_path)
+    filename = os.path.join(dirname, b'data\xff.csv')
+    try:
+        with open(filename, 'w') as f:
+            f.write('1,2\n')
+    except (OSError, UnicodeError):
+        pytest.skip('file system does not allow undecodable names')
+    assert_equal(read(_BytesPath(filename), dtype=int), [[1, 2]])
+
+
+def _cat_process(filename, content):
+    # A process that writes content to its stdout pipe.
+    filename.write_text(content)
+    code = f"import sys; sys.stdout.write(open({str(filename)!r}).read())"
+    return subprocess.Popen([sys.executable, '-c', code],
+                            stdout=subprocess.PIPE)
+
+
+@pytest.mark.parametrize('dtype', [None, np.float64])
+def test_read_pipe(tmp_path, dtype):
+    content = ''.join(f'{i}.0,{i / 2}\n' for i in range(100000))
+    p = _cat_process(tmp_path / 'data.csv', '# header\n' + content)
+    # The line read here is in the file object's buffer, along with (some
+    # of) the data; the reader must start right after it.
+    assert p.stdout.readline() == b'# header\n'
+    a = read(p.stdout, dtype=dtype)
+    p.wait()
+    assert_equal(a, np.column_stack((np.arange(100000),
+                                     np.arange(100000) / 2)))
+
+
+def test_read_pipe_readahead_checkpoint(tmp_path):
+    content = ''.join(f'{i},{i + 1}\n' for i in range(1000))
+    p = _cat_process(tmp_path / 'data.csv', content)
+    a = read(p.stdout, dtype=int, readahead=2, checkpoint=Checkpoint(8, 3))
+    p.wait()
+    assert_equal(a[0], [2, 3])
+    assert len(a) == 998
+
+
+@pytest.mark.parametrize('dtype', [None, np.int64])
+def test_read_socket(dtype):
+    content = ''.join(f'{i},{i + 1}\n' for i in range(50000)).encode()
+    s1, s2 = socket.socketpair()
+
+    def write():
+        s1.sendall(content)
+        s1.close()
+
+    # The peer is a thread, so the reader must not hold the GIL while it
+    # waits for data.
+    writer = threading.Thread(target=write)
+    writer.start()
+    try:
+        a = read(s2, dtype=dtype)
+    finally:
+        writer.join()
+        s2.close()
+    assert_equal(a, np.column_stack((np.arange(50000), np.arange(1, 50001))))
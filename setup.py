@@ -26,6 +26,34 @@ with open('README.rst', 'r') as f:
     _long_descr = f.read()
 
 
+def have_library(header, library, symbol):
+    """
+    Return True if `symbol` (declared in `header`) can be used, linking
+    with `library` (None if no library is needed).  Used for the optional
+    features.
+    """
+    import os
+    import tempfile
+    from distutils.ccompiler import new_compiler
+    from distutils.errors import CompileError, LinkError
+    from distutils.sysconfig import customize_compiler
+
+    compiler = new_compiler()
+    customize_compiler(compiler)
+    with tempfile.TemporaryDirectory() as tmpdir:
+        src = os.path.join(tmpdir, 'check.c')
+        with open(src, 'w') as f:
+            f.write(f'#include <{header}>\n'
+                    f'int main(void) {{ (void) {symbol}; return 0; }}\n')
+        try:
+            objs = compiler.compile([src], output_dir=tmpdir)
+            compiler.link_executable(objs, os.path.join(tmpdir, 'check'),
+                                     libraries=[library] if library else [])
+        except (CompileError, LinkError):
+            return False
+    return True
+
+
 def configuration(parent_package='', top_path=None):
     from numpy.distutils.misc_util import Configuration
 
@@ -36,10 +64,31 @@ def configuration(parent_package='', top_path=None):
               'rows.c', 'tokenize.c',
               'conversions.c', 'str_to.c', 'str_to_int.c', 'str_to_double.c',
               'pow10table.c',
-              'stream_file.c', 'stream_python_file_by_line.c', 'blocks.c',
+              'stream_buffered.c', 'stream_file.c', 'stream_memory.c',
+              'stream_mmap.c', 'stream_buffer.c', 'stream_gzip.c',
+              'stream_uring.c', 'stream_fd.c',
+              'stream_python_file_by_line.c', 'stream_python_file_by_chunk.c',
+              'readahead.c', 'spool.c', 'hints.c', 'encoding.c', 'scan.c',
+              'blocks.c',
               'char32utils.c', 'field_types.c', 'dtoa_modified.c']
+    libraries = ['z', 'pthread']
+    macros = []
+    # xz and bzip2 support is optional.
+    if have_library('lzma.h', 'lzma', 'lzma_stream_decoder'):
+        cfiles.append('stream_xz.c')
+        libraries.append('lzma')
+        macros.append(('HAVE_LZMA', None))
+    if have_library('bzlib.h', 'bz2', 'BZ2_bzDecompressInit'):
+        cfiles.append('stream_bz2.c')
+        libraries.append('bz2')
+        macros.append(('HAVE_BZ2', None))
+    # Without io_uring, the uring stream reads with pread().
+    if have_library('linux/io_uring.h', None, 'IORING_OP_READV'):
+        macros.append(('HAVE_IO_URING', None))
     config.add_extension('npreadtext._readtextmodule',
-                         sources=[path.join('src', t) for t in cfiles])
+                         sources=[path.join('src', t) for t in cfiles],
+                         libraries=libraries,
+                         define_macros=macros)
     return config
 
 
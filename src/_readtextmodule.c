@@ -11,7 +11,21 @@
 
 #include "parser_config.h"
 #include "stream_file.h"
+#include "stream_fd.h"
+#include "stream_mmap.h"
+#include "stream_gzip.h"
+#include "stream_uring.h"
+#include "hints.h"
+#ifdef HAVE_LZMA
+#include "stream_xz.h"
+#endif
+#ifdef HAVE_BZ2
+#include "stream_bz2.h"
+#endif
+#include "encoding.h"
 #include "stream_python_file_by_line.h"
+#include "stream_python_file_by_chunk.h"
+#include "stream_buffer.h"
 #include "field_types.h"
 #include "analyze.h"
 #include "rows.h"
@@ -33,6 +47,10 @@ raise_analyze_exception(int nrows, char *filename)
         }
     }
     else if (nrows == ANALYZE_FILE_ERROR) {
+        if (PyErr_Occurred()) {
+            // The stream's Python file object raised an exception.
+            return;
+        }
         if (filename) {
             PyErr_Format(PyExc_RuntimeError,
                          "File error while analyzing '%s'", filename);
@@ -41,6 +59,16 @@ raise_analyze_exception(int nrows, char *filename)
                          "File error while analyzing file.");
         }
     }
+    else if (nrows == ANALYZE_DECODING_ERROR) {
+        if (filename) {
+            PyErr_Format(PyExc_UnicodeError,
+                         "Invalid data for the encoding while analyzing '%s'",
+                         filename);
+        } else {
+            PyErr_Format(PyExc_UnicodeError,
+                         "Invalid data for the encoding while analyzing file.");
+        }
+    }
     else {
         if (filename) {
             PyErr_Format(PyExc_RuntimeError,
@@ -83,6 +111,18 @@ raise_read_exception(read_error_type *read_error)
                      "converter failed; line %d, field %d",
                      read_error->line_number, read_error->field_number + 1);
     }
+    else if (read_error->error_type == ERROR_STREAM) {
+        if (!PyErr_Occurred()) {
+            PyErr_Format(PyExc_RuntimeError,
+                         "line %d: error while reading the file",
+                         read_error->line_number);
+        }
+    }
+    else if (read_error->error_type == ERROR_DECODING) {
+        PyErr_Format(PyExc_UnicodeError,
+                     "line %d: invalid data for the encoding",
+                     read_error->line_number);
+    }
     else {
         // Some other error type
         PyErr_Format(PyExc_RuntimeError, "line %d: error type %d",
@@ -91,6 +131,62 @@ raise_read_exception(read_error_type *read_error)
 }
 
 
+//
+// A position in a stream: the offset returned by stream_tell(), and the line
+// number at that offset.  read() exposes it as a Checkpoint, so a file can
+// be read in pieces, or the reading resumed after a failure.
+//
+typedef struct _checkpoint {
+    long int offset;
+    int line_number;
+} checkpoint;
+
+
+//
+// Convert the `checkpoint` argument of the _readtext_* functions to *cp.
+// `obj` must be None (the start of the file) or a tuple (offset, line_number).
+//
+// Returns -1, with an exception set, if `obj` is not valid.
+//
+static int
+checkpoint_from_pyobj(PyObject *obj, checkpoint *cp)
+{
+    cp->offset = 0;
+    cp->line_number = 1;
+    if (obj == Py_None) {
+        return 0;
+    }
+    if (!PyTuple_Check(obj) ||
+            !PyArg_ParseTuple(obj, "li", &(cp->offset), &(cp->line_number))) {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_TypeError,
+                        "checkpoint must be a tuple (offset, line_number)");
+        return -1;
+    }
+    if (cp->offset < 0 || cp->line_number < 1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "invalid checkpoint: offset must be nonnegative, "
+                        "and line_number must be positive");
+        return -1;
+    }
+    return 0;
+}
+
+
+//
+// Returns the array `arr`, or the tuple (arr, (offset, line_number)) if
+// return_checkpoint is true.  The reference to `arr` is stolen.
+//
+static PyObject *
+_result_with_checkpoint(PyObject *arr, int return_checkpoint, checkpoint *end)
+{
+    if (arr == NULL || !return_checkpoint) {
+        return arr;
+    }
+    return Py_BuildValue("N(li)", arr, end->offset, end->line_number);
+}
+
+
 //
 // `usecols` must point to a Python object that is Py_None or a 1-d contiguous
 // numpy array with data type int32.
@@ -107,11 +203,19 @@ raise_read_exception(read_error_type *read_error)
 // If `dtype` is given and it is compound, and `usecols` is None, then the
 // number of columns in the file must match the number of fields in `dtype`.
 //
+// Reading starts at the position `start` (skiprows is counted from there).
+// On success, *end is set to the position after the last row read.
+//
+// `hints` (HINT_* flags, see hints.h) are used for the allocation of the
+// rows when the number of rows is not known in advance.
+//
 static PyObject *
 _readtext_from_stream(stream *s, char *filename, parser_config *pc,
+                      checkpoint *start, checkpoint *end,
                       PyObject *usecols, int skiprows, int max_rows,
                       PyObject *converters,
-                      PyObject *dtype, int num_dtype_fields, char *codes, int32_t *sizes)
+                      PyObject *dtype, int num_dtype_fields, char *codes, int32_t *sizes,
+                      int hints)
 {
     PyObject *arr = NULL;
     int32_t *cols;
@@ -124,6 +228,16 @@ _readtext_from_stream(stream *s, char *filename, parser_config *pc,
     bool homogeneous;
     npy_intp shape[2];
 
+    if ((start->offset != 0 || start->line_number != 1) &&
+            stream_seek(s, start->offset, start->line_number) != 0) {
+        if (!PyErr_Occurred()) {
+            PyErr_Format(PyExc_ValueError,
+                         "Unable to seek to offset %ld of the file",
+                         start->offset);
+        }
+        return NULL;
+    }
+
     if (dtype == Py_None) {
         // Make the first pass of the file to analyze the data type
         // and count the number of rows.
@@ -131,19 +245,41 @@ _readtext_from_stream(stream *s, char *filename, parser_config *pc,
         // based on the types of the data that it finds in the file.
         // XXX Note that analyze() does not use the usecols data--it
         // analyzes (and fills in ft for) all the columns in the file.
-        nrows = analyze(s, pc, skiprows, -1, &num_fields, &ft);
+        nrows = analyze(s, pc, skiprows, max_rows, &num_fields, &ft);
         if (nrows < 0) {
             raise_analyze_exception(nrows, filename);
             return NULL;
         }
-        stream_seek(s, 0);
         if (nrows == 0) {
             // Empty file, and a dtype was not given.  In this case, return
             // an array with shape (0, 0) and data type float64.
             npy_intp dims[2] = {0, 0};
+            free(ft);
+            end->offset = stream_tell(s);
+            end->line_number = stream_linenumber(s);
             arr = PyArray_SimpleNew(2, dims, NPY_FLOAT64);
             return arr;
         }
+        for (int k = 0; k < num_fields; ++k) {
+            if (ft[k].typecode == '*') {
+                // The field was blank in every row that was analyzed (e.g.
+                // only max_rows of them).  Read it as a string, the type
+                // classify_type() gives to a field that is not a number.
+                ft[k].typecode = 'S';
+                if (ft[k].itemsize == 0) {
+                    ft[k].itemsize = 1;
+                }
+            }
+        }
+        if (stream_seek(s, start->offset, start->line_number) != 0) {
+            free(ft);
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_RuntimeError,
+                             "Unable to rewind the file for the second pass; "
+                             "give the dtype to read it in one pass.");
+            }
+            return NULL;
+        }
     }
     else {
         // A dtype was given.
@@ -208,7 +344,7 @@ _readtext_from_stream(stream *s, char *filename, parser_config *pc,
         void *result = read_rows(s, &num_rows, num_fields, ft, pc,
                                  cols, ncols, skiprows,
                                  converters,
-                                 PyArray_DATA(arr),
+                                 PyArray_DATA(arr), 0,
                                  &num_cols, &read_error);
         if (read_error.error_type != 0) {
             free(ft);
@@ -228,7 +364,7 @@ _readtext_from_stream(stream *s, char *filename, parser_config *pc,
                                    (ft[0].typecode == 'U')));
         void *result = read_rows(s, &num_rows, num_fields, ft, pc,
                                  cols, ncols, skiprows, converters,
-                                 NULL, &num_cols, &read_error);
+                                 NULL, hints, &num_cols, &read_error);
         if (read_error.error_type != 0) {
             free(ft);
             raise_read_exception(&read_error);
@@ -282,10 +418,46 @@ _readtext_from_stream(stream *s, char *filename, parser_config *pc,
 
     free(ft);
 
+    end->offset = stream_tell(s);
+    end->line_number = stream_linenumber(s);
     return arr;
 }
 
 
+//
+// Convert the `encoding` argument of _readtext_from_filename to one of the
+// ENCODING_* constants.  `encoding` must be None or the normalized name of
+// a codec (i.e. the `name` attribute of the object returned by
+// codecs.lookup()).  None means the file is read as raw bytes, with each
+// byte being one character.
+//
+// Returns -1, with an exception set, if the encoding can not be decoded
+// by the C streams.
+//
+static int
+encoding_from_pyobj(PyObject *encoding)
+{
+    if (encoding == Py_None) {
+        return ENCODING_LATIN1;
+    }
+    if (!PyUnicode_Check(encoding)) {
+        PyErr_SetString(PyExc_TypeError, "encoding must be None or a str");
+        return -1;
+    }
+    if (PyUnicode_CompareWithASCIIString(encoding, "utf-8") == 0) {
+        return ENCODING_UTF8;
+    }
+    if (PyUnicode_CompareWithASCIIString(encoding, "iso8859-1") == 0) {
+        return ENCODING_LATIN1;
+    }
+    if (PyUnicode_CompareWithASCIIString(encoding, "ascii") == 0) {
+        return ENCODING_ASCII;
+    }
+    PyErr_Format(PyExc_ValueError, "unsupported encoding %R", encoding);
+    return -1;
+}
+
+
 static PyObject *
 _readtext_from_filename(PyObject *self, PyObject *args, PyObject *kwargs)
 {
@@ -294,7 +466,10 @@ _readtext_from_filename(PyObject *self, PyObject *args, PyObject *kwargs)
                              "usecols", "skiprows",
                              "max_rows", "converters",
                              "dtype", "codes", "sizes",
-                             "encoding", NULL};
+                             "encoding", "readahead", "uring", "direct_io",
+                             "checkpoint", "return_checkpoint", "hints",
+                             "ignore_blank_lines", NULL};
+    PyObject *filename_bytes;
     char *filename;
     char *delimiter = ",";
     char *comment = "#";
@@ -311,7 +486,16 @@ _readtext_from_filename(PyObject *self, PyObject *args, PyObject *kwargs)
     PyObject *dtype;
     PyObject *codes;
     PyObject *sizes;
-    PyObject *encoding;
+    PyObject *encoding = Py_None;
+    int enc;
+    int readahead = 0;
+    int uring = 0;
+    int direct_io = 0;
+    PyObject *start_obj = Py_None;
+    int return_checkpoint = 0;
+    checkpoint start, end;
+    int hints = 0;
+    int ignore_blank_lines = 1;
 
     char *codes_ptr = NULL;
     int32_t *sizes_ptr = NULL;
@@ -321,11 +505,28 @@ _readtext_from_filename(PyObject *self, PyObject *args, PyObject *kwargs)
     PyObject *arr = NULL;
     int num_dtype_fields;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|$ssssssOiiOOOOO", kwlist,
-                                     &filename, &delimiter, &comment, &quote,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|$ssssssOiiOOOOOiipOpip", kwlist,
+                                     PyUnicode_FSConverter, &filename_bytes, &delimiter, &comment, &quote,
                                      &decimal, &sci, &imaginary_unit, &usecols, &skiprows,
                                      &max_rows, &converters,
-                                     &dtype, &codes, &sizes, &encoding)) {
+                                     &dtype, &codes, &sizes, &encoding,
+                                     &readahead, &uring, &direct_io,
+                                     &start_obj, &return_checkpoint, &hints,
+                                     &ignore_blank_lines)) {
+        return NULL;
+    }
+    // The filename (a str, bytes or os.PathLike object) encoded with the
+    // file system encoding.
+    filename = PyBytes_AS_STRING(filename_bytes);
+
+    if (checkpoint_from_pyobj(start_obj, &start) != 0) {
+        Py_DECREF(filename_bytes);
+        return NULL;
+    }
+
+    enc = encoding_from_pyobj(encoding);
+    if (enc == -1) {
+        Py_DECREF(filename_bytes);
         return NULL;
     }
 
@@ -340,7 +541,7 @@ _readtext_from_filename(PyObject *self, PyObject *args, PyObject *kwargs)
     pc.allow_embedded_newline = true;
     pc.ignore_leading_spaces = false;
     pc.ignore_trailing_spaces = false;
-    pc.ignore_blank_lines = true;
+    pc.ignore_blank_lines = ignore_blank_lines;
     pc.strict_num_fields = false;
 
     if (dtype == Py_None) {
@@ -360,18 +561,60 @@ _readtext_from_filename(PyObject *self, PyObject *args, PyObject *kwargs)
         sizes_ptr = PyArray_DATA(sizes);
     }
 
-    stream *s = stream_file_from_filename(filename, buffer_size);
+    // A compressed stream is used if the file starts with the magic bytes
+    // of one of the compression formats.
+    // With readahead > 0, the file is read (and decompressed) by a
+    // background thread.  `hints` are the HINT_* flags for the kernel.
+    stream *s = stream_gzip_from_filename(filename, buffer_size, enc,
+                                          readahead, hints);
+#ifdef HAVE_LZMA
+    if (s == NULL) {
+        s = stream_xz_from_filename(filename, buffer_size, enc, readahead,
+                                    hints);
+    }
+#endif
+#ifdef HAVE_BZ2
+    if (s == NULL) {
+        s = stream_bz2_from_filename(filename, buffer_size, enc, readahead,
+                                     hints);
+    }
+#endif
+    if (s == NULL && uring > 0) {
+        s = stream_uring_from_filename(filename, buffer_size, enc, uring,
+                                       direct_io, hints);
+    }
+    if (s == NULL) {
+        // A pipe, FIFO or device.  Without a dtype, the data is spooled
+        // to a temporary file for the second pass.
+        s = stream_fd_from_filename(filename, buffer_size, enc,
+                                    dtype == Py_None, readahead);
+    }
+    if (s == NULL && readahead == 0 && !(hints & HINT_DONTNEED)) {
+        // (The pages of a mapping can not be dropped from the page cache
+        // while the file is read, so HINT_DONTNEED uses fread().)
+        s = stream_mmap_from_filename(filename, enc, hints);
+    }
+    if (s == NULL) {
+        // Not a regular file, mmap() failed, or read-ahead was requested,
+        // so read the file into a buffer with fread().
+        s = stream_file_from_filename(filename, buffer_size, enc, readahead,
+                                      hints);
+    }
     if (s == NULL) {
         PyErr_Format(PyExc_RuntimeError, "Unable to open '%s'", filename);
+        Py_DECREF(filename_bytes);
         return NULL;
     }
 
-    arr = _readtext_from_stream(s, filename, &pc, usecols, skiprows, max_rows,
+    arr = _readtext_from_stream(s, filename, &pc, &start, &end,
+                                usecols, skiprows, max_rows,
                                 converters,
-                                dtype, num_dtype_fields, codes_ptr, sizes_ptr);
+                                dtype, num_dtype_fields, codes_ptr, sizes_ptr,
+                                hints);
 
     stream_close(s, RESTORE_NOT);
-    return arr;
+    Py_DECREF(filename_bytes);
+    return _result_with_checkpoint(arr, return_checkpoint, &end);
 }
 
 
@@ -383,7 +626,9 @@ _readtext_from_file_object(PyObject *self, PyObject *args, PyObject *kwargs)
                              "usecols", "skiprows",
                              "max_rows", "converters",
                              "dtype", "codes", "sizes",
-                             "encoding", NULL};
+                             "encoding", "checkpoint", "return_checkpoint",
+                             "fd", "prefix", "readahead", "ignore_blank_lines",
+                             NULL};
     PyObject *file;
     char *delimiter = ",";
     char *comment = "#";
@@ -399,20 +644,36 @@ _readtext_from_file_object(PyObject *self, PyObject *args, PyObject *kwargs)
     PyObject *dtype;
     PyObject *codes;
     PyObject *sizes;
-    PyObject *encoding;
+    PyObject *encoding = Py_None;
+    PyObject *start_obj = Py_None;
+    int return_checkpoint = 0;
+    checkpoint start, end;
+    int fd = -1;
+    const char *prefix = NULL;
+    Py_ssize_t prefix_len = 0;
+    int readahead = 0;
+    int ignore_blank_lines = 1;
 
     char *codes_ptr = NULL;
     int32_t *sizes_ptr = NULL;
 
     parser_config pc;
+    int buffer_size = 1 << 21;
     PyObject *arr = NULL;
     int num_dtype_fields;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$ssssssOiiOOOOO", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$ssssssOiiOOOOOOpiy#ip", kwlist,
                                      &file, &delimiter, &comment, &quote,
                                      &decimal, &sci, &imaginary_unit, &usecols, &skiprows,
                                      &max_rows, &converters,
-                                     &dtype, &codes, &sizes, &encoding)) {
+                                     &dtype, &codes, &sizes, &encoding,
+                                     &start_obj, &return_checkpoint,
+                                     &fd, &prefix, &prefix_len, &readahead,
+                                     &ignore_blank_lines)) {
+        return NULL;
+    }
+
+    if (checkpoint_from_pyobj(start_obj, &start) != 0) {
         return NULL;
     }
 
@@ -427,7 +688,7 @@ _readtext_from_file_object(PyObject *self, PyObject *args, PyObject *kwargs)
     pc.allow_embedded_newline = true;
     pc.ignore_leading_spaces = false;
     pc.ignore_trailing_spaces = false;
-    pc.ignore_blank_lines = true;
+    pc.ignore_blank_lines = ignore_blank_lines;
     pc.strict_num_fields = false;
 
     if (dtype == Py_None) {
@@ -447,17 +708,74 @@ _readtext_from_file_object(PyObject *self, PyObject *args, PyObject *kwargs)
         sizes_ptr = PyArray_DATA(sizes);
     }
 
-    stream *s = stream_python_file_by_line(file, encoding);
-    if (s == NULL) {
-        PyErr_Format(PyExc_RuntimeError, "Unable to access the file.");
-        return NULL;
+    stream *s;
+    if (fd >= 0) {
+        // A pipe, socket or terminal: read the file descriptor directly.
+        // `prefix` holds the data that the file object has already read
+        // from it.  Without a dtype, the data is spooled to a temporary
+        // file for the second pass.
+        int enc = ENCODING_UTF8;
+        if (encoding != Py_None) {
+            enc = encoding_from_pyobj(encoding);
+            if (enc == -1) {
+                return NULL;
+            }
+        }
+        s = stream_fd(fd, (const uint8_t *) prefix, prefix_len, buffer_size,
+                      enc, dtype == Py_None, readahead);
+        if (s == NULL) {
+            PyErr_Format(PyExc_MemoryError,
+                         "Unable to create the stream for the file.");
+            return NULL;
+        }
+    }
+    else if (PyObject_CheckBuffer(file)) {
+        // bytes, bytearray, memoryview, mmap, ...: read the data in place.
+        int enc = ENCODING_UTF8;
+        if (encoding != Py_None) {
+            enc = encoding_from_pyobj(encoding);
+            if (enc == -1) {
+                return NULL;
+            }
+        }
+        s = stream_buffer(file, enc);
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+    else if (PyObject_HasAttrString(file, "read")) {
+        // Read the file in large blocks.  Bytes that are not in one of the
+        // encodings handled by the stream are decoded in Python (enc == -1).
+        // If the file can not be rewound (e.g. a pipe or a generator) and
+        // the dtype is not given, the data is spooled for the second pass.
+        int enc = ENCODING_UTF8;
+        if (encoding != Py_None) {
+            enc = encoding_from_pyobj(encoding);
+            if (enc == -1) {
+                PyErr_Clear();
+            }
+        }
+        s = stream_python_file_by_chunk(file, enc, encoding, buffer_size,
+                                        dtype == Py_None);
+        if (s == NULL) {
+            return NULL;
+        }
+    }
+    else {
+        s = stream_python_file_by_line(file, encoding);
+        if (s == NULL) {
+            PyErr_Format(PyExc_RuntimeError, "Unable to access the file.");
+            return NULL;
+        }
     }
 
-    arr = _readtext_from_stream(s, NULL, &pc, usecols, skiprows, max_rows,
+    arr = _readtext_from_stream(s, NULL, &pc, &start, &end,
+                                usecols, skiprows, max_rows,
                                 converters,
-                                dtype, num_dtype_fields, codes_ptr, sizes_ptr);
+                                dtype, num_dtype_fields, codes_ptr, sizes_ptr,
+                                0);
     stream_close(s, RESTORE_NOT);
-    return arr;
+    return _result_with_checkpoint(arr, return_checkpoint, &end);
 }
 
 
@@ -500,6 +818,27 @@ PyInit__readtextmodule(void)
 
     // Create module
     m = PyModule_Create(&moduledef);
+    if (m == NULL) {
+        return NULL;
+    }
+
+    // Which compressed files _readtext_from_filename can read.
+#ifdef HAVE_LZMA
+    PyModule_AddIntConstant(m, "have_lzma", 1);
+#else
+    PyModule_AddIntConstant(m, "have_lzma", 0);
+#endif
+#ifdef HAVE_BZ2
+    PyModule_AddIntConstant(m, "have_bz2", 1);
+#else
+    PyModule_AddIntConstant(m, "have_bz2", 0);
+#endif
+
+    // The flags of the `hints` argument of _readtext_from_filename.
+    PyModule_AddIntConstant(m, "HINT_SEQUENTIAL", HINT_SEQUENTIAL);
+    PyModule_AddIntConstant(m, "HINT_WILLNEED", HINT_WILLNEED);
+    PyModule_AddIntConstant(m, "HINT_DONTNEED", HINT_DONTNEED);
+    PyModule_AddIntConstant(m, "HINT_HUGE_PAGES", HINT_HUGE_PAGES);
 
     return m;
 }
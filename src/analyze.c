@@ -14,6 +14,7 @@
 #include "type_inference.h"
 #include "stream.h"
 #include "char32utils.h"
+#include "error_types.h"
 
 
 typedef struct {
@@ -71,8 +72,11 @@ int enlarge_type_tracking_arrays(int new_num_fields, int num_fields,
  *  ------------
  *  row_count > 0: number of rows. row_count might be less than numrows if the
  *      end of the file is reached.
- *  ANALYZE_FILE_ERROR:    unable to create a file buffer.
+ *  ANALYZE_FILE_ERROR:    unable to create a file buffer, or an error
+ *                         occurred while reading the stream.
  *  ANALYZE_OUT_OF_MEMORY: out of memory (malloc failed)
+ *  ANALYZE_DECODING_ERROR: the stream contains data that is not valid
+ *                         for its encoding.
  *  ...
  */
 
@@ -95,10 +99,8 @@ int analyze(stream *s, parser_config *pconfig, int skiplines, int numrows,
         return 0;
     }
 
-    char32_t *word_buffer = malloc(WORD_BUFFER_SIZE*sizeof(char32_t));
-    if (word_buffer == NULL) {
-        return ANALYZE_OUT_OF_MEMORY;
-    }
+    token_index tokens;
+    token_index_init(&tokens, pconfig);
 
     // In this loop, types[k].itemsize will track the largest field length
     // encountered for field k, regardless of the apparent type of the field
@@ -111,11 +113,21 @@ int analyze(stream *s, parser_config *pconfig, int skiplines, int numrows,
     while (row_count != numrows) {
         int new_num_fields;
         int tok_error_type;
-        char32_t **result;
+        field_span *result;
 
-        result = tokenize(s, word_buffer, WORD_BUFFER_SIZE,
-                          pconfig, &new_num_fields, &tok_error_type);
+        result = tokenize(s, pconfig, &tokens, &new_num_fields,
+                          &tok_error_type);
         if (result == NULL) {
+            if (tok_error_type == ERROR_STREAM ||
+                    tok_error_type == ERROR_DECODING ||
+                    tok_error_type == ERROR_OUT_OF_MEMORY) {
+                token_index_free(&tokens);
+                free(types);
+                free(ranges);
+                return (tok_error_type == ERROR_STREAM) ? ANALYZE_FILE_ERROR :
+                       (tok_error_type == ERROR_DECODING) ? ANALYZE_DECODING_ERROR
+                                                          : ANALYZE_OUT_OF_MEMORY;
+            }
             break;
         }
 
@@ -126,8 +138,7 @@ int analyze(stream *s, parser_config *pconfig, int skiplines, int numrows,
             if (status != 0) {
                 // If this occurs, types and ranges have been freed in
                 // enlarge_type_tracking_array().
-                free(result);
-                free(word_buffer);
+                token_index_free(&tokens);
                 //fb_del(fb, RESTORE_INITIAL);
                 return ANALYZE_OUT_OF_MEMORY;
             }
@@ -139,7 +150,8 @@ int analyze(stream *s, parser_config *pconfig, int skiplines, int numrows,
             int field_len;
             int64_t imin;
             uint64_t umax;
-            typecode = classify_type(result[k], decimal, sci, imaginary_unit,
+            typecode = classify_type(result[k].p, result[k].len,
+                                     decimal, sci, imaginary_unit,
                                      &imin, &umax,
                                      types[k].typecode);
             if (typecode == 'q' && imin < ranges[k].imin) {
@@ -151,16 +163,15 @@ int analyze(stream *s, parser_config *pconfig, int skiplines, int numrows,
             if (typecode != '*') {
                 types[k].typecode = typecode;
             }
-            field_len = strlen32(result[k]);
+            field_len = utf8_strlen(result[k].p, result[k].len);
             if (field_len > types[k].itemsize) {
                 types[k].itemsize = field_len;
             }
         }
-        free(result);
         ++row_count;
     }
 
-    free(word_buffer);
+    token_index_free(&tokens);
 
     // At this point, any field that contained only unsigned integers
     // or only integers (some negative) has been classified as typecode='Q'
@@ -9,6 +9,7 @@
 
 #define ANALYZE_FILE_ERROR    -1
 #define ANALYZE_OUT_OF_MEMORY -2
+#define ANALYZE_DECODING_ERROR -3
 
 int analyze(stream *s, parser_config *pconfig, int skiplines, int numrows,
             int *num_fields, field_type **field_types);
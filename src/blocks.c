@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "blocks.h"
+#include "hints.h"
 
 //
 // Diagram for blocks data
@@ -19,6 +20,8 @@
 // +--------------------------+
 // | char **block_table       +-----+
 // +--------------------------+     |
+// | int hints                |     |
+// +--------------------------+     |
 //                                  |
 //  +-------------------------------+
 //  |
@@ -50,12 +53,16 @@
 //     The number of rows in each block
 // int block_table_length
 //     The initial length of the table of pointers to blocks.
+// int hints
+//     HINT_* flags (see hints.h) for the allocation of the blocks and
+//     of the contiguous copy made by blocks_to_contiguous().
 //
 // Returns NULL if a memory allocation fails.
 //
 
 blocks_data *
-blocks_init(int row_size, int rows_per_block, int block_table_length)
+blocks_init(int row_size, int rows_per_block, int block_table_length,
+            int hints)
 {
     blocks_data *b;
 
@@ -66,6 +73,7 @@ blocks_init(int row_size, int rows_per_block, int block_table_length)
     b->row_size = row_size;
     b->block_table_length = block_table_length;
     b->rows_per_block = rows_per_block;
+    b->hints = hints;
     b->block_table = calloc(block_table_length, sizeof(void *));
     if (b->block_table == NULL) {
         free(b);
@@ -129,7 +137,7 @@ blocks_get_row_ptr(blocks_data *b, size_t k)
     if (b->block_table[block_number] == NULL) {
         // Haven't allocated this block yet...
         int block_size = b->row_size * rows_per_block;
-        b->block_table[block_number] = malloc(block_size);
+        b->block_table[block_number] = hints_malloc(block_size, b->hints);
         if (b->block_table[block_number] == NULL) {
             return NULL;
         }
@@ -189,7 +197,7 @@ char *
 blocks_to_contiguous(blocks_data *b, size_t num_rows)
 {
     size_t actual_size = num_rows * b->row_size;
-    char *data = malloc(actual_size);
+    char *data = hints_malloc(actual_size, b->hints);
     if (data == NULL) {
         return NULL;
     }
@@ -220,7 +228,7 @@ int main(int argc, char *argv[])
 
     int num_rows = 26;
 
-    blocks_data *b = blocks_init(row_size, rows_per_block, block_table_length);
+    blocks_data *b = blocks_init(row_size, rows_per_block, block_table_length, 0);
     if (b == NULL) {
         fprintf(stderr, "blocks_init returned NULL\n");
         exit(-1);
@@ -8,11 +8,13 @@ typedef struct _blocks_data
     int rows_per_block;
     int block_table_length;
     char **block_table;
+    int hints;
 } blocks_data;
 
 
 blocks_data *
-blocks_init(int row_size,  int rows_per_block, int block_table_length);
+blocks_init(int row_size,  int rows_per_block, int block_table_length,
+            int hints);
 
 void
 blocks_destroy(blocks_data *b);
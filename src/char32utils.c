@@ -1,4 +1,6 @@
 
+#include <stdlib.h>
+
 #include "char32utils.h"
 
 
@@ -35,4 +37,128 @@ long long strtoll32(char32_t *s, char32_t **p)
     *p = s;
     result *= sign;
     return result;
-}
\ No newline at end of file
+}
+
+/*
+ *  The tokenizer stores the fields as UTF-8 (each character that it gets
+ *  from the stream is encoded, whatever the encoding of the stream), so
+ *  the functions below do not have to check that the bytes are valid.
+ *  Surrogates (which can come from a Python file object) are encoded like
+ *  any other character.
+ */
+
+/*
+ *  Encode c in dst, and return the number of bytes used (1 to 4).
+ */
+int utf8_encode(char32_t c, uint8_t *dst)
+{
+    if (c < 0x80) {
+        dst[0] = (uint8_t) c;
+        return 1;
+    }
+    if (c < 0x800) {
+        dst[0] = (uint8_t) (0xC0 | (c >> 6));
+        dst[1] = (uint8_t) (0x80 | (c & 0x3F));
+        return 2;
+    }
+    if (c < 0x10000) {
+        dst[0] = (uint8_t) (0xE0 | (c >> 12));
+        dst[1] = (uint8_t) (0x80 | ((c >> 6) & 0x3F));
+        dst[2] = (uint8_t) (0x80 | (c & 0x3F));
+        return 3;
+    }
+    dst[0] = (uint8_t) (0xF0 | (c >> 18));
+    dst[1] = (uint8_t) (0x80 | ((c >> 12) & 0x3F));
+    dst[2] = (uint8_t) (0x80 | ((c >> 6) & 0x3F));
+    dst[3] = (uint8_t) (0x80 | (c & 0x3F));
+    return 4;
+}
+
+
+/*
+ *  Decode the character at s, and set *len to the number of bytes used.
+ */
+char32_t utf8_decode_char(const uint8_t *s, int *len)
+{
+    char32_t c = s[0];
+
+    if (c < 0x80) {
+        *len = 1;
+        return c;
+    }
+    if (c < 0xE0) {
+        *len = 2;
+        return ((c & 0x1F) << 6) | (s[1] & 0x3F);
+    }
+    if (c < 0xF0) {
+        *len = 3;
+        return ((c & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+    }
+    *len = 4;
+    return ((c & 0x07) << 18) | ((s[1] & 0x3F) << 12) |
+           ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+}
+
+
+/*
+ *  The number of characters in the len bytes at s.
+ */
+size_t utf8_strlen(const uint8_t *s, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; ++i) {
+        // Count every byte that is not a continuation byte.
+        count += ((s[i] & 0xC0) != 0x80);
+    }
+    return count;
+}
+
+
+/*
+ *  Decode the len bytes at s into dst.  At most max characters are
+ *  stored (no terminating nul is stored).  Returns the number of
+ *  characters stored.
+ */
+size_t utf8_decode(const uint8_t *s, size_t len, char32_t *dst, size_t max)
+{
+    const uint8_t *end = s + len;
+    size_t n = 0;
+
+    while (n < max && s < end) {
+        if (*s < 0x80) {
+            dst[n] = *s;
+            ++s;
+        }
+        else {
+            int clen;
+            dst[n] = utf8_decode_char(s, &clen);
+            s += clen;
+        }
+        ++n;
+    }
+    return n;
+}
+
+
+/*
+ *  Decode the len bytes at s to a nul-terminated char32_t string.  The
+ *  result is stored in buffer if it fits (buffer_len is the number of
+ *  char32_t in buffer); otherwise it is stored in memory allocated here,
+ *  and the caller must free it.  Returns NULL if the allocation fails.
+ */
+char32_t *utf8_to_char32(const uint8_t *s, size_t len,
+                         char32_t *buffer, size_t buffer_len)
+{
+    size_t n = utf8_strlen(s, len);
+    char32_t *result = buffer;
+
+    if (n + 1 > buffer_len) {
+        result = malloc((n + 1) * sizeof(char32_t));
+        if (result == NULL) {
+            return NULL;
+        }
+    }
+    utf8_decode(s, len, result, n);
+    result[n] = '\0';
+    return result;
+}
@@ -2,10 +2,21 @@
 #define CHAR32UTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "typedefs.h"
 
+// The maximum number of bytes in the UTF-8 encoding of a character.
+#define UTF8_MAX_LEN 4
+
 size_t strlen32(char32_t *s);
 long long strtoll32(char32_t *s, char32_t **p);
 
+int utf8_encode(char32_t c, uint8_t *dst);
+char32_t utf8_decode_char(const uint8_t *s, int *len);
+size_t utf8_strlen(const uint8_t *s, size_t len);
+size_t utf8_decode(const uint8_t *s, size_t len, char32_t *dst, size_t max);
+char32_t *utf8_to_char32(const uint8_t *s, size_t len,
+                         char32_t *buffer, size_t buffer_len);
+
 #endif
@@ -14,9 +14,231 @@ double
 _Py_dg_strtod_modified(const char32_t *s00, char32_t **se, int *error,
                        char32_t decimal, char32_t sci, bool skip_trailing);
 
+// pow10table[k] is 10**k, for k = 0, 1, ..., 308.
+extern double pow10table[];
+
+/*
+ *  The conversions work on the fields as produced by the tokenizer: `len`
+ *  bytes of UTF-8, not nul-terminated.  Most numbers are parsed directly
+ *  from the bytes by fast_strtod(); the others are decoded to a char32_t
+ *  string and handed to _Py_dg_strtod_modified().
+ */
+
+#define FAST_OK         0
+#define FAST_NO_DIGITS  1
+#define FAST_FALLBACK   2
+
+// The largest significand for which every integer is exactly representable.
+#define FAST_MAX_SIGNIFICAND (1ULL << 53)
+
+// 10**k is exactly representable for k <= 22.
+#define FAST_MAX_EXP 22
+
 /*
- *  `item` must be the nul-terminated string that is to be
- *  converted to a double.
+ *  The byte at s, or 0 at the end of the field.
+ */
+static inline int
+byte_at(const uint8_t *s, const uint8_t *end)
+{
+    return (s < end) ? *s : 0;
+}
+
+static inline bool
+digit_at(const uint8_t *s, const uint8_t *end)
+{
+    return s < end && '0' <= *s && *s <= '9';
+}
+
+/*
+ *  Parse the number in [s00, end) with the same syntax as
+ *  _Py_dg_strtod_modified() (and set *se to the end of the number in the
+ *  same way).  The result is only computed here when it is exact with one
+ *  multiplication or division (the "fast path" of Clinger's algorithm): the
+ *  significand, without leading zeros, is at most 2**53 and the decimal
+ *  exponent is at most 22 in magnitude.  Returns FAST_FALLBACK in all the
+ *  other cases (including any non-ASCII byte where the parse stops, or
+ *  non-ASCII `decimal` or `sci`), without setting *value or *se.
+ *
+ *  Returns FAST_NO_DIGITS if there are no digits; *se is then s00.
+ */
+static int
+fast_strtod(const uint8_t *s00, const uint8_t *end, const uint8_t **se,
+            double *value, char32_t decimal, char32_t sci, bool skip_trailing)
+{
+    const uint8_t *s = s00;
+    uint64_t m = 0;
+    int nd = 0;
+    int e = 0;
+    bool neg = false;
+    bool digits = false;
+
+    if (decimal >= 0x80 || sci >= 0x80) {
+        return FAST_FALLBACK;
+    }
+
+    while (s < end && isspace(*s)) {
+        ++s;
+    }
+    if (byte_at(s, end) == '-') {
+        neg = true;
+        ++s;
+    }
+    else if (byte_at(s, end) == '+') {
+        ++s;
+    }
+
+    // Leading zeros don't count as significant digits.
+    while (byte_at(s, end) == '0') {
+        digits = true;
+        ++s;
+    }
+    while (digit_at(s, end)) {
+        if (nd == 19) {
+            return FAST_FALLBACK;
+        }
+        m = 10*m + (*s - '0');
+        ++nd;
+        digits = true;
+        ++s;
+    }
+    if (s < end && *s == decimal) {
+        ++s;
+        if (nd == 0) {
+            while (byte_at(s, end) == '0') {
+                digits = true;
+                --e;
+                ++s;
+            }
+        }
+        while (digit_at(s, end)) {
+            if (nd == 19) {
+                return FAST_FALLBACK;
+            }
+            m = 10*m + (*s - '0');
+            ++nd;
+            --e;
+            digits = true;
+            ++s;
+        }
+    }
+    if (byte_at(s, end) >= 0x80) {
+        return FAST_FALLBACK;
+    }
+    if (!digits) {
+        *se = s00;
+        return FAST_NO_DIGITS;
+    }
+
+    if (s < end && (char32_t) toupper(*s) == sci) {
+        const uint8_t *s_sci = s;
+        bool eneg = false;
+        int x = 0;
+
+        ++s;
+        if (byte_at(s, end) == '-') {
+            eneg = true;
+            ++s;
+        }
+        else if (byte_at(s, end) == '+') {
+            ++s;
+        }
+        if (digit_at(s, end)) {
+            while (digit_at(s, end)) {
+                if (x < 100000) {
+                    x = 10*x + (*s - '0');
+                }
+                ++s;
+            }
+            e += eneg ? -x : x;
+        }
+        else {
+            // Not an exponent; the number ends before the sci character.
+            s = s_sci;
+        }
+    }
+
+    if (skip_trailing) {
+        while (s < end && isspace(*s)) {
+            ++s;
+        }
+    }
+    if (byte_at(s, end) >= 0x80) {
+        return FAST_FALLBACK;
+    }
+
+    if (m == 0) {
+        *value = neg ? -0.0 : 0.0;
+    }
+    else if (m <= FAST_MAX_SIGNIFICAND && e >= -FAST_MAX_EXP && e <= FAST_MAX_EXP) {
+        double x = (double) m;
+        x = (e < 0) ? x / pow10table[-e] : x * pow10table[e];
+        *value = neg ? -x : x;
+    }
+    else {
+        return FAST_FALLBACK;
+    }
+    *se = s;
+    return FAST_OK;
+}
+
+/*
+ *  Like _Py_dg_strtod_modified(), for the UTF-8 bytes in [s, end).
+ */
+static double
+strtod_bytes(const uint8_t *s, const uint8_t *end, const uint8_t **se,
+             int *error, char32_t decimal, char32_t sci, bool skip_trailing)
+{
+    double x = 0.0;
+    char32_t buffer[64];
+    char32_t *s32;
+    char32_t *p_end;
+    int status;
+
+    status = fast_strtod(s, end, se, &x, decimal, sci, skip_trailing);
+    if (status != FAST_FALLBACK) {
+        *error = (status == FAST_NO_DIGITS);
+        return x;
+    }
+
+    s32 = utf8_to_char32(s, end - s, buffer, sizeof(buffer) / sizeof(buffer[0]));
+    if (s32 == NULL) {
+        *error = ENOMEM;
+        *se = s;
+        return 0.0;
+    }
+    x = _Py_dg_strtod_modified(s32, &p_end, error, decimal, sci, skip_trailing);
+    // Find the byte where the character at p_end starts.
+    *se = s;
+    for (char32_t *p = s32; p < p_end; ++p) {
+        int len;
+        utf8_decode_char(*se, &len);
+        *se += len;
+    }
+    if (s32 != buffer) {
+        free(s32);
+    }
+    return x;
+}
+
+/*
+ *  If the character at *p (before end) is c, move *p past it and return
+ *  true.
+ */
+static bool
+skip_char(const uint8_t **p, const uint8_t *end, char32_t c)
+{
+    int len;
+
+    if (*p == end || utf8_decode_char(*p, &len) != c) {
+        return false;
+    }
+    *p += len;
+    return true;
+}
+
+/*
+ *  `item` must point to the `len` bytes that are to be converted to a
+ *  double.
  *
  *  To be successful, to_double() must use *all* the characters
  *  in `item`.  E.g. "1.q25" will fail.  Leading and trailing 
@@ -30,41 +252,43 @@ _Py_dg_strtod_modified(const char32_t *s00, char32_t **se, int *error,
  *
  */
 
-bool to_double(char32_t *item, double *p_value, char32_t sci, char32_t decimal)
+bool to_double(const uint8_t *item, size_t len, double *p_value,
+               char32_t sci, char32_t decimal)
 {
-    char32_t *p_end;
+    const uint8_t *end = item + len;
+    const uint8_t *p_end;
     int error;
 
-    *p_value = _Py_dg_strtod_modified(item, &p_end, &error, decimal, sci, true);
+    *p_value = strtod_bytes(item, end, &p_end, &error, decimal, sci, true);
 
-    return (error == 0) && (!*p_end);
+    return (error == 0) && (p_end == end);
 }
 
 
-bool to_complex(char32_t *item, double *p_real, double *p_imag,
+bool to_complex(const uint8_t *item, size_t len, double *p_real, double *p_imag,
                 char32_t sci, char32_t decimal, char32_t imaginary_unit,
                 bool allow_parens)
 {
-    char32_t *p_end;
+    const uint8_t *end = item + len;
+    const uint8_t *p_end;
     int error;
     bool unmatched_opening_paren = false;
 
-    if (allow_parens && (*item == '(')) {
+    if (allow_parens && (byte_at(item, end) == '(')) {
         unmatched_opening_paren = true;
         ++item;
     }
-    *p_real = _Py_dg_strtod_modified(item, &p_end, &error, decimal, sci, false);
-    if (*p_end == '\0') {
+    *p_real = strtod_bytes(item, end, &p_end, &error, decimal, sci, false);
+    if (p_end == end) {
         // No imaginary part in the string (e.g. "3.5")
         *p_imag = 0.0;
         return (error == 0) && (!unmatched_opening_paren);
     }
-    if (*p_end == imaginary_unit) {
+    if (skip_char(&p_end, end, imaginary_unit)) {
         // Pure imaginary part only (e.g "1.5j")
         *p_imag = *p_real;
         *p_real = 0.0;
-        ++p_end;
-        if (unmatched_opening_paren && (*p_end == ')')) {
+        if (unmatched_opening_paren && (byte_at(p_end, end) == ')')) {
             ++p_end;
             unmatched_opening_paren = false;
         }
@@ -79,20 +303,19 @@ bool to_complex(char32_t *item, double *p_real, double *p_imag,
             ++p_end;
         }
 
-        *p_imag = _Py_dg_strtod_modified(p_end, &p_end, &error, decimal, sci, false);
-        if (error || (*p_end != imaginary_unit)) {
+        *p_imag = strtod_bytes(p_end, end, &p_end, &error, decimal, sci, false);
+        if (error || !skip_char(&p_end, end, imaginary_unit)) {
             return false;
         }
-        ++p_end;
-        if (unmatched_opening_paren && (*p_end == ')')) {
+        if (unmatched_opening_paren && (byte_at(p_end, end) == ')')) {
             ++p_end;
             unmatched_opening_paren = false;
         }
     }
-    while(*p_end == ' ') {
+    while (byte_at(p_end, end) == ' ') {
         ++p_end;
     }
-    return *p_end == '\0';
+    return p_end == end;
 }
 
 
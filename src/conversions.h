@@ -2,12 +2,15 @@
 #define CONVERSIONS_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "typedefs.h"
 
 
-bool to_double(char32_t *item, double *p_value, char32_t sci, char32_t decimal);
-bool to_complex(char32_t *item, double *p_real, double *p_imag,
+bool to_double(const uint8_t *item, size_t len, double *p_value,
+               char32_t sci, char32_t decimal);
+bool to_complex(const uint8_t *item, size_t len, double *p_real, double *p_imag,
                 char32_t sci, char32_t decimal, char32_t imaginary_unit,
                 bool allow_parens);
 bool to_longlong(char32_t *item, long long *p_value);
@@ -1,3 +1,3 @@
 export PYTHONINCLUDE=$(python -c "import sysconfig; print(sysconfig.get_paths()['include'])")
 echo $PYTHONINCLUDE
-gcc runtests.c -I $PYTHONINCLUDE ../type_inference.c ../blocks.c ../field_types.c ../conversions.c ../str_to.c  ../dtoa_modified.c ../char32utils.c ../max_token_len.c ctestify.c ctestify_assert.c -o runtests
+gcc runtests.c -I $PYTHONINCLUDE ../type_inference.c ../blocks.c ../hints.c ../field_types.c ../conversions.c ../pow10table.c ../str_to.c  ../dtoa_modified.c ../char32utils.c ../max_token_len.c ../scan.c ctestify.c ctestify_assert.c -o runtests
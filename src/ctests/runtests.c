@@ -13,14 +13,16 @@
 #include "../str_to.h"
 #include "../type_inference.h"
 #include "../max_token_len.h"
+#include "../scan.h"
+#include "../char32utils.h"
 
 #include "ctestify.h"
 
 #define ALLOW_PARENS true
 
 #define TEST_TO_LONGLONG(value)                                 \
-    str_to_char32(s, #value);                                   \
-    status = to_longlong(s, &m);                                \
+    str_to_char32(s32, #value);                                 \
+    status = to_longlong(s32, &m);                              \
     assert_equal_int(results, status, 1,                        \
                      "bad return status from to_longlong()");   \
     assert_equal_longlong(results, m, value##LL,                \
@@ -38,32 +40,39 @@ void str_to_char32(char32_t *w, char *s)
 }
 
 
+void str_to_bytes(uint8_t *w, char *s)
+{
+    strcpy((char *) w, s);
+}
+
+
 void test_conversions(test_results *results)
 {
-    char32_t s[64];
+    uint8_t s[64];
     double x;
     int status;
 
-    str_to_char32(s, "1.25");
-    status = to_double(s, &x, 'e', '.');
+    str_to_bytes(s, "1.25");
+    status = to_double(s, strlen((char *) s), &x, 'e', '.');
     assert_equal_int(results, status, 1, "bad return status from to_double()");
     assert_equal_double(results, x, 1.25, "incorrect conversion to double");
 
-    str_to_char32(s, "1,25");
-    status = to_double(s, &x, 'e', ',');
+    str_to_bytes(s, "1,25");
+    status = to_double(s, strlen((char *) s), &x, 'e', ',');
     assert_equal_int(results, status, 1, "bad return status from to_double()");
     assert_equal_double(results, x, 1.25, "incorrect conversion to double");
 
-    str_to_char32(s, "1.25e0");
-    status = to_double(s, &x, 'E', '.');
+    str_to_bytes(s, "1.25e0");
+    status = to_double(s, strlen((char *) s), &x, 'E', '.');
     assert_equal_int(results, status, 1, "bad return status from to_double()");
     assert_equal_double(results, x, 1.25, "incorrect conversion to double");
 
-    str_to_char32(s, "1.25D0");
-    status = to_double(s, &x, 'D', '.');
+    str_to_bytes(s, "1.25D0");
+    status = to_double(s, strlen((char *) s), &x, 'D', '.');
     assert_equal_int(results, status, 1, "bad return status from to_double()");
     assert_equal_double(results, x, 1.25, "incorrect conversion to double");
 
+    char32_t s32[64];
     long long m;
     TEST_TO_LONGLONG(987654321)
     TEST_TO_LONGLONG(-1)
@@ -73,87 +82,163 @@ void test_conversions(test_results *results)
 
 void test_complex_conversion(test_results *results)
 {
-    char32_t s[64];
+    uint8_t s[64];
     double x, y;
     int status;
 
-    str_to_char32(s, "1.25+2.0j");
-    status = to_complex(s, &x, &y, 'E', '.', 'j', ALLOW_PARENS);
+    str_to_bytes(s, "1.25+2.0j");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 'j', ALLOW_PARENS);
     assert_equal_int(results, status, 1, "bad return status from to_complex()");
     assert_equal_double(results, x, 1.25, "incorrect conversion to complex (real part)");
     assert_equal_double(results, y, 2.0, "incorrect conversion to complex (imag part)");
 
-    str_to_char32(s, "1.25+-2000i");
-    status = to_complex(s, &x, &y, 'E', '.', 'i', ALLOW_PARENS);
+    str_to_bytes(s, "1.25+-2000i");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 'i', ALLOW_PARENS);
     assert_equal_int(results, status, 1, "bad return status from to_complex()");
     assert_equal_double(results, x, 1.25, "incorrect conversion to complex (real part)");
     assert_equal_double(results, y, -2000.0, "incorrect conversion to complex (imag part)");
 
-    str_to_char32(s, "1.25");
-    status = to_complex(s, &x, &y, 'E', '.', 'i', ALLOW_PARENS);
+    str_to_bytes(s, "1.25");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 'i', ALLOW_PARENS);
     assert_equal_int(results, status, 1, "bad return status from to_complex()");
     assert_equal_double(results, x, 1.25, "incorrect conversion to complex (real part)");
     assert_equal_double(results, y, 0.0, "incorrect conversion to complex (imag part)");
 
-    str_to_char32(s, "1.25i");
-    status = to_complex(s, &x, &y, 'E', '.', 'i', ALLOW_PARENS);
+    str_to_bytes(s, "1.25i");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 'i', ALLOW_PARENS);
     assert_equal_int(results, status, 1, "bad return status from to_complex()");
     assert_equal_double(results, x, 0.0, "incorrect conversion to complex (real part)");
     assert_equal_double(results, y, 1.25, "incorrect conversion to complex (imag part)");
 
-    str_to_char32(s, "1.25+-2.0e1i");
-    status = to_complex(s, &x, &y, 'E', '.', 'i', ALLOW_PARENS);
+    str_to_bytes(s, "1.25+-2.0e1i");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 'i', ALLOW_PARENS);
     assert_equal_int(results, status, 1, "bad return status from to_complex()");
     assert_equal_double(results, x, 1.25, "incorrect conversion to complex (real part)");
     assert_equal_double(results, y, -20.0, "incorrect conversion to complex (imag part)");
 
-    str_to_char32(s, "1.0-2.0i");
-    status = to_complex(s, &x, &y, 'E', '.', 'i', ALLOW_PARENS);
+    str_to_bytes(s, "1.0-2.0i");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 'i', ALLOW_PARENS);
     assert_equal_int(results, status, 1, "bad return status from to_complex()");
     assert_equal_double(results, x, 1.0, "incorrect conversion to complex (real part)");
     assert_equal_double(results, y, -2.0, "incorrect conversion to complex (imag part)");
 
-    str_to_char32(s, "8.125e03-.5e1i");
-    status = to_complex(s, &x, &y, 'E', '.', 'i', ALLOW_PARENS);
+    str_to_bytes(s, "8.125e03-.5e1i");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 'i', ALLOW_PARENS);
     assert_equal_int(results, status, 1, "bad return status from to_complex()");
     assert_equal_double(results, x, 8125.0, "incorrect conversion to complex (real part)");
     assert_equal_double(results, y, -5.0, "incorrect conversion to complex (imag part)");
 
-    str_to_char32(s, "(8.125e03-.5e1i)");
-    status = to_complex(s, &x, &y, 'E', '.', 'i', ALLOW_PARENS);
+    str_to_bytes(s, "(8.125e03-.5e1i)");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 'i', ALLOW_PARENS);
     assert_equal_int(results, status, 1, "bad return status from to_complex()");
     assert_equal_double(results, x, 8125.0, "incorrect conversion to complex (real part)");
     assert_equal_double(results, y, -5.0, "incorrect conversion to complex (imag part)");
 }
 
+void test_double_fast_path(test_results *results)
+{
+    // Numbers that fast_strtod() handles, and numbers that it leaves to
+    // _Py_dg_strtod_modified(); all must give the correctly rounded value.
+    char *good[] = {"0.1", "123.456", "-0.000123", "1e22", "4.35e-22",
+                    "9007199254740992", "9007199254740993",
+                    "1.7976931348623157e308", "2.2250738585072014e-308",
+                    "12345678901234567890123", "0.30000000000000004441",
+                    "1.", ".5", "+.5e-3", "-0", "  2.5  ", "1e0", "00012.50"};
+    char *bad[] = {"", "-", ".", "1e", "1e+", "1.5x", "e5", "1 2"};
+    uint8_t s[64];
+    double x;
+    bool status;
+
+    for (size_t k = 0; k < sizeof(good) / sizeof(good[0]); ++k) {
+        str_to_bytes(s, good[k]);
+        status = to_double(s, strlen((char *) s), &x, 'E', '.');
+        assert_equal_bool(results, status, true, "to_double() failed");
+        assert_equal_double(results, x, strtod(good[k], NULL),
+                            "incorrect conversion to double");
+    }
+    for (size_t k = 0; k < sizeof(bad) / sizeof(bad[0]); ++k) {
+        str_to_bytes(s, bad[k]);
+        status = to_double(s, strlen((char *) s), &x, 'E', '.');
+        assert_equal_bool(results, status, false, "to_double() did not fail");
+    }
+
+    // A non-ASCII decimal point (U+00B7, middle dot).
+    str_to_bytes(s, "1\xc2\xb7" "25");
+    status = to_double(s, strlen((char *) s), &x, 'E', 0xB7);
+    assert_equal_bool(results, status, true, "to_double() failed");
+    assert_equal_double(results, x, 1.25, "incorrect conversion to double");
+
+    // Only the first len bytes are part of the field.
+    str_to_bytes(s, "2.75,1e5");
+    status = to_double(s, 4, &x, 'E', '.');
+    assert_equal_bool(results, status, true, "to_double() failed");
+    assert_equal_double(results, x, 2.75, "incorrect conversion to double");
+    status = to_double(s, 5, &x, 'E', '.');
+    assert_equal_bool(results, status, false, "to_double() did not fail");
+
+    // A non-ASCII imaginary unit (U+2148).
+    double y;
+    str_to_bytes(s, "2.5-1.5\xe2\x85\x88");
+    status = to_complex(s, strlen((char *) s), &x, &y, 'E', '.', 0x2148, ALLOW_PARENS);
+    assert_equal_bool(results, status, true, "to_complex() failed");
+    assert_equal_double(results, x, 2.5, "incorrect conversion to complex (real part)");
+    assert_equal_double(results, y, -1.5, "incorrect conversion to complex (imag part)");
+}
+
+
+void test_utf8(test_results *results)
+{
+    char32_t chars[] = {'a', 0xE9, 0x20AC, 0x1F600, 0xDC80, 0};
+    uint8_t s[32];
+    char32_t decoded[8];
+    size_t n = 0;
+    size_t len;
+
+    for (int k = 0; chars[k]; ++k) {
+        n += utf8_encode(chars[k], s + n);
+    }
+    s[n] = '\0';
+    assert_equal_int(results, (int) n, 1 + 2 + 3 + 4 + 3, "incorrect UTF-8 length");
+    assert_equal_int(results, (int) utf8_strlen(s, n), 5, "incorrect utf8_strlen()");
+
+    len = utf8_decode(s, n, decoded, 8);
+    assert_equal_int(results, (int) len, 5, "incorrect utf8_decode() length");
+    for (size_t k = 0; k < len; ++k) {
+        assert_equal_uint32_t(results, decoded[k], chars[k], "incorrect utf8_decode()");
+    }
+    len = utf8_decode(s, n, decoded, 2);
+    assert_equal_int(results, (int) len, 2, "utf8_decode() stored too much");
+}
+
+
 void test_str_to(test_results *results)
 {
-    char32_t s[16];
+    uint8_t s[16];
     int64_t n;
     int error;
 
-    str_to_char32(s, "45");
-    n = str_to_int64(s, -100, 100, &error);
+    str_to_bytes(s, "45");
+    n = str_to_int64(s, strlen((char *) s), -100, 100, &error);
     assert_equal_int(results, error, 0, "str_to_int64 returned nonzero error");
     assert_equal_int64_t(results, n, 45, "str_to_int64 returned incorrect value");
 
-    str_to_char32(s, "-97");
-    n = str_to_int64(s, -100, 100, &error);
+    str_to_bytes(s, "-97");
+    n = str_to_int64(s, strlen((char *) s), -100, 100, &error);
     assert_equal_int(results, error, 0, "str_to_int64 returned nonzero error");
     assert_equal_int64_t(results, n, -97, "str_to_int64 returned incorrect value");
 
-    str_to_char32(s, "32767");
-    n = str_to_int64(s, -32768, 32767, &error);
+    str_to_bytes(s, "32767");
+    n = str_to_int64(s, strlen((char *) s), -32768, 32767, &error);
     assert_equal_int(results, error, 0, "str_to_int64 returned nonzero error");
     assert_equal_int64_t(results, n, 32767, "str_to_int64 returned incorrect value");
 
-    str_to_char32(s, "-32768");
-    n = str_to_int64(s, -32768, 32767, &error);
+    str_to_bytes(s, "-32768");
+    n = str_to_int64(s, strlen((char *) s), -32768, 32767, &error);
     assert_equal_int(results, error, 0, "str_to_int64 returned nonzero error");
     assert_equal_int64_t(results, n, -32768, "str_to_int64 returned incorrect value");
 
-    str_to_char32(s, "32768");
-    n = str_to_uint64(s, 100000UL, &error);
+    str_to_bytes(s, "32768");
+    n = str_to_uint64(s, strlen((char *) s), 100000UL, &error);
     assert_equal_int(results, error, 0, "str_to_uint64 returned nonzero error");
     assert_equal_uint64_t(results, n, 32768, "str_to_uint64 returned incorrect value");
 }
@@ -202,7 +287,7 @@ void test_blocks(test_results *results)
 
     int num_rows = 26;
 
-    blocks_data *b = blocks_init(row_size, rows_per_block, block_table_length);
+    blocks_data *b = blocks_init(row_size, rows_per_block, block_table_length, 0);
     if (b == NULL) {
         fprintf(stderr, "blocks_init returned NULL\n");
         exit(-1);
@@ -268,36 +353,36 @@ void test_blocks(test_results *results)
 
 void test_type_inference(test_results *results)
 {
-    char32_t s[16];
+    uint8_t s[16];
     char type, prev_type;
     int64_t i = 0;
     uint64_t u = 0;
 
-    str_to_char32(s, "123");
+    str_to_bytes(s, "123");
     prev_type = '*';
-    type = classify_type(s, '.', 'e', 'j', &i, &u, prev_type);
+    type = classify_type(s, strlen((char *) s), '.', 'e', 'j', &i, &u, prev_type);
     assert_equal_char(results, type, 'Q', "inferred type is not 'Q'");
     assert_equal_uint64_t(results, u, 123, "value in u is not 123");
 
-    str_to_char32(s, "1234");
+    str_to_bytes(s, "1234");
     prev_type = 'd';
-    type = classify_type(s, '.', 'e', 'j', &i, &u, prev_type);
+    type = classify_type(s, strlen((char *) s), '.', 'e', 'j', &i, &u, prev_type);
     assert_equal_char(results, type, 'd', "inferred type is not 'd'");
 
-    str_to_char32(s, "12X3");
+    str_to_bytes(s, "12X3");
     prev_type = 'd';
-    type = classify_type(s, '.', 'e', 'j', &i, &u, prev_type);
+    type = classify_type(s, strlen((char *) s), '.', 'e', 'j', &i, &u, prev_type);
     assert_equal_char(results, type, 'S', "inferred type is not 'S'");
 
-    str_to_char32(s, "-12345");
+    str_to_bytes(s, "-12345");
     prev_type = '*';
-    type = classify_type(s, '.', 'e', 'j', &i, &u, prev_type);
+    type = classify_type(s, strlen((char *) s), '.', 'e', 'j', &i, &u, prev_type);
     assert_equal_char(results, type, 'q', "inferred type is not 'q'");
     assert_equal_int64_t(results, i, -12345, "value in u is not -12345");
 
-    str_to_char32(s, "-12345");
+    str_to_bytes(s, "-12345");
     prev_type = 'Q';
-    type = classify_type(s, '.', 'e', 'j', &i, &u, prev_type);
+    type = classify_type(s, strlen((char *) s), '.', 'e', 'j', &i, &u, prev_type);
     assert_equal_char(results, type, 'q', "inferred type is not 'q'");
     assert_equal_int64_t(results, i, -12345, "value in u is not -12345");
 
@@ -384,6 +469,143 @@ void test_max_token_len(test_results *results)
 }
 
 
+void test_scan_copy(test_results *results)
+{
+    // The bytes that end a run, for a ',' and for a ' ' (whitespace)
+    // delimiter, and (last) a byte that does not end it.
+    const uint8_t ends[2][8] = {{',', '"', '#', '\n', '\r', '\t', 0xC3, ' '},
+                                {' ', '\t', '"', '#', '\n', '\r', 0xC3, '!'}};
+    uint8_t data[200];
+    uint8_t dst[200];
+    scan_set set;
+    int default_level = scan_level();
+    int max_level = scan_use_level(SCAN_AVX512);
+
+    // Every level must find the same end of the run, for runs ending at
+    // every position of a 16, 32 or 64 byte block, and for the tails.
+    for (int level = SCAN_SCALAR; level <= max_level; ++level) {
+        int num_wrong = 0;
+        scan_use_level(level);
+        for (int ws = 0; ws < 2; ++ws) {
+            scan_set_init(&set, ws ? ' ' : ',', '"', '#');
+            for (size_t e = 0; e < sizeof(ends[ws]); ++e) {
+                for (size_t t = 0; t < 150; ++t) {
+                    for (size_t start = 0; start < 3; ++start) {
+                        size_t max = (t % 2) ? 200 : 20;
+                        size_t expected;
+                        size_t k;
+
+                        for (size_t i = 0; i < sizeof(data); ++i) {
+                            data[i] = 'a' + i % 26;
+                        }
+                        data[t] = ends[ws][e];
+                        // If t < start, or data[t] does not end the run, the
+                        // run goes up to `end`.
+                        expected = (t < start || e == sizeof(ends[ws]) - 1)
+                                       ? 160 - start : t - start;
+                        if (expected > max) {
+                            expected = max;
+                        }
+                        if (max == 200 &&
+                                scan_skip(&set, data + start, data + 160) != expected) {
+                            ++num_wrong;
+                        }
+                        k = scan_copy(&set, data + start, data + 160, dst, max);
+                        if (k != expected) {
+                            ++num_wrong;
+                            continue;
+                        }
+                        for (size_t i = 0; i < k; ++i) {
+                            if (dst[i] != data[start + i]) {
+                                ++num_wrong;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        // A run that is not ended stops at `end`.
+        memset(data, '1', sizeof(data));
+        if (scan_copy(&set, data + 1, data + 131, dst, 200) != 130) {
+            ++num_wrong;
+        }
+        assert_equal_int(results, num_wrong, 0, "incorrect scan_copy() or scan_skip() result");
+    }
+    scan_use_level(default_level);
+}
+
+
+void test_scan_blanks(test_results *results)
+{
+    const uint8_t ends[] = {'a', '\n', '\r', '\v', 0xC3};
+    uint8_t data[200];
+    int default_level = scan_level();
+    int max_level = scan_use_level(SCAN_AVX512);
+
+    for (int level = SCAN_SCALAR; level <= max_level; ++level) {
+        int num_wrong = 0;
+        scan_use_level(level);
+        for (size_t e = 0; e < sizeof(ends); ++e) {
+            for (size_t t = 0; t < 150; ++t) {
+                for (size_t start = 0; start < 3; ++start) {
+                    size_t expected;
+
+                    for (size_t i = 0; i < sizeof(data); ++i) {
+                        data[i] = (i % 3) ? ' ' : '\t';
+                    }
+                    data[t] = ends[e];
+                    expected = (t < start) ? 160 - start : t - start;
+                    if (scan_blanks(data + start, data + 160) != expected) {
+                        ++num_wrong;
+                    }
+                }
+            }
+        }
+        assert_equal_int(results, num_wrong, 0, "incorrect scan_blanks() result");
+    }
+    scan_use_level(default_level);
+}
+
+
+void test_scan_lines(test_results *results)
+{
+    uint8_t data[200];
+    int default_level = scan_level();
+    int max_level = scan_use_level(SCAN_AVX512);
+
+    // Lines of 1 to 7 bytes, so some blocks have many newlines.
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        bool nl = (i % 7 == 0) || ((i / 40) % 2 == 1 && i % 2 == 0);
+        data[i] = nl ? '\n' : ((i % 5) ? 'x' : '\r');
+    }
+    for (int level = SCAN_SCALAR; level <= max_level; ++level) {
+        int num_wrong = 0;
+        scan_use_level(level);
+        for (size_t start = 0; start < 3; ++start) {
+            for (int num_lines = 0; num_lines < 80; ++num_lines) {
+                size_t expected = start;
+                int expected_remaining = num_lines;
+                int remaining = num_lines;
+                size_t k;
+
+                while (expected_remaining > 0 && expected < 180) {
+                    if (data[expected++] == '\n') {
+                        --expected_remaining;
+                    }
+                }
+                k = scan_lines(data + start, data + 180, &remaining);
+                if (k != expected - start || remaining != expected_remaining) {
+                    ++num_wrong;
+                }
+            }
+        }
+        assert_equal_int(results, num_wrong, 0, "incorrect scan_lines() result");
+    }
+    scan_use_level(default_level);
+}
+
+
 int main(int argc, char *argv[])
 {
     test_results results;
@@ -401,6 +623,12 @@ int main(int argc, char *argv[])
     printf("test_complex_conversion\n");
     test_complex_conversion(&results);
 
+    printf("test_double_fast_path\n");
+    test_double_fast_path(&results);
+
+    printf("test_utf8\n");
+    test_utf8(&results);
+
     printf("test_str_to\n");
     test_str_to(&results);
 
@@ -416,6 +644,15 @@ int main(int argc, char *argv[])
     printf("test_max_token_len\n");
     test_max_token_len(&results);
 
+    printf("test_scan_copy\n");
+    test_scan_copy(&results);
+
+    printf("test_scan_blanks\n");
+    test_scan_blanks(&results);
+
+    printf("test_scan_lines\n");
+    test_scan_lines(&results);
+
     printf("### finished running tests\n");
 
     test_results_print_summary(&results, __FILE__);
@@ -0,0 +1,94 @@
+//
+// encoding.c
+//
+// Decoding of the characters of a byte stream.  The streams handle ASCII
+// bytes themselves (that is the fast path); decode_char() is only called
+// for a byte with the high bit set.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "typedefs.h"
+#include "stream.h"
+#include "encoding.h"
+
+
+/*
+ *  Decode the UTF-8 sequence at p.  n is the number of bytes available
+ *  at p, and p[0] >= 0x80.  *len is set to the length of the sequence.
+ *
+ *  As in Python's strict UTF-8 decoder, overlong sequences, surrogates
+ *  and values greater than 0x10FFFF are rejected.  An incomplete sequence
+ *  (i.e. n is too small) is also invalid.
+ *
+ *  Returns STREAM_DECODE_ERROR if the sequence is not valid.
+ */
+
+static char32_t
+decode_utf8(const uint8_t *p, size_t n, int *len)
+{
+    char32_t c = p[0];
+    char32_t min;
+    int k;
+
+    if (c >= 0xF0 && c <= 0xF4) {
+        *len = 4;
+        c &= 0x07;
+        min = 0x10000;
+    }
+    else if (c >= 0xE0) {
+        *len = 3;
+        c &= 0x0F;
+        min = 0x800;
+    }
+    else if (c >= 0xC2 && c < 0xE0) {
+        *len = 2;
+        c &= 0x1F;
+        min = 0x80;
+    }
+    else {
+        // A continuation byte, an overlong two-byte lead byte (0xC0, 0xC1),
+        // or a lead byte for a value greater than 0x10FFFF.
+        *len = 1;
+        return STREAM_DECODE_ERROR;
+    }
+
+    if ((size_t) *len > n) {
+        *len = 1;
+        return STREAM_DECODE_ERROR;
+    }
+    for (k = 1; k < *len; ++k) {
+        if ((p[k] & 0xC0) != 0x80) {
+            *len = 1;
+            return STREAM_DECODE_ERROR;
+        }
+        c = (c << 6) | (p[k] & 0x3F);
+    }
+    if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+        *len = 1;
+        return STREAM_DECODE_ERROR;
+    }
+    return c;
+}
+
+
+/*
+ *  Decode the character at p, where p[0] >= 0x80.  n is the number of
+ *  bytes available at p.  *len is set to the number of bytes used.
+ *
+ *  Returns STREAM_DECODE_ERROR if the bytes are not valid for the encoding.
+ */
+
+char32_t
+decode_char(const uint8_t *p, size_t n, int encoding, int *len)
+{
+    if (encoding == ENCODING_UTF8) {
+        return decode_utf8(p, n, len);
+    }
+    *len = 1;
+    if (encoding == ENCODING_ASCII) {
+        return STREAM_DECODE_ERROR;
+    }
+    return p[0];
+}
@@ -0,0 +1,21 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "typedefs.h"
+
+//
+// Encodings that the byte-oriented streams can decode natively.
+//
+// ENCODING_LATIN1 is also what the streams use when no encoding is
+// given: each byte is one character.
+//
+#define ENCODING_LATIN1 0
+#define ENCODING_ASCII  1
+#define ENCODING_UTF8   2
+
+char32_t decode_char(const uint8_t *p, size_t n, int encoding, int *len);
+
+#endif
@@ -0,0 +1,127 @@
+//
+// hints.c
+//
+// Access-pattern hints for the kernel.  `hints` is a combination of the
+// HINT_* flags defined in hints.h:
+//
+//     HINT_SEQUENTIAL  The file is read sequentially (more kernel readahead).
+//     HINT_WILLNEED    Start reading the whole file into the page cache.
+//     HINT_DONTNEED    Drop the file's pages from the page cache once they
+//                      have been read, so a large file does not evict the
+//                      pages of other processes.
+//     HINT_HUGE_PAGES  Back large buffers with transparent huge pages, to
+//                      reduce TLB misses.
+//
+// The hints are advisory: the functions ignore errors, and do nothing on
+// systems that do not support them.
+//
+// Pure C, no Python API used.
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hints.h"
+
+// Size of a transparent huge page on x86-64 and (usually) aarch64.
+#define HUGE_PAGE_SIZE 2097152
+
+// HINT_DONTNEED drops the pages in steps of at least this many bytes.
+#define DROP_STEP 8388608
+
+
+/*
+ *  void hints_file_start(int fd, int hints)
+ *
+ *  Apply HINT_SEQUENTIAL and HINT_WILLNEED to the open file fd.
+ */
+
+void hints_file_start(int fd, int hints)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (hints & HINT_SEQUENTIAL) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    if (hints & HINT_WILLNEED) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+#endif
+}
+
+
+/*
+ *  void hints_file_consumed(int fd, int hints, long int *dropped,
+ *                           long int pos)
+ *
+ *  With HINT_DONTNEED, tell the kernel that the bytes of fd before offset
+ *  pos are no longer needed.  *dropped is the offset up to which that has
+ *  already been done (initially 0); it is updated.
+ */
+
+void hints_file_consumed(int fd, int hints, long int *dropped, long int pos)
+{
+#ifdef POSIX_FADV_DONTNEED
+    if ((hints & HINT_DONTNEED) && pos - *dropped >= DROP_STEP) {
+        posix_fadvise(fd, *dropped, pos - *dropped, POSIX_FADV_DONTNEED);
+        *dropped = pos;
+    }
+#endif
+}
+
+
+/*
+ *  void hints_mapping(void *addr, size_t len, int hints)
+ *
+ *  Apply the hints to a memory mapping of a file.  (HINT_DONTNEED is not
+ *  applied here: dropping mapped pages does not drop them from the page
+ *  cache.)
+ */
+
+void hints_mapping(void *addr, size_t len, int hints)
+{
+#ifdef MADV_SEQUENTIAL
+    if (hints & HINT_SEQUENTIAL) {
+        madvise(addr, len, MADV_SEQUENTIAL);
+    }
+    if (hints & HINT_WILLNEED) {
+        madvise(addr, len, MADV_WILLNEED);
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (hints & HINT_HUGE_PAGES) {
+        madvise(addr, len, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+
+/*
+ *  void *hints_malloc(size_t size, int hints)
+ *
+ *  Allocate size bytes, like malloc().  With HINT_HUGE_PAGES, a buffer of
+ *  at least one huge page is aligned to the huge page size and marked for
+ *  transparent huge pages.  The memory is released with free().
+ */
+
+void *hints_malloc(size_t size, int hints)
+{
+#ifdef MADV_HUGEPAGE
+    if ((hints & HINT_HUGE_PAGES) && size >= HUGE_PAGE_SIZE) {
+        void *p;
+        if (posix_memalign(&p, HUGE_PAGE_SIZE, size) != 0) {
+            return NULL;
+        }
+        madvise(p, size - size % HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+        return p;
+    }
+#endif
+    return malloc(size);
+}
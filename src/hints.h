@@ -0,0 +1,16 @@
+#ifndef HINTS_H
+#define HINTS_H
+
+#include <stddef.h>
+
+#define HINT_SEQUENTIAL  1
+#define HINT_WILLNEED    2
+#define HINT_DONTNEED    4
+#define HINT_HUGE_PAGES  8
+
+void hints_file_start(int fd, int hints);
+void hints_file_consumed(int fd, int hints, long int *dropped, long int pos);
+void hints_mapping(void *addr, size_t len, int hints);
+void *hints_malloc(size_t size, int hints);
+
+#endif
@@ -11,7 +11,8 @@ typedef struct _parser_config {
     /*
      *  Field delimiter character.
      *  Typically ',', ' ', '\t', or '\0'.
-     *  '\0' means each contiguous span of spaces is one delimiter.
+     *  ' ' and '\0' mean each contiguous span of blanks (spaces and tabs)
+     *  is one delimiter, and the blanks at the ends of a line are ignored.
      */
     char32_t delimiter;
 
@@ -38,8 +39,9 @@ typedef struct _parser_config {
     bool ignore_trailing_spaces;
 
     /*
-     *  Ignore lines that are all spaces.  Only used when the delimiter
-     *  is \0.
+     *  Ignore lines that are all blanks (spaces and tabs); if false, such
+     *  a line is a row with no fields.  Only used when the delimiter is
+     *  ' ' or '\0'.
      */
     bool ignore_blank_lines;
 
@@ -0,0 +1,283 @@
+//
+// readahead.c
+//
+// The public function defined in this file is
+//
+//     int readahead_source(buffered_source *source, size_t block_size,
+//                          int num_blocks, int hints)
+//
+// The function replaces *source with a source that reads from the original
+// source in a background thread.  The thread fills up to num_blocks blocks
+// of block_size bytes ahead of the reader, so reading from the source (e.g.
+// fread() from a network file system, or decompression) overlaps with
+// the tokenizer's work on the data already read.  The memory used is
+// bounded by num_blocks * block_size.  The blocks are allocated with
+// hints_malloc() (see hints.h), e.g. on huge pages.
+//
+// The original source's functions are called only from the background
+// thread (except close(), which is called after the thread has stopped),
+// so they must not need the Python GIL.
+//
+// Returns 0 on success, or -1 if the memory allocation or the creation of
+// the thread fails; *source is unchanged in that case.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "hints.h"
+#include "readahead.h"
+
+
+typedef struct _block {
+
+    uint8_t *data;
+
+    /* Number of bytes in data; 0 at the end of the source, -1 on error. */
+    long int len;
+
+    /* Position in data of the next byte to be returned by ra_read(). */
+    long int pos;
+
+} block;
+
+
+typedef struct _readahead {
+
+    /* The source being read by the thread. */
+    buffered_source source;
+
+    pthread_t thread;
+
+    /* Boolean: is the thread running (i.e. must it be joined)? */
+    bool running;
+
+    /*
+     *  The ring of blocks.  blocks[head] is the block being read by
+     *  ra_read(); the thread fills blocks[(head + num_filled) % num_blocks].
+     *  num_filled, stop and the block contents are protected by lock.
+     */
+    block *blocks;
+    int num_blocks;
+    size_t block_size;
+    int head;
+    int num_filled;
+
+    /* Boolean: set to make the thread exit. */
+    bool stop;
+
+    pthread_mutex_t lock;
+
+    /* Signaled when a block is filled. */
+    pthread_cond_t filled;
+
+    /* Signaled when a block is emptied, or stop is set. */
+    pthread_cond_t emptied;
+
+} readahead;
+
+#define RA(ra)  ((readahead *)ra)
+
+
+static
+void *_ra_thread(void *ra)
+{
+    int tail = RA(ra)->head;
+
+    while (1) {
+        block *b;
+        long int len;
+
+        pthread_mutex_lock(&(RA(ra)->lock));
+        while (!RA(ra)->stop && RA(ra)->num_filled == RA(ra)->num_blocks) {
+            pthread_cond_wait(&(RA(ra)->emptied), &(RA(ra)->lock));
+        }
+        if (RA(ra)->stop) {
+            pthread_mutex_unlock(&(RA(ra)->lock));
+            break;
+        }
+        pthread_mutex_unlock(&(RA(ra)->lock));
+
+        // blocks[tail] is not in use by the reader, so it can be filled
+        // without holding the lock.
+        b = &(RA(ra)->blocks[tail]);
+        len = RA(ra)->source.read(RA(ra)->source.data, b->data,
+                                  RA(ra)->block_size);
+
+        pthread_mutex_lock(&(RA(ra)->lock));
+        b->len = len;
+        b->pos = 0;
+        RA(ra)->num_filled++;
+        pthread_cond_signal(&(RA(ra)->filled));
+        pthread_mutex_unlock(&(RA(ra)->lock));
+
+        if (len <= 0) {
+            // End of the source, or an error: nothing more to read.
+            break;
+        }
+        tail = (tail + 1) % RA(ra)->num_blocks;
+    }
+    return NULL;
+}
+
+static
+int _ra_start(void *ra)
+{
+    RA(ra)->head = 0;
+    RA(ra)->num_filled = 0;
+    RA(ra)->stop = false;
+    if (pthread_create(&(RA(ra)->thread), NULL, &_ra_thread, ra) != 0) {
+        return -1;
+    }
+    RA(ra)->running = true;
+    return 0;
+}
+
+static
+void _ra_stop(void *ra)
+{
+    if (!RA(ra)->running) {
+        return;
+    }
+    pthread_mutex_lock(&(RA(ra)->lock));
+    RA(ra)->stop = true;
+    pthread_cond_signal(&(RA(ra)->emptied));
+    pthread_mutex_unlock(&(RA(ra)->lock));
+    pthread_join(RA(ra)->thread, NULL);
+    RA(ra)->running = false;
+}
+
+
+/*
+ *  long int ra_read(void *ra, uint8_t *buf, size_t n)
+ *
+ *  Copy at most n bytes from the block at the head of the ring to buf,
+ *  waiting for the thread to fill it if necessary.
+ */
+
+static
+long int ra_read(void *ra, uint8_t *buf, size_t n)
+{
+    block *b;
+    long int k;
+
+    if (!RA(ra)->running) {
+        // A failed ra_seek() left the thread stopped.
+        return -1;
+    }
+    pthread_mutex_lock(&(RA(ra)->lock));
+    while (RA(ra)->num_filled == 0) {
+        pthread_cond_wait(&(RA(ra)->filled), &(RA(ra)->lock));
+    }
+    pthread_mutex_unlock(&(RA(ra)->lock));
+
+    b = &(RA(ra)->blocks[RA(ra)->head]);
+    if (b->len <= 0) {
+        // The end-of-source (or error) block stays at the head, so
+        // further calls return the same result.
+        return b->len;
+    }
+
+    k = b->len - b->pos;
+    if ((size_t) k > n) {
+        k = n;
+    }
+    memcpy(buf, b->data + b->pos, k);
+    b->pos += k;
+
+    if (b->pos == b->len) {
+        pthread_mutex_lock(&(RA(ra)->lock));
+        RA(ra)->head = (RA(ra)->head + 1) % RA(ra)->num_blocks;
+        RA(ra)->num_filled--;
+        pthread_cond_signal(&(RA(ra)->emptied));
+        pthread_mutex_unlock(&(RA(ra)->lock));
+    }
+    return k;
+}
+
+static
+int ra_seek(void *ra, long int pos)
+{
+    if (RA(ra)->source.seek == NULL) {
+        return -1;
+    }
+    _ra_stop(ra);
+    if (RA(ra)->source.seek(RA(ra)->source.data, pos) != 0) {
+        return -1;
+    }
+    return _ra_start(ra);
+}
+
+static
+void _ra_free(void *ra)
+{
+    int i;
+
+    for (i = 0; i < RA(ra)->num_blocks; ++i) {
+        free(RA(ra)->blocks[i].data);
+    }
+    free(RA(ra)->blocks);
+    pthread_mutex_destroy(&(RA(ra)->lock));
+    pthread_cond_destroy(&(RA(ra)->filled));
+    pthread_cond_destroy(&(RA(ra)->emptied));
+    free(ra);
+}
+
+static
+void ra_close(void *ra, int restore, long int pos)
+{
+    _ra_stop(ra);
+    if (RA(ra)->source.close != NULL) {
+        RA(ra)->source.close(RA(ra)->source.data, restore, pos);
+    }
+    _ra_free(ra);
+}
+
+
+int readahead_source(buffered_source *source, size_t block_size,
+                     int num_blocks, int hints)
+{
+    readahead *ra;
+    int i;
+
+    ra = (readahead *) calloc(1, sizeof(readahead));
+    if (ra == NULL) {
+        return -1;
+    }
+    ra->blocks = (block *) calloc(num_blocks, sizeof(block));
+    if (ra->blocks == NULL) {
+        free(ra);
+        return -1;
+    }
+    ra->num_blocks = num_blocks;
+    ra->block_size = block_size;
+    pthread_mutex_init(&(ra->lock), NULL);
+    pthread_cond_init(&(ra->filled), NULL);
+    pthread_cond_init(&(ra->emptied), NULL);
+    for (i = 0; i < num_blocks; ++i) {
+        ra->blocks[i].data = hints_malloc(block_size, hints);
+        if (ra->blocks[i].data == NULL) {
+            _ra_free(ra);
+            return -1;
+        }
+    }
+
+    ra->source = *source;
+    if (_ra_start(ra) != 0) {
+        _ra_free(ra);
+        return -1;
+    }
+
+    source->data = (void *) ra;
+    source->read = &ra_read;
+    source->seek = &ra_seek;
+    source->close = &ra_close;
+    return 0;
+}
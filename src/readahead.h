@@ -0,0 +1,11 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stddef.h>
+
+#include "stream_buffered.h"
+
+int readahead_source(buffered_source *source, size_t block_size,
+                     int num_blocks, int hints);
+
+#endif
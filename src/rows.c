@@ -22,10 +22,17 @@
 #include "str_to.h"
 #include "str_to_int.h"
 #include "blocks.h"
+#include "char32utils.h"
 
 #define INITIAL_BLOCKS_TABLE_LENGTH 200
 #define ROWS_PER_BLOCK 500
 
+// The rows are tokenized in batches of up to ROWS_PER_BATCH rows, and of
+// about FIELDS_PER_BATCH fields (so that the token index of a batch stays
+// in the cache while it is converted).
+#define ROWS_PER_BATCH 4096
+#define FIELDS_PER_BATCH 65536
+
 #define ALLOW_PARENS true
 
 //
@@ -51,15 +58,14 @@ size_t compute_row_size(int actual_num_fields,
 }
 
 
-PyObject *call_converter_function(PyObject *func, char32_t *token)
+PyObject *call_converter_function(PyObject *func, const field_span *token)
 {
-    Py_ssize_t tokenlen = 0;
-    while (token[tokenlen]) {
-        ++tokenlen;
-    }
-    PyObject *s = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, token, tokenlen);
+    // The token is UTF-8 (see tokenize()).  "surrogatepass" because the
+    // lines of a Python file object can contain surrogates.
+    PyObject *s = PyUnicode_DecodeUTF8((const char *) token->p, token->len,
+                                       "surrogatepass");
     if (s == NULL) {
-        // fprintf(stderr, "*** PyUnicode_FromKindAndData failed ***\n");
+        // fprintf(stderr, "*** PyUnicode_DecodeUTF8 failed ***\n");
         return s;
     }
     PyObject *result = PyObject_CallFunctionObjArgs(func, s, NULL);
@@ -71,10 +77,10 @@ PyObject *call_converter_function(PyObject *func, char32_t *token)
 }
 
 /*
- *  Find the length of the longest token.
+ *  Find the length (in characters) of the longest token.
  */
 
-size_t max_token_len(char32_t **tokens, int num_tokens,
+size_t max_token_len(const field_span *tokens, int num_tokens,
                      int32_t *usecols, int num_usecols)
 {
     size_t maxlen = 0;
@@ -86,7 +92,7 @@ size_t max_token_len(char32_t **tokens, int num_tokens,
         else {
             j = usecols[i];
         }
-        size_t m = strlen32(tokens[j]);
+        size_t m = utf8_strlen(tokens[j].p, tokens[j].len);
         if (m > maxlen) {
             maxlen = m;
         }
@@ -96,7 +102,7 @@ size_t max_token_len(char32_t **tokens, int num_tokens,
 
 
 // WIP...
-size_t max_token_len_with_converters(char32_t **tokens, int num_tokens,
+size_t max_token_len_with_converters(const field_span *tokens, int num_tokens,
                                      int32_t *usecols, int num_usecols,
                                      PyObject **conv_funcs)
 {
@@ -113,7 +119,7 @@ size_t max_token_len_with_converters(char32_t **tokens, int num_tokens,
         }
 
         if (conv_funcs && conv_funcs[j]) {
-            PyObject *obj = call_converter_function(conv_funcs[i], tokens[j]);
+            PyObject *obj = call_converter_function(conv_funcs[i], &tokens[j]);
             if (obj == NULL) {
                 fprintf(stderr, "CALL FAILED!\n");
             }
@@ -133,7 +139,7 @@ size_t max_token_len_with_converters(char32_t **tokens, int num_tokens,
             m = (size_t) len;
         }
         else {
-            m = strlen32(tokens[j]);
+            m = utf8_strlen(tokens[j].p, tokens[j].len);
         }
         if (m > maxlen) {
             maxlen = m;
@@ -185,6 +191,362 @@ PyObject **create_conv_funcs(PyObject *converters, int32_t *usecols, int num_use
     return conv_funcs;
 }
 
+/*
+ *  Convert the field `token` (or `converted`, the object returned by the
+ *  field's converter, if it is not NULL) to the type `typecode`, and store
+ *  it at data_ptr.  itemsize is the size of the item.
+ *
+ *  Returns 0, or the error type (e.g. ERROR_BAD_FIELD).
+ */
+static int
+convert_field(char typecode, int32_t itemsize, const field_span *token,
+              PyObject *converted, parser_config *pconfig, char *data_ptr)
+{
+    int error = ERROR_OK;
+
+    if (typecode == 'b') {
+        int8_t x = 0;
+        if (converted != NULL) {
+            long long value = PyLong_AsLongLong(converted);
+            if (value == -1) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+            x = (int8_t) value;  // FIXME: Check out of bounds!
+        }
+        else {
+            x = to_int8(token->p, token->len, pconfig, &error);
+            if (error) {
+                return error;
+            }
+        }
+        *(int8_t *) data_ptr = x;
+    }
+    else if (typecode == 'B') {
+        uint8_t x = 0;
+        if (converted != NULL) {
+            size_t value = PyLong_AsSize_t(converted);
+            if (value == (size_t)-1) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+            x = (uint8_t) value;  // FIXME: Check out of bounds!
+        }
+        else {
+            x = to_uint8(token->p, token->len, pconfig, &error);
+            if (error) {
+                return error;
+            }
+        }
+        *(uint8_t *) data_ptr = x;
+    }
+    else if (typecode == 'h') {
+        int16_t x = 0;
+        if (converted != NULL) {
+            long long value = PyLong_AsLongLong(converted);
+            if (value == -1) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+            x = (int16_t) value;  // FIXME: Check out of bounds!
+        }
+        else {
+            x = to_int16(token->p, token->len, pconfig, &error);
+            if (error) {
+                return error;
+            }
+        }
+        *(int16_t *) data_ptr = x;
+    }
+    else if (typecode == 'H') {
+        uint16_t x = 0;
+        if (converted != NULL) {
+            size_t value = PyLong_AsSize_t(converted);
+            if (value == (size_t)-1) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+            x = (uint16_t) value;  // FIXME: Check out of bounds!
+        }
+        else {
+            x = to_uint16(token->p, token->len, pconfig, &error);
+            if (error) {
+                return error;
+            }
+        }
+        *(uint16_t *) data_ptr = x;
+    }
+    else if (typecode == 'i') {
+        int32_t x = 0;
+        if (converted != NULL) {
+            long long value = PyLong_AsLongLong(converted);
+            if (value == -1) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+            x = (int32_t) value;  // FIXME: Check out of bounds!
+        }
+        else {
+            x = to_int32(token->p, token->len, pconfig, &error);
+            if (error) {
+                return error;
+            }
+        }
+        *(int32_t *) data_ptr = x;
+    }
+    else if (typecode == 'I') {
+        uint32_t x = 0;
+        if (converted != NULL) {
+            size_t value = PyLong_AsSize_t(converted);
+            if (value == (size_t)-1) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+            x = (uint32_t) value;  // FIXME: Check out of bounds!
+        }
+        else {
+            x = to_uint32(token->p, token->len, pconfig, &error);
+            if (error) {
+                return error;
+            }
+        }
+        *(uint32_t *) data_ptr = x;
+    }
+    else if (typecode == 'q') {
+        int64_t x = 0;
+        if (converted != NULL) {
+            long long value = PyLong_AsLongLong(converted);
+            if (value == -1) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+            x = (int64_t) value;  // FIXME: Check out of bounds!
+        }
+        else {
+            x = to_int64(token->p, token->len, pconfig, &error);
+            if (error) {
+                return error;
+            }
+        }
+        *(int64_t *) data_ptr = x;
+    }
+    else if (typecode == 'Q') {
+        uint64_t x = 0;
+        if (converted != NULL) {
+            size_t value = PyLong_AsSize_t(converted);
+            if (value == (size_t)-1) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+            x = (uint64_t) value;  // FIXME: Check out of bounds!
+        }
+        else {
+            x = to_uint64(token->p, token->len, pconfig, &error);
+            if (error) {
+                return error;
+            }
+        }
+        *(uint64_t *) data_ptr = x;
+    }
+    else if (typecode == 'f' || typecode == 'd') {
+        // Convert to float.
+        double x = NAN;
+        if (converted != NULL) {
+            x = PyFloat_AsDouble(converted);
+            if (x == -1.0) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+        }
+        else {
+            char32_t decimal = pconfig->decimal;
+            char32_t sci = pconfig->sci;
+            if ((token->len == 0) ||
+                    !to_double(token->p, token->len, &x, sci, decimal)) {
+                return ERROR_BAD_FIELD;
+            }
+        }
+        if (typecode == 'f') {
+            *(float *) data_ptr = (float) x;
+        }
+        else {
+            *(double *) data_ptr = x;
+        }
+    }
+    else if (typecode == 'z' || typecode == 'c') {
+        // Convert to complex.
+        double x = NAN;
+        double y = NAN;
+        if (converted != NULL) {
+            // FIXME: This case not converted from the float/double code.
+            x = PyFloat_AsDouble(converted);
+            if (x == -1.0) {
+                if (PyErr_Occurred()) {
+                    return ERROR_BAD_FIELD;
+                }
+            }
+        }
+        else {
+            char32_t decimal = pconfig->decimal;
+            char32_t sci = pconfig->sci;
+            char32_t imaginary_unit = pconfig->imaginary_unit;
+            if ((token->len == 0) ||
+                    !to_complex(token->p, token->len, &x, &y,
+                                sci, decimal, imaginary_unit,
+                                ALLOW_PARENS)) {
+                return ERROR_BAD_FIELD;
+            }
+        }
+        if (typecode == 'c') {
+            *(complex float *) data_ptr = (complex float) (x + I*y);
+        }
+        else {
+            *(complex double *) data_ptr = x + I*y;
+        }
+    }
+    else if (typecode == 'S') {
+        // String
+        memset(data_ptr, 0, itemsize);
+        // One byte per character; a non-ASCII character is
+        // truncated to its low byte (so Latin-1 text keeps
+        // its bytes).
+        const uint8_t *p = token->p;
+        const uint8_t *end = p + token->len;
+        size_t i = 0;
+        while (i < (size_t) itemsize && p < end) {
+            if (*p < 0x80) {
+                data_ptr[i] = *p;
+                ++p;
+            }
+            else {
+                int len;
+                data_ptr[i] = (char) utf8_decode_char(p, &len);
+                p += len;
+            }
+            ++i;
+        }
+    }
+    else {  // typecode == 'U'
+        memset(data_ptr, 0, itemsize);
+        if (converted != NULL) {
+            Py_ssize_t len;
+            int kind;
+            void *data;
+            if (!PyUnicode_Check(converted)) {
+                return ERROR_BAD_FIELD;
+            }
+            len = PyUnicode_GET_LENGTH(converted);
+            if (4*len > itemsize) {
+                // XXX Make a more specific error type? Converted
+                // Unicode string is too long.
+                return ERROR_BAD_FIELD;
+            }
+            kind = PyUnicode_KIND(converted);
+            data = PyUnicode_DATA(converted);
+            for (Py_ssize_t i = 0; i < len; ++i) {
+                *(char32_t *)(data_ptr + 4*i) = PyUnicode_READ(kind, data, i);
+            }
+        }
+        else {
+            // XXX The '4' in the following is sizeof(char32_t).
+            utf8_decode(token->p, token->len,
+                        (char32_t *) data_ptr,
+                        itemsize/4);
+        }
+    }
+    return 0;
+}
+
+/*
+ *  Convert the num_rows rows of the batch in *tokens, and store them at
+ *  row_ptrs[0], ..., row_ptrs[num_rows - 1].
+ *
+ *  The batch is converted column by column, so that the same conversion
+ *  runs over all the rows before the next one starts.  An error stops the
+ *  conversion of its row and of the rows after it, in this column and the
+ *  next ones; so the error that is reported (in *read_error) is the first
+ *  one in the order of the file, as if the rows were converted one by one.
+ *  Since the converters are Python functions, which must not be called
+ *  after a failed call, a batch with converters must have one row.
+ *
+ *  Returns the number of rows converted: num_rows, or the index of the row
+ *  that has the error.
+ */
+static int
+convert_rows(const token_index *tokens, int num_rows, char **row_ptrs,
+             int num_field_types, field_type *field_types,
+             parser_config *pconfig, int32_t *usecols, int num_usecols,
+             PyObject **conv_funcs, read_error_type *read_error)
+{
+    int bad_row = num_rows;
+    size_t offset = 0;
+
+    for (int j = 0; j < num_usecols; ++j) {
+        // f is the index into the field_types array.  If there is only
+        // one field type, it applies to all fields found in the file.
+        int f = (num_field_types == 1) ? 0 : j;
+        char typecode = field_types[f].typecode;
+        int32_t itemsize = field_types[f].itemsize;
+        PyObject *conv_func = (conv_funcs != NULL) ? conv_funcs[j] : NULL;
+
+        for (int i = 0; i < bad_row; ++i) {
+            const field_span *row = tokens->fields + tokens->row_starts[i];
+            int num_fields = tokens->row_starts[i + 1] - tokens->row_starts[i];
+            PyObject *converted = NULL;
+            int error = ERROR_OK;
+            // k is the column index of the field in the file.
+            int k = j;
+
+            if (usecols != NULL) {
+                k = usecols[j];
+                if (k < 0) {
+                    // Python-like column indexing: k = -1 means the last column.
+                    k += num_fields;
+                }
+                if ((k < 0) || (k >= num_fields)) {
+                    read_error->error_type = ERROR_INVALID_COLUMN_INDEX;
+                    read_error->line_number = tokens->row_lines[i] - 1;
+                    read_error->column_index = usecols[j];
+                    bad_row = i;
+                    break;
+                }
+            }
+
+            if (conv_func != NULL) {
+                converted = call_converter_function(conv_func, &row[k]);
+                if (converted == NULL) {
+                    error = ERROR_CONVERTER_FAILED;
+                }
+            }
+            if (error == ERROR_OK) {
+                error = convert_field(typecode, itemsize, &row[k], converted,
+                                      pconfig, row_ptrs[i] + offset);
+            }
+            if (error != ERROR_OK) {
+                read_error->error_type = error;
+                read_error->line_number = tokens->row_lines[i] - 1;
+                read_error->field_number = k;
+                read_error->char_position = -1; // FIXME
+                read_error->typecode = typecode;
+                bad_row = i;
+                break;
+            }
+        }
+        offset += itemsize;
+    }
+    return bad_row;
+}
+
+
 /*
  *  XXX Handle errors in any of the functions called by read_rows().
  *
@@ -215,6 +577,9 @@ PyObject **create_conv_funcs(PyObject *converters, int32_t *usecols, int num_use
  *  PyObject *converters
  *      dicitionary of converters
  *  void *data_array
+ *  int hints
+ *      HINT_* flags (see hints.h) for the memory allocated when *nrows is
+ *      negative.
  *  int *num_cols
  *      The actual number of columns (or fields) of the data being returned.
  *  read_error_type *read_error
@@ -228,24 +593,29 @@ void *read_rows(stream *s, int *nrows,
                 int skiplines,
                 PyObject *converters,
                 void *data_array,
+                int hints,
                 int *num_cols,
                 read_error_type *read_error)
 {
-    char *data_ptr;
+    char *data_ptr = NULL;
+    size_t row_stride = 0;
     int current_num_fields;
-    char32_t **result;
+    field_span *result;
     size_t row_size;
     size_t size;
     PyObject **conv_funcs = NULL;
 
     bool track_string_size = false;
 
-    bool use_blocks;
+    bool use_blocks = false;
     blocks_data *blks = NULL;
 
     int row_count;
-    char32_t word_buffer[WORD_BUFFER_SIZE];
-    int tok_error_type;
+    int batch_size;
+    char **row_ptrs = NULL;
+    int num_fields_needed = 0;
+    token_index tokens;
+    int tok_error_type = 0;
 
     int actual_num_fields = -1;
 
@@ -281,13 +651,28 @@ void *read_rows(stream *s, int *nrows,
                          ((field_types[0].typecode == 'S') ||
                           (field_types[0].typecode == 'U')));
 
+    token_index_init(&tokens, pconfig);
+
+    // The first row is tokenized alone, since the rest of the setup depends
+    // on it.  Then the rows are tokenized in batches, and each batch is
+    // converted column by column.
+    batch_size = 1;
     row_count = 0;
-    while (((*nrows < 0) || (row_count < *nrows)) &&
-           (result = tokenize(s, word_buffer, WORD_BUFFER_SIZE, pconfig,
-                              &current_num_fields, &tok_error_type)) != NULL) {
-        int j, k;
+    while ((*nrows < 0) || (row_count < *nrows)) {
+        int max_rows = batch_size;
+        int num_rows, num_converted, bad_row, i, j;
+
+        if ((*nrows >= 0) && (*nrows - row_count < max_rows)) {
+            max_rows = *nrows - row_count;
+        }
+        num_rows = tokenize_rows(s, pconfig, &tokens, max_rows, &tok_error_type);
+        if (num_rows == 0) {
+            break;
+        }
+        result = tokens.fields;
 
         if (actual_num_fields == -1) {
+            current_num_fields = tokens.row_starts[1];
             // We've deferred some of the initialization tasks to here,
             // because we've now read the first line, and we definitively
             // know how many fields (i.e. columns) we will be processing.
@@ -315,12 +700,19 @@ void *read_rows(stream *s, int *nrows,
                     }
                     // XXX Check that the value is between 0 and current_num_fields.
                 }
+                // The tokenizer can skip the fields that are not used.
+                if (token_index_project(&tokens, usecols, num_usecols) != 0) {
+                    read_error->error_type = ERROR_OUT_OF_MEMORY;
+                    token_index_free(&tokens);
+                    return NULL;
+                }
             }
 
             if (converters != Py_None) {
                 conv_funcs = create_conv_funcs(converters, usecols, num_usecols,
                                                current_num_fields, read_error);
                 if (conv_funcs == NULL) {
+                    token_index_free(&tokens);
                     return NULL;
                 }
             }
@@ -355,11 +747,13 @@ void *read_rows(stream *s, int *nrows,
                 // or not initialized. I.e. the value passed in is ignored,
                 // and instead is initialized to the first block.
                 use_blocks = true;
-                blks = blocks_init(row_size, ROWS_PER_BLOCK, INITIAL_BLOCKS_TABLE_LENGTH);
+                blks = blocks_init(row_size, ROWS_PER_BLOCK, INITIAL_BLOCKS_TABLE_LENGTH,
+                                   hints);
                 if (blks == NULL) {
                     // XXX Check for other clean up that might be necessary.
                     read_error->error_type = ERROR_OUT_OF_MEMORY;
                     free(conv_funcs);
+                    token_index_free(&tokens);
                     return NULL;
                 }
             }
@@ -373,413 +767,155 @@ void *read_rows(stream *s, int *nrows,
                     data_array = malloc(size);
                     if (data_array == NULL) {
                         read_error->error_type = ERROR_OUT_OF_MEMORY;
+                        token_index_free(&tokens);
                         return NULL;
                     }
                 }
                 data_ptr = data_array;
             }
-        }
-        else {
-            // *Not* the first line...
-            if (track_string_size) {
-                size_t new_itemsize;
-                // typecode must be 'S' or 'U'.
-                // Find the maximum field length in the current line.
-                if (converters != Py_None) {
-                    // XXX Not handled yet.
-                }
-                size_t maxlen = max_token_len(result, actual_num_fields,
-                                              usecols, num_usecols);
-                new_itemsize = (field_types[0].typecode == 'S') ? maxlen : 4*maxlen;
-                if (new_itemsize > field_types[0].itemsize) {
-                    // There is a field in this row whose length is
-                    // more than any previously seen length.
-                    if (use_blocks) {
-                        int status = blocks_uniform_resize(blks, actual_num_fields, new_itemsize);
-                        if (status != 0) {
-                            // XXX Handle this--probably out of memory.
-                        }
-                    }
-                    field_types[0].itemsize = new_itemsize;
-                }
-            }    
-        }
 
-        if (!usecols && (actual_num_fields != current_num_fields)) {
-            read_error->error_type = ERROR_CHANGED_NUMBER_OF_FIELDS;
-            read_error->line_number = stream_linenumber(s);
-            read_error->column_index = current_num_fields;
-            if (use_blocks) {
-                blocks_destroy(blks);
+            // Size the batches.  (With converters, the rows are converted
+            // one by one; see convert_rows().)
+            batch_size = FIELDS_PER_BATCH / ((current_num_fields > 0) ? current_num_fields : 1);
+            if (batch_size > ROWS_PER_BATCH) {
+                batch_size = ROWS_PER_BATCH;
             }
-            return NULL;
-        }
-
-        if (use_blocks) {
-            data_ptr = blocks_get_row_ptr(blks, row_count);
-            if (data_ptr == NULL) {
-                blocks_destroy(blks);
+            if (batch_size < 1 || conv_funcs != NULL) {
+                batch_size = 1;
+            }
+            row_ptrs = malloc(batch_size * sizeof(char *));
+            if (row_ptrs == NULL) {
                 read_error->error_type = ERROR_OUT_OF_MEMORY;
+                if (use_blocks) {
+                    blocks_destroy(blks);
+                }
+                token_index_free(&tokens);
                 return NULL;
             }
-        }
-
-        for (j = 0; j < num_usecols; ++j) {
-            int error = ERROR_OK;
-            // f is the index into the field_types array.  If there is only
-            // one field type, it applies to all fields found in the file.
-            int f = (num_field_types == 1) ? 0 : j;
-            char typecode = field_types[f].typecode;
-            PyObject *converted = NULL;
-
-            // k is the column index of the field in the file.
-            if (usecols == NULL) {
-                k = j;
+            if (usecols != NULL) {
+                // The rows with fewer fields are not converted (see below).
+                num_fields_needed = 0;
+                for (j = 0; j < num_usecols; ++j) {
+                    if (usecols[j] < 0) {
+                        num_fields_needed = INT_MAX;
+                        break;
+                    }
+                    if (usecols[j] >= num_fields_needed) {
+                        num_fields_needed = usecols[j] + 1;
+                    }
+                }
             }
             else {
-                k = usecols[j];
-                if (k < 0) {
-                    // Python-like column indexing: k = -1 means the last column.
-                    k += current_num_fields;
-                }
-                if ((k < 0) || (k >= current_num_fields)) {
-                    read_error->error_type = ERROR_INVALID_COLUMN_INDEX;
-                    read_error->line_number = stream_linenumber(s) - 1;
-                    read_error->column_index = usecols[j];
-                    break;
-                }
+                num_fields_needed = actual_num_fields;
             }
+        }
 
-            read_error->error_type = 0;
-            read_error->line_number = stream_linenumber(s) - 1;
-            read_error->field_number = k;
-            read_error->char_position = -1; // FIXME
-            read_error->typecode = typecode;
-
-            if (conv_funcs && conv_funcs[j]) {
-                converted = call_converter_function(conv_funcs[j], result[k]);
-                if (converted == NULL) {
-                    read_error->error_type = ERROR_CONVERTER_FAILED;
+        // The rows from bad_row on are not converted: bad_row has the wrong
+        // number of fields.
+        bad_row = num_rows;
+        if (!usecols) {
+            for (i = 0; i < num_rows; ++i) {
+                if (tokens.row_starts[i + 1] - tokens.row_starts[i] != actual_num_fields) {
+                    bad_row = i;
                     break;
                 }
             }
+        }
 
-            // FIXME: There is a lot of repeated code in the following.
-            // This needs to be modularized.
-
-            if (typecode == 'b') {
-                int8_t x = 0;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        long long value = PyLong_AsLongLong(converted);
-                        if (value == -1) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                        x = (int8_t) value;  // FIXME: Check out of bounds!
-                    }
-                    else {
-                        x = to_int8(result[k], pconfig, &read_error->error_type);
-                        if (read_error->error_type) {
-                            break;
-                        }
-                    }
-                }
-                *(int8_t *) data_ptr = x;
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'B') {
-                uint8_t x = 0;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        size_t value = PyLong_AsSize_t(converted);
-                        if (value == (size_t)-1) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                        x = (uint8_t) value;  // FIXME: Check out of bounds!
-                    }
-                    else {
-                        x = to_uint8(result[k], pconfig, &read_error->error_type);
-                        if (read_error->error_type) {
-                            break;
-                        }
-                    }
-                }
-                *(uint8_t *) data_ptr = x;
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'h') {
-                int16_t x = 0;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        long long value = PyLong_AsLongLong(converted);
-                        if (value == -1) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                        x = (int16_t) value;  // FIXME: Check out of bounds!
-                    }
-                    else {
-                        x = to_int16(result[k], pconfig, &read_error->error_type);
-                        if (read_error->error_type) {
-                            break;
-                        }
-                    }
-                }
-                *(int16_t *) data_ptr = x;
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'H') {
-                uint16_t x = 0;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        size_t value = PyLong_AsSize_t(converted);
-                        if (value == (size_t)-1) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                        x = (uint16_t) value;  // FIXME: Check out of bounds!
-                    }
-                    else {
-                        x = to_uint16(result[k], pconfig, &read_error->error_type);
-                        if (read_error->error_type) {
-                            break;
-                        }
-                    }
-                }
-                *(uint16_t *) data_ptr = x;
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'i') {
-                int32_t x = 0;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        long long value = PyLong_AsLongLong(converted);
-                        if (value == -1) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                        x = (int32_t) value;  // FIXME: Check out of bounds!
-                    }
-                    else {
-                        x = to_int32(result[k], pconfig, &read_error->error_type);
-                        if (read_error->error_type) {
-                            break;
-                        }
-                    }
-                }
-                *(int32_t *) data_ptr = x;
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'I') {
-                uint32_t x = 0;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        size_t value = PyLong_AsSize_t(converted);
-                        if (value == (size_t)-1) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                        x = (uint32_t) value;  // FIXME: Check out of bounds!
-                    }
-                    else {
-                        x = to_uint32(result[k], pconfig, &read_error->error_type);
-                        if (read_error->error_type) {
-                            break;
-                        }
-                    }
-                }
-                *(uint32_t *) data_ptr = x;
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'q') {
-                int64_t x = 0;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        long long value = PyLong_AsLongLong(converted);
-                        if (value == -1) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                        x = (int64_t) value;  // FIXME: Check out of bounds!
-                    }
-                    else {
-                        x = to_int64(result[k], pconfig, &read_error->error_type);
-                        if (read_error->error_type) {
-                            break;
-                        }
-                    }
-                }
-                *(int64_t *) data_ptr = x;
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'Q') {
-                uint64_t x = 0;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        size_t value = PyLong_AsSize_t(converted);
-                        if (value == (size_t)-1) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                        x = (uint64_t) value;  // FIXME: Check out of bounds!
-                    }
-                    else {
-                        x = to_uint64(result[k], pconfig, &read_error->error_type);
-                        if (read_error->error_type) {
-                            break;
-                        }
-                    }
-                }
-                *(uint64_t *) data_ptr = x;
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'f' || typecode == 'd') {
-                // Convert to float.
-                double x = NAN;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        x = PyFloat_AsDouble(converted);
-                        if (x == -1.0) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                    }
-                    else {
-                        char32_t decimal = pconfig->decimal;
-                        char32_t sci = pconfig->sci;
-                        if ((*(result[k]) == '\0') || !to_double(result[k], &x, sci, decimal)) {
-                            read_error->error_type = ERROR_BAD_FIELD;
-                            break;
-                        }
-                    }
-                }
-                if (typecode == 'f') {
-                    *(float *) data_ptr = (float) x;
-                }
-                else {
-                    *(double *) data_ptr = x;
-                }
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'z' || typecode == 'c') {
-                // Convert to complex.
-                double x = NAN;
-                double y = NAN;
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        // FIXME: This case not converted from the float/double code.
-                        x = PyFloat_AsDouble(converted);
-                        if (x == -1.0) {
-                            if (PyErr_Occurred()) {
-                                read_error->error_type = ERROR_BAD_FIELD;
-                                break;
-                            }
-                        }
-                    }
-                    else {
-                        char32_t decimal = pconfig->decimal;
-                        char32_t sci = pconfig->sci;
-                        char32_t imaginary_unit = pconfig->imaginary_unit;
-                        if ((*(result[k]) == '\0') || !to_complex(result[k], &x, &y,
-                                                                  sci, decimal,
-                                                                  imaginary_unit,
-                                                                  ALLOW_PARENS)) {
-                            read_error->error_type = ERROR_BAD_FIELD;
-                            break;
-                        }
-                    }
-                }
-                if (typecode == 'c') {
-                    *(complex float *) data_ptr = (complex float) (x + I*y);
-                }
-                else {
-                    *(complex double *) data_ptr = x + I*y;
-                }
-                data_ptr += field_types[f].itemsize;
-            }
-            else if (typecode == 'S') {
-                // String
-                memset(data_ptr, 0, field_types[f].itemsize);
-                if (k < current_num_fields) {
-                    //strncpy(data_ptr, result[k], field_types[f].itemsize);
-                    size_t i = 0;
-                    while (i < (size_t) field_types[f].itemsize && result[k][i]) {
-                        data_ptr[i] = result[k][i];
-                        ++i;
-                    }
-                    if (i < (size_t) field_types[f].itemsize) {
-                        data_ptr[i] = '\0';
+        if (track_string_size && row_count > 0) {
+            // typecode must be 'S' or 'U'.
+            // Find the maximum field length in the rows of the batch.
+            size_t maxlen = 0;
+            size_t new_itemsize;
+            if (converters != Py_None) {
+                // XXX Not handled yet.
+            }
+            for (i = 0; i < bad_row; ++i) {
+                if (tokens.row_starts[i + 1] - tokens.row_starts[i] >= num_fields_needed) {
+                    size_t m = max_token_len(result + tokens.row_starts[i],
+                                             actual_num_fields,
+                                             usecols, num_usecols);
+                    if (m > maxlen) {
+                        maxlen = m;
                     }
                 }
-                data_ptr += field_types[f].itemsize;
-            }
-            else {  // typecode == 'U'
-                memset(data_ptr, 0, field_types[f].itemsize);
-                if (k < current_num_fields) {
-                    if (converted != NULL) {
-                        Py_ssize_t len;
-                        int kind;
-                        void *data;
-                        if (!PyUnicode_Check(converted)) {
-                            read_error->error_type = ERROR_BAD_FIELD;
-                            break;
-                        }
-                        len = PyUnicode_GET_LENGTH(converted);
-                        if (4*len > field_types[f].itemsize) {
-                            // XXX Make a more specific error type? Converted
-                            // Unicode string is too long.
-                            read_error->error_type = ERROR_BAD_FIELD;
-                            break;
-                        }
-                        kind = PyUnicode_KIND(converted);
-                        data = PyUnicode_DATA(converted);
-                        for (Py_ssize_t i = 0; i < len; ++i) {
-                            *(char32_t *)(data_ptr + 4*i) = PyUnicode_READ(kind, data, i);
-                        }
-                    }
-                    else {
-                        size_t i = 0;
-                        // XXX The '4's in the following are sizeof(char32_t).
-                        while (i < (size_t) field_types[f].itemsize/4 && result[k][i]) {
-                            *(char32_t *)(data_ptr + 4*i) = result[k][i];
-                            ++i;
-                        }
-                        if (i < (size_t) field_types[f].itemsize/4) {
-                            *(char32_t *)(data_ptr + 4*i) = '\0';
-                        }
+            }
+            new_itemsize = (field_types[0].typecode == 'S') ? maxlen : 4*maxlen;
+            if (new_itemsize > field_types[0].itemsize) {
+                // There is a field in this batch whose length is
+                // more than any previously seen length.
+                if (use_blocks) {
+                    int status = blocks_uniform_resize(blks, actual_num_fields, new_itemsize);
+                    if (status != 0) {
+                        // XXX Handle this--probably out of memory.
                     }
                 }
-                data_ptr += field_types[f].itemsize;
+                field_types[0].itemsize = new_itemsize;
             }
         }
 
-        free(result);
+        if (!use_blocks) {
+            // The rows are packed in data_array: each one takes the
+            // itemsizes of the fields that are stored.
+            row_stride = 0;
+            for (j = 0; j < num_usecols; ++j) {
+                row_stride += field_types[(num_field_types == 1) ? 0 : j].itemsize;
+            }
+        }
+        for (i = 0; i < bad_row; ++i) {
+            if (use_blocks) {
+                row_ptrs[i] = blocks_get_row_ptr(blks, row_count + i);
+                if (row_ptrs[i] == NULL) {
+                    blocks_destroy(blks);
+                    read_error->error_type = ERROR_OUT_OF_MEMORY;
+                    token_index_free(&tokens);
+                    free(row_ptrs);
+                    return NULL;
+                }
+            }
+            else {
+                row_ptrs[i] = data_ptr + i * row_stride;
+            }
+        }
 
+        num_converted = convert_rows(&tokens, bad_row, row_ptrs,
+                                     num_field_types, field_types, pconfig,
+                                     usecols, num_usecols, conv_funcs, read_error);
+        row_count += num_converted;
+        if (!use_blocks) {
+            data_ptr += num_converted * row_stride;
+        }
         if (read_error->error_type != 0) {
             break;
         }
 
-        ++row_count;
+        if (bad_row < num_rows) {
+            read_error->error_type = ERROR_CHANGED_NUMBER_OF_FIELDS;
+            read_error->line_number = tokens.row_lines[bad_row];
+            read_error->column_index = tokens.row_starts[bad_row + 1] -
+                                       tokens.row_starts[bad_row];
+            if (use_blocks) {
+                blocks_destroy(blks);
+            }
+            token_index_free(&tokens);
+            free(row_ptrs);
+            return NULL;
+        }
+
+        if (tok_error_type != 0) {
+            break;
+        }
+    }
+
+    token_index_free(&tokens);
+    free(row_ptrs);
+
+    if (read_error->error_type == 0 && tok_error_type != 0 &&
+            tok_error_type != ERROR_NO_DATA) {
+        // tokenize() failed for a reason other than reaching the end
+        // of the file, e.g. a read error or invalid encoded data.
+        read_error->error_type = tok_error_type;
+        read_error->line_number = stream_linenumber(s);
     }
 
     if (use_blocks) {
@@ -39,6 +39,7 @@ void *read_rows(stream *s, int *nrows,
                 int skiplines,
                 PyObject *converters,
                 void *data_array,
+                int hints,
                 int *num_cols,
                 read_error_type *read_error);
 
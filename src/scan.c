@@ -0,0 +1,455 @@
+//
+// scan.c
+//
+// The public functions defined in this file are
+//
+//     void scan_set_init(scan_set *set, char32_t delimiter, char32_t quote,
+//                        char32_t comment)
+//     size_t scan_copy(const scan_set *set, const uint8_t *p,
+//                      const uint8_t *end, uint8_t *dst, size_t max)
+//     size_t scan_skip(const scan_set *set, const uint8_t *p,
+//                      const uint8_t *end)
+//     size_t scan_blanks(const uint8_t *p, const uint8_t *end)
+//     size_t scan_lines(const uint8_t *p, const uint8_t *end, int *num_lines)
+//     int scan_level(void)
+//     int scan_use_level(int level)
+//
+// scan_copy() is the bulk path of the tokenizer: it copies the bytes from
+// p up to (not including) the first byte that is in `set` or is not ASCII
+// to dst, and returns the number of bytes copied.  At
+// most `max` bytes are copied, and the bytes from `end` on are not read.
+// scan_skip() is the same without the copy, for fields that the tokenizer
+// uses in place.
+// Those bytes need no decoding and no decision of the tokenizer's state
+// machine, so in unquoted numeric data most of a field is copied by one
+// call.
+// scan_blanks() returns the number of spaces and tabs at p, for the
+// whitespace-delimited tokenizer, which skips the runs of blanks between
+// fields with it.
+// scan_lines() returns the number of bytes at p up to and including the
+// *num_lines-th '\n' (or end - p if there are fewer), and subtracts the
+// number of newlines in those bytes from *num_lines; the streams skip
+// lines (skiprows, comment headers) with it.  The newlines of a block are
+// counted at once, so short lines cost no more than long ones.
+//
+// The bytes are compared with the set 16 or 32 at a time, with SSE2 or
+// AVX2, as supported by the CPU (checked once, at run time), and each
+// block is stored to dst as it is.  On other architectures, a table lookup
+// is used.  An AVX-512BW version (64 bytes at a time) is only used when
+// asked for with scan_use_level(): most runs in a text file are a few bytes
+// long, and for those the 512 bit version was measured to be several times
+// slower than the AVX2 one.  scan_level() returns the SCAN_* level in use;
+// scan_use_level() selects another level supported by the CPU (for the
+// tests), and returns the level actually used.
+//
+// Pure C, no Python API used.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "typedefs.h"
+#include "scan.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+
+void scan_set_init(scan_set *set, char32_t delimiter, char32_t quote,
+                   char32_t comment)
+{
+    char32_t c[3] = {delimiter, quote, comment};
+
+    // With whitespace delimiters, the blanks (space and tab) end the run.
+    set->low = (delimiter == ' ' || delimiter == '\0') ? ' ' : '\r';
+
+    memset(set->special, 0, sizeof(set->special));
+    for (int i = 0; i < 3; ++i) {
+        // A non-ASCII character starts with a byte >= 0x80, which ends the
+        // run anyway.  (That is also what a zero quote or comment, i.e.
+        // "none", is replaced with.)
+        set->c[i] = (c[i] < 0x80 && c[i] != 0) ? (uint8_t) c[i] : '\n';
+        set->special[set->c[i]] = true;
+    }
+    for (int i = 0; i <= set->low; ++i) {
+        set->special[i] = true;
+    }
+    for (int i = 0x80; i < 256; ++i) {
+        set->special[i] = true;
+    }
+}
+
+
+static size_t
+scan_copy_scalar(const scan_set *set, const uint8_t *p, size_t n,
+                 uint8_t *dst)
+{
+    size_t k = 0;
+
+    if (dst == NULL) {
+        while (k < n && !set->special[p[k]]) {
+            ++k;
+        }
+        return k;
+    }
+    while (k < n && !set->special[p[k]]) {
+        dst[k] = p[k];
+        ++k;
+    }
+    return k;
+}
+
+static size_t
+scan_blanks_scalar(const uint8_t *p, size_t n)
+{
+    size_t k = 0;
+
+    while (k < n && (p[k] == ' ' || p[k] == '\t')) {
+        ++k;
+    }
+    return k;
+}
+
+
+static size_t
+scan_lines_scalar(const uint8_t *p, size_t n, int *num_lines)
+{
+    size_t k = 0;
+
+    while (*num_lines > 0 && k < n) {
+        const uint8_t *nl = memchr(p + k, '\n', n - k);
+        if (nl == NULL) {
+            return n;
+        }
+        k = (nl - p) + 1;
+        --*num_lines;
+    }
+    return k;
+}
+
+
+#ifdef SCAN_X86
+
+/*
+ *  The vector versions compare a block of bytes with each byte of the set
+ *  and with set->low (v <= low is tested as min(v, low) == v), and OR the
+ *  results with the block itself, so the high bit of each byte is set for
+ *  the bytes that end the run.  Unless dst is NULL, the whole block is
+ *  stored in dst (there is room for it, since it is not longer than n).
+ *  Then the position of the first byte that ends the run, if any, is
+ *  returned.
+ */
+
+static size_t
+scan_copy_sse2(const scan_set *set, const uint8_t *p, size_t n,
+               uint8_t *dst)
+{
+    const __m128i c0 = _mm_set1_epi8(set->c[0]);
+    const __m128i c1 = _mm_set1_epi8(set->c[1]);
+    const __m128i c2 = _mm_set1_epi8(set->c[2]);
+    const __m128i low = _mm_set1_epi8(set->low);
+    size_t k = 0;
+
+    while (k + 16 <= n) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + k));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, c0),
+                                              _mm_cmpeq_epi8(v, c1)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, c2),
+                                              _mm_cmpeq_epi8(_mm_min_epu8(v, low), v)));
+        unsigned mask;
+
+        m = _mm_or_si128(m, v);
+        mask = (unsigned) _mm_movemask_epi8(m);
+
+        if (dst != NULL) {
+            _mm_storeu_si128((__m128i *) (dst + k), v);
+        }
+        if (mask != 0) {
+            return k + __builtin_ctz(mask);
+        }
+        k += 16;
+    }
+    return k + scan_copy_scalar(set, p + k, n - k, dst ? dst + k : NULL);
+}
+
+__attribute__((target("avx2")))
+static size_t
+scan_copy_avx2(const scan_set *set, const uint8_t *p, size_t n,
+               uint8_t *dst)
+{
+    const __m256i c0 = _mm256_set1_epi8(set->c[0]);
+    const __m256i c1 = _mm256_set1_epi8(set->c[1]);
+    const __m256i c2 = _mm256_set1_epi8(set->c[2]);
+    const __m256i low = _mm256_set1_epi8(set->low);
+    size_t k = 0;
+
+    while (k + 32 <= n) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + k));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, c0),
+                                                    _mm256_cmpeq_epi8(v, c1)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, c2),
+                                                    _mm256_cmpeq_epi8(_mm256_min_epu8(v, low), v)));
+        unsigned mask;
+
+        m = _mm256_or_si256(m, v);
+        mask = (unsigned) _mm256_movemask_epi8(m);
+
+        if (dst != NULL) {
+            _mm256_storeu_si256((__m256i *) (dst + k), v);
+        }
+        if (mask != 0) {
+            return k + __builtin_ctz(mask);
+        }
+        k += 32;
+    }
+    // The tail is done by the SSE2 version (and its scalar tail).
+    return k + scan_copy_sse2(set, p + k, n - k, dst ? dst + k : NULL);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t
+scan_copy_avx512(const scan_set *set, const uint8_t *p, size_t n,
+                 uint8_t *dst)
+{
+    const __m512i c0 = _mm512_set1_epi8(set->c[0]);
+    const __m512i c1 = _mm512_set1_epi8(set->c[1]);
+    const __m512i c2 = _mm512_set1_epi8(set->c[2]);
+    const __m512i low = _mm512_set1_epi8(set->low);
+    size_t k;
+
+    // Most fields are short, and for those a 64 byte block costs more than
+    // it saves, so the first 32 bytes are done by the AVX2 version.
+    k = scan_copy_avx2(set, p, (n < 32) ? n : 32, dst);
+    if (k < 32) {
+        return k;
+    }
+
+    while (k + 64 <= n) {
+        __m512i v = _mm512_loadu_si512((const void *) (p + k));
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(v, c0) |
+                         _mm512_cmpeq_epi8_mask(v, c1) |
+                         _mm512_cmpeq_epi8_mask(v, c2) |
+                         _mm512_cmple_epu8_mask(v, low) |
+                         _mm512_movepi8_mask(v);
+
+        if (dst != NULL) {
+            _mm512_storeu_si512((void *) (dst + k), v);
+        }
+        if (mask != 0) {
+            return k + __builtin_ctzll(mask);
+        }
+        k += 64;
+    }
+    return k + scan_copy_avx2(set, p + k, n - k, dst ? dst + k : NULL);
+}
+
+/*
+ *  The first byte of the block that is not a blank is the first byte that
+ *  is equal neither to ' ' nor to '\t'.
+ */
+
+static size_t
+scan_blanks_sse2(const uint8_t *p, size_t n)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    size_t k = 0;
+
+    while (k + 16 <= n) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + k));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                 _mm_cmpeq_epi8(v, tab));
+        unsigned mask = ~(unsigned) _mm_movemask_epi8(m) & 0xFFFF;
+
+        if (mask != 0) {
+            return k + __builtin_ctz(mask);
+        }
+        k += 16;
+    }
+    return k + scan_blanks_scalar(p + k, n - k);
+}
+
+__attribute__((target("avx2")))
+static size_t
+scan_blanks_avx2(const uint8_t *p, size_t n)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    size_t k = 0;
+
+    while (k + 32 <= n) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + k));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                    _mm256_cmpeq_epi8(v, tab));
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(m);
+
+        if (mask != 0) {
+            return k + __builtin_ctz(mask);
+        }
+        k += 32;
+    }
+    return k + scan_blanks_sse2(p + k, n - k);
+}
+
+/*
+ *  mask has a bit set for each '\n' of the block; if there are at least
+ *  *num_lines of them, the position after the *num_lines-th is returned
+ *  (and *num_lines becomes 0), otherwise 0 (and they are subtracted).
+ */
+__attribute__((target("popcnt")))
+static inline size_t
+_lines_in_mask(unsigned mask, int *num_lines)
+{
+    int count = __builtin_popcount(mask);
+
+    if (count < *num_lines) {
+        *num_lines -= count;
+        return 0;
+    }
+    for (int j = 1; j < *num_lines; ++j) {
+        mask &= mask - 1;
+    }
+    *num_lines = 0;
+    return __builtin_ctz(mask) + 1;
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t
+scan_lines_avx2(const uint8_t *p, size_t n, int *num_lines)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t k = 0;
+
+    while (*num_lines > 0 && k + 32 <= n) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + k));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+
+        if (mask != 0) {
+            size_t j = _lines_in_mask(mask, num_lines);
+            if (j != 0) {
+                return k + j;
+            }
+        }
+        k += 32;
+    }
+    return k + scan_lines_scalar(p + k, n - k, num_lines);
+}
+
+#endif
+
+
+typedef size_t (*scan_copy_func)(const scan_set *set, const uint8_t *p,
+                                 size_t n, uint8_t *dst);
+
+static scan_copy_func scan_funcs[] = {
+    &scan_copy_scalar,
+#ifdef SCAN_X86
+    &scan_copy_sse2,
+    &scan_copy_avx2,
+    &scan_copy_avx512,
+#endif
+};
+
+typedef size_t (*scan_blanks_func)(const uint8_t *p, size_t n);
+
+// (The runs of blanks are short, so there is no AVX-512 version.)
+static scan_blanks_func blank_funcs[] = {
+    &scan_blanks_scalar,
+#ifdef SCAN_X86
+    &scan_blanks_sse2,
+    &scan_blanks_avx2,
+    &scan_blanks_avx2,
+#endif
+};
+
+typedef size_t (*scan_lines_func)(const uint8_t *p, size_t n, int *num_lines);
+
+// (memchr() is already vectorized; counting only pays off with AVX2.)
+static scan_lines_func lines_funcs[] = {
+    &scan_lines_scalar,
+#ifdef SCAN_X86
+    &scan_lines_scalar,
+    &scan_lines_avx2,
+    &scan_lines_avx2,
+#endif
+};
+
+// -1 until the CPU has been checked.  (Checking it twice in two threads
+// at the same time is harmless.)
+static int current_level = -1;
+
+// The highest level the CPU supports.
+static int
+_scan_cpu_level(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512bw")) {
+        return SCAN_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SCAN_AVX2;
+    }
+    return SCAN_SSE2;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+
+int scan_level(void)
+{
+    if (current_level < 0) {
+        int level = _scan_cpu_level();
+        current_level = (level < SCAN_AVX2) ? level : SCAN_AVX2;
+    }
+    return current_level;
+}
+
+
+int scan_use_level(int level)
+{
+    int max_level = _scan_cpu_level();
+
+    if (level < SCAN_SCALAR) {
+        level = SCAN_SCALAR;
+    }
+    current_level = (level < max_level) ? level : max_level;
+    return current_level;
+}
+
+
+size_t scan_copy(const scan_set *set, const uint8_t *p, const uint8_t *end,
+                 uint8_t *dst, size_t max)
+{
+    size_t n = end - p;
+
+    if (n > max) {
+        n = max;
+    }
+    return scan_funcs[scan_level()](set, p, n, dst);
+}
+
+
+size_t scan_skip(const scan_set *set, const uint8_t *p, const uint8_t *end)
+{
+    return scan_funcs[scan_level()](set, p, end - p, NULL);
+}
+
+
+size_t scan_blanks(const uint8_t *p, const uint8_t *end)
+{
+    return blank_funcs[scan_level()](p, end - p);
+}
+
+
+size_t scan_lines(const uint8_t *p, const uint8_t *end, int *num_lines)
+{
+    return lines_funcs[scan_level()](p, end - p, num_lines);
+}
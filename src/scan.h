@@ -0,0 +1,40 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "typedefs.h"
+
+#define SCAN_SCALAR  0
+#define SCAN_SSE2    1
+#define SCAN_AVX2    2
+#define SCAN_AVX512  3
+
+//
+// The bytes that end a run of plain characters: the delimiter, the quote
+// character, the first comment character, and the bytes up to `low`:
+// '\r', which includes '\n' (and the other control characters), or ' ',
+// which also includes the blanks, for whitespace-delimited input (the
+// delimiter is ' ' or '\0').  Bytes >= 0x80 always end a run.
+//
+typedef struct _scan_set {
+    uint8_t c[3];
+    uint8_t low;
+    bool special[256];
+} scan_set;
+
+void scan_set_init(scan_set *set, char32_t delimiter, char32_t quote,
+                   char32_t comment);
+
+size_t scan_copy(const scan_set *set, const uint8_t *p, const uint8_t *end,
+                 uint8_t *dst, size_t max);
+size_t scan_skip(const scan_set *set, const uint8_t *p, const uint8_t *end);
+size_t scan_blanks(const uint8_t *p, const uint8_t *end);
+size_t scan_lines(const uint8_t *p, const uint8_t *end, int *num_lines);
+
+int scan_level(void);
+int scan_use_level(int level);
+
+#endif
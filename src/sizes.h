@@ -1,11 +1,10 @@
 #ifndef _SIZES_H_
 #define _SIZES_H_
 
-// Maximum number of columns in a file.
-#define MAX_NUM_COLUMNS    2000
-
-// WORD_BUFFER_SIZE determines the maximum amount of non-delimiter
-// text in a row.
-#define WORD_BUFFER_SIZE 4000
+// Initial sizes of the tokenizer's arrays (see token_index in tokenize.h):
+// the number of fields in a row, and the amount of text of the fields that
+// are copied, in bytes of UTF-8.  Both are grown as needed.
+#define INITIAL_NUM_FIELDS          16
+#define INITIAL_WORD_BUFFER_SIZE  4000
 
 #endif
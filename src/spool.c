@@ -0,0 +1,199 @@
+//
+// spool.c
+//
+// The public function defined in this file is
+//
+//     int spool_source(buffered_source *source)
+//
+// The function replaces *source with a source that keeps a copy of all the
+// data read from the original source, so that it can be repositioned even
+// if the original source can not (e.g. a pipe, or a Python generator).
+// This allows the reader to make its two passes over such a source (the
+// first one to analyze the data when the dtype is not given) while the
+// source itself is read only once.
+//
+// The first SPOOL_MEMORY_SIZE bytes are kept in memory; the rest is written
+// to an anonymous temporary file (see tmpfile(3)), so the memory used is
+// bounded.  The original source's seek function is never called.
+//
+// Returns 0 on success, or -1 if the memory allocation fails; *source is
+// unchanged in that case.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "spool.h"
+
+#define SPOOL_MEMORY_SIZE 67108864
+
+
+typedef struct _spool {
+
+    /* The source being spooled. */
+    buffered_source source;
+
+    /* The first mem_len bytes of the data, in a buffer of mem_size bytes. */
+    uint8_t *mem;
+    size_t mem_len;
+    size_t mem_size;
+
+    /* The data after the first SPOOL_MEMORY_SIZE bytes, or NULL. */
+    FILE *file;
+
+    /* Number of bytes read from the source so far. */
+    long int total;
+
+    /* Offset of the next byte to be returned. */
+    long int pos;
+
+} spool;
+
+#define SP(sp)  ((spool *)sp)
+
+
+/*
+ *  int _sp_append(void *sp, const uint8_t *buf, size_t n)
+ *
+ *  Add n bytes read from the source to the spool.  Returns 0 on success,
+ *  or -1 if the memory allocation or the temporary file fails.
+ */
+
+static
+int _sp_append(void *sp, const uint8_t *buf, size_t n)
+{
+    size_t k = 0;
+
+    if (SP(sp)->mem_len < SPOOL_MEMORY_SIZE) {
+        k = SPOOL_MEMORY_SIZE - SP(sp)->mem_len;
+        if (k > n) {
+            k = n;
+        }
+        if (SP(sp)->mem_len + k > SP(sp)->mem_size) {
+            size_t new_size = 2*SP(sp)->mem_size;
+            uint8_t *new_mem;
+            if (new_size < SP(sp)->mem_len + k) {
+                new_size = SP(sp)->mem_len + k;
+            }
+            if (new_size > SPOOL_MEMORY_SIZE) {
+                new_size = SPOOL_MEMORY_SIZE;
+            }
+            new_mem = realloc(SP(sp)->mem, new_size);
+            if (new_mem == NULL) {
+                return -1;
+            }
+            SP(sp)->mem = new_mem;
+            SP(sp)->mem_size = new_size;
+        }
+        memcpy(SP(sp)->mem + SP(sp)->mem_len, buf, k);
+        SP(sp)->mem_len += k;
+    }
+    if (k < n) {
+        if (SP(sp)->file == NULL) {
+            SP(sp)->file = tmpfile();
+            if (SP(sp)->file == NULL) {
+                return -1;
+            }
+        }
+        if (fseek(SP(sp)->file, 0, SEEK_END) != 0 ||
+                fwrite(buf + k, 1, n - k, SP(sp)->file) != n - k) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  long int sp_read(void *sp, uint8_t *buf, size_t n)
+ *
+ *  Return data from the spool while the position is before the end of the
+ *  data read so far; after that, read from the source and spool the data.
+ */
+
+static
+long int sp_read(void *sp, uint8_t *buf, size_t n)
+{
+    long int k;
+
+    if (SP(sp)->pos == SP(sp)->total) {
+        k = SP(sp)->source.read(SP(sp)->source.data, buf, n);
+        if (k > 0) {
+            if (_sp_append(sp, buf, k) != 0) {
+                return -1;
+            }
+            SP(sp)->total += k;
+            SP(sp)->pos += k;
+        }
+        return k;
+    }
+
+    k = SP(sp)->total - SP(sp)->pos;
+    if ((size_t) k > n) {
+        k = n;
+    }
+    if ((size_t) SP(sp)->pos < SP(sp)->mem_len) {
+        // Only the bytes in memory in this call.
+        if ((size_t) k > SP(sp)->mem_len - SP(sp)->pos) {
+            k = SP(sp)->mem_len - SP(sp)->pos;
+        }
+        memcpy(buf, SP(sp)->mem + SP(sp)->pos, k);
+    }
+    else {
+        if (fseek(SP(sp)->file, SP(sp)->pos - SP(sp)->mem_len,
+                  SEEK_SET) != 0 ||
+                fread(buf, 1, k, SP(sp)->file) != (size_t) k) {
+            return -1;
+        }
+    }
+    SP(sp)->pos += k;
+    return k;
+}
+
+static
+int sp_seek(void *sp, long int pos)
+{
+    if (pos < 0 || pos > SP(sp)->total) {
+        // stream_buffered() handles pos > total by rewinding and reading
+        // up to pos.
+        return -1;
+    }
+    SP(sp)->pos = pos;
+    return 0;
+}
+
+static
+void sp_close(void *sp, int restore, long int pos)
+{
+    if (SP(sp)->source.close != NULL) {
+        SP(sp)->source.close(SP(sp)->source.data, restore, pos);
+    }
+    if (SP(sp)->file != NULL) {
+        fclose(SP(sp)->file);
+    }
+    free(SP(sp)->mem);
+    free(sp);
+}
+
+
+int spool_source(buffered_source *source)
+{
+    spool *sp;
+
+    sp = (spool *) calloc(1, sizeof(spool));
+    if (sp == NULL) {
+        return -1;
+    }
+    sp->source = *source;
+
+    source->data = (void *) sp;
+    source->read = &sp_read;
+    source->seek = &sp_seek;
+    source->close = &sp_close;
+    return 0;
+}
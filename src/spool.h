@@ -0,0 +1,8 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "stream_buffered.h"
+
+int spool_source(buffered_source *source);
+
+#endif
@@ -10,32 +10,36 @@
 
 
 /*
+ *  Convert the len bytes at p_item (a field from the tokenizer; it is
+ *  not nul-terminated).
  *  On success, *error is zero.
  *  If the conversion fails, *error is nonzero, and the return value is 0.
  */
-int64_t str_to_int64(const char32_t *p_item, int64_t int_min, int64_t int_max, int *error)
+int64_t str_to_int64(const uint8_t *p_item, size_t len,
+                     int64_t int_min, int64_t int_max, int *error)
 {
-    const char32_t *p = (const char32_t *) p_item;
+    const uint8_t *p = p_item;
+    const uint8_t *end = p_item + len;
     bool isneg = 0;
     int64_t number = 0;
     int d;
 
     // Skip leading spaces.
-    while (isspace(*p)) {
+    while (p < end && isspace(*p)) {
         ++p;
     }
 
     // Handle sign.
-    if (*p == '-') {
+    if (p < end && *p == '-') {
         isneg = true;
         ++p;
     }
-    else if (*p == '+') {
+    else if (p < end && *p == '+') {
         p++;
     }
 
     // Check that there is a first digit.
-    if (!isdigit(*p)) {
+    if (p == end || !isdigit(*p)) {
         // Error...
         *error = ERROR_NO_DIGITS;
         return 0;
@@ -52,7 +56,7 @@ int64_t str_to_int64(const char32_t *p_item, int64_t int_min, int64_t int_max, i
         while (isdigit(d)) {
             if ((number > pre_min) || ((number == pre_min) && (d - '0' <= dig_pre_min))) {
                 number = number * 10 - (d - '0');
-                d = *++p;
+                d = (++p < end) ? *p : 0;
             }
             else {
                 *error = ERROR_OVERFLOW;
@@ -73,7 +77,7 @@ int64_t str_to_int64(const char32_t *p_item, int64_t int_min, int64_t int_max, i
         while (isdigit(d)) {
             if ((number < pre_max) || ((number == pre_max) && (d - '0' <= dig_pre_max))) {
                 number = number * 10 + (d - '0');
-                d = *++p;
+                d = (++p < end) ? *p : 0;
             }
             else {
                 *error = ERROR_OVERFLOW;
@@ -83,12 +87,12 @@ int64_t str_to_int64(const char32_t *p_item, int64_t int_min, int64_t int_max, i
     }
 
     // Skip trailing spaces.
-    while (isspace(*p)) {
+    while (p < end && isspace(*p)) {
         ++p;
     }
 
     // Did we use up all the characters?
-    if (*p) {
+    if (p < end) {
         *error = ERROR_INVALID_CHARS;
         return 0;
     }
@@ -98,31 +102,35 @@ int64_t str_to_int64(const char32_t *p_item, int64_t int_min, int64_t int_max, i
 }
 
 /*
+ *  Convert the len bytes at p_item (a field from the tokenizer; it is
+ *  not nul-terminated).
  *  On success, *error is zero.
  *  If the conversion fails, *error is nonzero, and the return value is 0.
  */
-uint64_t str_to_uint64(const char32_t *p_item, uint64_t uint_max, int *error)
+uint64_t str_to_uint64(const uint8_t *p_item, size_t len,
+                       uint64_t uint_max, int *error)
 {
-    const char32_t *p = (const char32_t *) p_item;
+    const uint8_t *p = p_item;
+    const uint8_t *end = p_item + len;
     uint64_t number = 0;
     int d;
 
     // Skip leading spaces.
-    while (isspace(*p)) {
+    while (p < end && isspace(*p)) {
         ++p;
     }
 
     // Handle sign.
-    if (*p == '-') {
+    if (p < end && *p == '-') {
         *error = ERROR_MINUS_SIGN;
         return 0;
     }
-    if (*p == '+') {
+    if (p < end && *p == '+') {
         p++;
     }
 
     // Check that there is a first digit.
-    if (!isdigit(*p)) {
+    if (p == end || !isdigit(*p)) {
         // Error...
         *error = ERROR_NO_DIGITS;
         return 0;
@@ -138,7 +146,7 @@ uint64_t str_to_uint64(const char32_t *p_item, uint64_t uint_max, int *error)
     while (isdigit(d)) {
         if ((number < pre_max) || ((number == pre_max) && (d - '0' <= dig_pre_max))) {
             number = number * 10 + (d - '0');
-            d = *++p;
+            d = (++p < end) ? *p : 0;
         }
         else {
             *error = ERROR_OVERFLOW;
@@ -147,12 +155,12 @@ uint64_t str_to_uint64(const char32_t *p_item, uint64_t uint_max, int *error)
     }
 
     // Skip trailing spaces.
-    while (isspace(*p)) {
+    while (p < end && isspace(*p)) {
         ++p;
     }
 
     // Did we use up all the characters?
-    if (*p) {
+    if (p < end) {
         *error = ERROR_INVALID_CHARS;
         return 0;
     }
@@ -1,6 +1,7 @@
 #ifndef STR_TO_H
 #define STR_TO_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "typedefs.h"
@@ -12,7 +13,9 @@
 #define ERROR_INVALID_CHARS  3
 #define ERROR_MINUS_SIGN     4
 
-int64_t str_to_int64(const char32_t *p_item, int64_t int_min, int64_t int_max, int *error);
-uint64_t str_to_uint64(const char32_t *p_item, uint64_t uint_max, int *error);
+int64_t str_to_int64(const uint8_t *p_item, size_t len,
+                     int64_t int_min, int64_t int_max, int *error);
+uint64_t str_to_uint64(const uint8_t *p_item, size_t len,
+                       uint64_t uint_max, int *error);
 
 #endif
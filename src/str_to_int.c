@@ -8,20 +8,21 @@
 
 
 #define DECLARE_TO_INT(intw, INT_MIN, INT_MAX)                                  \
-    intw##_t to_##intw(char32_t *field, parser_config *pconfig, int *error)     \
+    intw##_t to_##intw(const uint8_t *field, size_t len,                        \
+                       parser_config *pconfig, int *error)                      \
     {                                                                               \
         intw##_t x;                                                                 \
         int ierror = 0;                                                             \
                                                                                     \
         *error = ERROR_OK;                                                          \
                                                                                     \
-        x = (intw##_t) str_to_int64(field, INT_MIN, INT_MAX, &ierror);              \
+        x = (intw##_t) str_to_int64(field, len, INT_MIN, INT_MAX, &ierror);         \
         if (ierror) {                                                               \
             if (pconfig->allow_float_for_int) {                                     \
                 double fx;                                                          \
                 char32_t decimal = pconfig->decimal;                                \
                 char32_t sci = pconfig->sci;                                        \
-                if ((*field == '\0') || !to_double(field, &fx, sci, decimal)) {     \
+                if ((len == 0) || !to_double(field, len, &fx, sci, decimal)) {     \
                     *error = ERROR_BAD_FIELD;                                       \
                 }                                                                   \
                 else {                                                              \
@@ -36,20 +37,21 @@
     }                                                                               \
 
 #define DECLARE_TO_UINT(uintw, UINT_MAX)                                            \
-    uintw##_t to_##uintw(char32_t *field, parser_config *pconfig, int *error)       \
+    uintw##_t to_##uintw(const uint8_t *field, size_t len,                          \
+                         parser_config *pconfig, int *error)                        \
     {                                                                               \
         uintw##_t x;                                                                \
         int ierror = 0;                                                             \
                                                                                     \
         *error = ERROR_OK;                                                          \
                                                                                     \
-        x = (uintw##_t) str_to_uint64(field, UINT_MAX, &ierror);                    \
+        x = (uintw##_t) str_to_uint64(field, len, UINT_MAX, &ierror);               \
         if (ierror) {                                                               \
             if (pconfig->allow_float_for_int) {                                     \
                 double fx;                                                          \
                 char32_t decimal = pconfig->decimal;                                \
                 char32_t sci = pconfig->sci;                                        \
-                if ((*field == '\0') || !to_double(field, &fx, sci, decimal)) {     \
+                if ((len == 0) || !to_double(field, len, &fx, sci, decimal)) {     \
                     *error = ERROR_BAD_FIELD;                                       \
                 }                                                                   \
                 else {                                                              \
@@ -5,7 +5,8 @@
 #include "parser_config.h"
 
 #define DECLARE_TO_INT_PROTOTYPE(intw)                                          \
-    intw##_t to_##intw(char32_t *field, parser_config *pconfig, int *error);    \
+    intw##_t to_##intw(const uint8_t *field, size_t len,                        \
+                       parser_config *pconfig, int *error);                     \
 
 DECLARE_TO_INT_PROTOTYPE(int8)
 DECLARE_TO_INT_PROTOTYPE(int16)
@@ -1,12 +1,14 @@
 #ifndef _STREAM_H_
 #define _STREAM_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "typedefs.h"
 
 #define STREAM_EOF   4294967295  // 2**32-1
 #define STREAM_ERROR 4294967294  // 2**32-2
+#define STREAM_DECODE_ERROR 4294967293  // 2**32-3
 
 #define RESTORE_NOT     0
 #define RESTORE_INITIAL 1
@@ -21,8 +23,25 @@ typedef struct _stream {
     uint32_t (*stream_skiplines)(void *sdata, int n);
     int (*stream_linenumber)(void *sdata);
     int (*stream_lineoffset)(void *sdata);
+    // stream_tell returns the offset, relative to the start of the stream,
+    // of the next byte to be read.  stream_seek moves to an offset that was
+    // returned by stream_tell, and sets the line number to line_number (the
+    // value of stream_linenumber at that offset; it is 1 at offset 0).  It
+    // returns 0 on success, and -1 if the stream can not be repositioned.
     long int (*stream_tell)(void *sdata);
-    int (*stream_seek)(void *sdata, long int pos);
+    int (*stream_seek)(void *sdata, long int pos, int line_number);
+    // Bulk access.  These are NULL if the stream does not support them.
+    // stream_span stores in *p a pointer to the next unread bytes held in
+    // the stream's buffer, and returns the number of bytes available there
+    // (0 at the end of the stream, -1 on error).  The bytes are raw: the
+    // sequence "\r\n" is not translated.  Unless the span reaches the end
+    // of the stream, it is at least two bytes long, so a reader can always
+    // look one byte ahead of the byte it is examining, except at the last
+    // byte of the span.  stream_advance consumes n bytes of the span;
+    // num_newlines is the number of '\n' characters in those bytes (the
+    // caller has seen every byte, so the stream doesn't rescan them).
+    long int (*stream_span)(void *sdata, const uint8_t **p);
+    void (*stream_advance)(void *sdata, size_t n, int num_newlines);
     // Note that the first argument to stream_close is the stream pointer
     // itself, not the stream_data pointer.
     int (*stream_close)(void *strm, int);
@@ -35,8 +54,10 @@ typedef struct _stream {
 #define stream_skiplines(s, n)      ((s)->stream_skiplines((s)->stream_data, (n)))
 #define stream_linenumber(s)        ((s)->stream_linenumber((s)->stream_data))
 #define stream_lineoffset(s)        ((s)->stream_lineoffset((s)->stream_data))
-#define stream_seek(s, pos)         ((s)->stream_seek((s)->stream_data, (pos)))
+#define stream_seek(s, pos, line)   ((s)->stream_seek((s)->stream_data, (pos), (line)))
 #define stream_tell(s)              ((s)->stream_tell((s)->stream_data))
+#define stream_span(s, p)           ((s)->stream_span((s)->stream_data, (p)))
+#define stream_advance(s, n, nl)    ((s)->stream_advance((s)->stream_data, (n), (nl)))
 #define stream_close(s, restore)    ((s)->stream_close((s), (restore)))
 
 #endif
@@ -0,0 +1,60 @@
+//
+// stream_buffer.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_buffer(PyObject *obj, int encoding)
+//
+// This function creates a stream that reads the data of a Python object
+// that supports the buffer protocol (e.g. bytes, bytearray, memoryview or
+// mmap.mmap).  The buffer is pinned with PyObject_GetBuffer() for the
+// lifetime of the stream, and the characters are read directly from it by
+// a stream_memory() stream, so the data is not copied.  `encoding` is one
+// of the ENCODING_* constants defined in encoding.h.
+//
+// The buffer must be C-contiguous.  Returns NULL with a Python exception
+// set on failure.
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "stream.h"
+#include "stream_memory.h"
+
+
+static
+void release_buffer(void *view)
+{
+    PyBuffer_Release((Py_buffer *) view);
+    free(view);
+}
+
+
+stream *stream_buffer(PyObject *obj, int encoding)
+{
+    Py_buffer *view;
+    stream *strm;
+
+    view = (Py_buffer *) malloc(sizeof(Py_buffer));
+    if (view == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    // PyBUF_SIMPLE requests a contiguous buffer of bytes.
+    if (PyObject_GetBuffer(obj, view, PyBUF_SIMPLE) == -1) {
+        free(view);
+        return NULL;
+    }
+
+    strm = stream_memory((const uint8_t *) view->buf, view->len, encoding,
+                         &release_buffer, view);
+    if (strm == NULL) {
+        release_buffer(view);
+        PyErr_NoMemory();
+    }
+    return strm;
+}
@@ -0,0 +1,11 @@
+#ifndef _STREAM_BUFFER
+#define _STREAM_BUFFER
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "stream.h"
+
+stream *stream_buffer(PyObject *obj, int encoding);
+
+#endif
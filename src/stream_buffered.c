@@ -0,0 +1,467 @@
+//
+// stream_buffered.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_buffered(buffered_source *source, int buffer_size,
+//                             int encoding, int readahead, int hints)
+//
+// The function creates a stream that reads the bytes provided by `source`
+// into a buffer of buffer_size bytes, and decodes the characters according
+// to `encoding` (one of the ENCODING_* constants defined in encoding.h).
+// If `readahead` is positive, the source is read by a background thread
+// that keeps up to `readahead` more buffers filled (see readahead.c); the
+// source's functions must then not need the Python GIL.  The buffers are
+// allocated with hints_malloc(); `hints` is a combination of the HINT_*
+// flags defined in hints.h (only HINT_HUGE_PAGES applies to them).
+// The stream takes ownership of the source: source->close() is called
+// when the stream is closed.  (The buffered_source struct itself is copied,
+// so it does not have to outlive the call.)
+//
+// This is the common implementation of the streams that read from a C FILE,
+// from a Python file object's read() method, etc.  See stream_buffered.h.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "readahead.h"
+#include "encoding.h"
+#include "hints.h"
+#include "scan.h"
+
+#define DEFAULT_BUFFER_SIZE 16777216
+
+// When fewer than MIN_UNREAD bytes are left in the buffer, the buffer is
+// refilled, and the unread bytes are moved to the start of the buffer.
+// A UTF-8 encoded character is at most four bytes long, so this ensures
+// that a complete character is always in the buffer.
+#define MIN_UNREAD 4
+
+
+typedef struct _byte_buffer {
+
+    /* Where the bytes come from. */
+    buffered_source source;
+
+    int32_t line_number;
+
+    /* Boolean: has the end of the source been reached? */
+    bool reached_eof;
+
+    /* Offset in the source of the data currently in the buffer. */
+    long int buffer_source_pos;
+
+    /* Position in the buffer of the next character to read. */
+    long int current_buffer_pos;
+
+    /* Actual number of bytes in the current buffer. (Can be less than buffer_size.) */
+    long int last_pos;
+
+    /* Size (in bytes) of the buffer. */
+    long int buffer_size;
+
+    /* Pointer to the buffer. */
+    uint8_t *buffer;
+
+    /* Encoding of the data (one of the ENCODING_* constants). */
+    int encoding;
+
+} byte_buffer;
+
+#define BB(bb)  ((byte_buffer *)bb)
+
+
+static
+int32_t bb_line_number(void *bb)
+{
+    return BB(bb)->line_number;
+}
+
+/*
+ *  int _bb_load(void *bb)
+ *
+ *  Get data from the source into the buffer.
+ *
+ *  A source may return fewer bytes than requested (e.g. a pipe or a
+ *  Python file object that returns short chunks), so the source is read
+ *  until at least MIN_UNREAD bytes are in the buffer or the end of the
+ *  source is reached.
+ *
+ *  Returns 0 on success.
+ *  Returns STREAM_ERROR on error.
+ */
+
+static
+uint32_t _bb_load(void *bb)
+{
+    uint8_t *buffer = BB(bb)->buffer;
+
+    if (!BB(bb)->reached_eof &&
+            BB(bb)->last_pos - BB(bb)->current_buffer_pos < MIN_UNREAD) {
+        /* k is the number of unread bytes; 0 <= k < MIN_UNREAD. */
+        int k = BB(bb)->last_pos - BB(bb)->current_buffer_pos;
+        if (k) {
+            memmove(buffer, &(buffer[BB(bb)->current_buffer_pos]), k);
+        }
+
+        BB(bb)->buffer_source_pos += BB(bb)->current_buffer_pos;
+        BB(bb)->current_buffer_pos = 0;
+        BB(bb)->last_pos = k;
+
+        while (BB(bb)->last_pos < MIN_UNREAD) {
+            long int num_read;
+            num_read = BB(bb)->source.read(BB(bb)->source.data,
+                                           &(buffer[BB(bb)->last_pos]),
+                                           BB(bb)->buffer_size - BB(bb)->last_pos);
+            if (num_read < 0) {
+                return STREAM_ERROR;
+            }
+            if (num_read == 0) {
+                BB(bb)->reached_eof = 1;
+                break;
+            }
+            BB(bb)->last_pos += num_read;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  char32_t bb_fetch(void *bb)
+ *
+ *  Get a single character from the buffer, and advance the buffer pointer.
+ *
+ *  Returns STREAM_EOF when the end of the source is reached.
+ *  The sequence '\r\n' is treated as a single '\n'.  That is, when the next
+ *  two bytes in the buffer are '\r\n', the buffer pointer is advanced by 2
+ *  and '\n' is returned.
+ *  A non-ASCII character is decoded according to bb->encoding;
+ *  STREAM_DECODE_ERROR is returned if the bytes are not valid.
+ *  When '\n' is returned, bb->line_number is incremented.
+ */
+
+static
+char32_t bb_fetch(void *bb)
+{
+    int32_t status;
+    char32_t c;
+    uint8_t *buffer = BB(bb)->buffer;
+
+    status = _bb_load(bb);
+    if (status != 0) {
+        return status;
+    }
+
+    if (BB(bb)->current_buffer_pos == BB(bb)->last_pos) {
+        return STREAM_EOF;
+    }
+
+    c = buffer[BB(bb)->current_buffer_pos];
+    if ((c == '\r') && (BB(bb)->current_buffer_pos + 1 < BB(bb)->last_pos) &&
+            (buffer[BB(bb)->current_buffer_pos + 1] == '\n')) {
+        c = '\n';
+        BB(bb)->current_buffer_pos += 2;
+    }
+    else if (c < 0x80) {
+        BB(bb)->current_buffer_pos += 1;
+    }
+    else {
+        int len;
+        c = decode_char(&(buffer[BB(bb)->current_buffer_pos]),
+                        BB(bb)->last_pos - BB(bb)->current_buffer_pos,
+                        BB(bb)->encoding, &len);
+        BB(bb)->current_buffer_pos += len;
+    }
+    if (c == '\n') {
+        BB(bb)->line_number++;
+    }
+    return c;
+}
+
+
+/*
+ *  char32_t bb_next(void *bb)
+ *
+ *  Returns the next character in the buffer, but does not advance the
+ *  pointer.  If the next two characters in the buffer are "\r\n", '\n'
+ *  is returned.
+ */
+
+static
+char32_t bb_next(void *bb)
+{
+    int32_t status;
+    char32_t c;
+    uint8_t *buffer = BB(bb)->buffer;
+
+    status = _bb_load(bb);
+    if (status != 0) {
+        return status;
+    }
+
+    if (BB(bb)->current_buffer_pos == BB(bb)->last_pos) {
+        return STREAM_EOF;
+    }
+
+    c = buffer[BB(bb)->current_buffer_pos];
+    if ((c == '\r') && (BB(bb)->current_buffer_pos + 1 < BB(bb)->last_pos) &&
+            (buffer[BB(bb)->current_buffer_pos + 1] == '\n')) {
+        c = '\n';
+    }
+    else if (c >= 0x80) {
+        int len;
+        c = decode_char(&(buffer[BB(bb)->current_buffer_pos]),
+                        BB(bb)->last_pos - BB(bb)->current_buffer_pos,
+                        BB(bb)->encoding, &len);
+    }
+    return c;
+}
+
+/*
+ *  bb_skipline(void *bb)
+ *
+ *  Read bytes from the buffer until a newline or the end of the source is
+ *  reached.  The bytes are not decoded; the newline is found with memchr().
+ *
+ *  The return value is 0 if no errors occurred.
+ */
+
+static
+uint32_t bb_skipline(void *bb)
+{
+    while (1) {
+        uint8_t *start, *nl;
+        long int n;
+
+        if (_bb_load(bb) != 0) {
+            return STREAM_ERROR;
+        }
+        n = BB(bb)->last_pos - BB(bb)->current_buffer_pos;
+        if (n == 0) {
+            return 0;
+        }
+        start = BB(bb)->buffer + BB(bb)->current_buffer_pos;
+        nl = memchr(start, '\n', n);
+        if (nl != NULL) {
+            BB(bb)->current_buffer_pos += (nl - start) + 1;
+            BB(bb)->line_number++;
+            return 0;
+        }
+        BB(bb)->current_buffer_pos += n;
+    }
+}
+
+
+/*
+ *  bb_skiplines(void *bb, int num_lines)
+ *
+ *  Skip num_lines, or until the end of the source is reached.  The bytes
+ *  are not decoded; the newlines of each buffer are found (and counted) in
+ *  bulk by scan_lines().
+ *
+ *  The return value is 0 if no errors occurred.
+ */
+
+static
+uint32_t bb_skiplines(void *bb, int num_lines)
+{
+    while (num_lines > 0) {
+        const uint8_t *start;
+        long int n;
+        int remaining = num_lines;
+
+        if (_bb_load(bb) != 0) {
+            return STREAM_ERROR;
+        }
+        n = BB(bb)->last_pos - BB(bb)->current_buffer_pos;
+        if (n == 0) {
+            break;
+        }
+        start = BB(bb)->buffer + BB(bb)->current_buffer_pos;
+        BB(bb)->current_buffer_pos += scan_lines(start, start + n, &remaining);
+        BB(bb)->line_number += num_lines - remaining;
+        num_lines = remaining;
+    }
+    return 0;
+}
+
+/*
+ *  long int bb_span(void *bb, const uint8_t **p)
+ *
+ *  Make *p point to the unread bytes in the buffer, loading more data
+ *  from the source first if fewer than MIN_UNREAD bytes are left.  (_bb_load()
+ *  keeps those bytes, so the span is at least MIN_UNREAD bytes long unless
+ *  the end of the source is within the span.)
+ *
+ *  Returns the number of bytes in the span, or -1 on error.
+ */
+
+static
+long int bb_span(void *bb, const uint8_t **p)
+{
+    if (_bb_load(bb) != 0) {
+        return -1;
+    }
+    *p = BB(bb)->buffer + BB(bb)->current_buffer_pos;
+    return BB(bb)->last_pos - BB(bb)->current_buffer_pos;
+}
+
+static
+void bb_advance(void *bb, size_t n, int num_newlines)
+{
+    BB(bb)->current_buffer_pos += n;
+    BB(bb)->line_number += num_newlines;
+}
+
+/*
+ *  long int bb_tell(void *bb)
+ *
+ *  Returns the offset (relative to the start of the source) of the next
+ *  byte to be read from the stream.
+ */
+
+static
+long int bb_tell(void *bb)
+{
+    return BB(bb)->buffer_source_pos + BB(bb)->current_buffer_pos;
+}
+
+/*
+ *  int _bb_discard(void *bb, long int n)
+ *
+ *  Read and drop the first n bytes of the source.  The buffer is used as
+ *  scratch space, so this must be followed by a reset of the buffer state.
+ *
+ *  Returns 0 on success, or -1 on error or if the source has fewer than
+ *  n bytes.
+ */
+
+static
+int _bb_discard(void *bb, long int n)
+{
+    while (n > 0) {
+        long int num_read;
+        long int k = n < BB(bb)->buffer_size ? n : BB(bb)->buffer_size;
+
+        num_read = BB(bb)->source.read(BB(bb)->source.data, BB(bb)->buffer, k);
+        if (num_read <= 0) {
+            return -1;
+        }
+        n -= num_read;
+    }
+    return 0;
+}
+
+/*
+ *  int bb_seek(void *bb, long int pos, int line_number)
+ *
+ *  Reposition the source at pos.  If the source can only be rewound (e.g.
+ *  a compressed file, or a text file object), it is rewound and pos bytes
+ *  are read and discarded.
+ */
+
+static
+int bb_seek(void *bb, long int pos, int line_number)
+{
+    if (BB(bb)->source.seek == NULL) {
+        return -1;
+    }
+    if (BB(bb)->source.seek(BB(bb)->source.data, pos) != 0) {
+        if (pos == 0 || BB(bb)->source.seek(BB(bb)->source.data, 0) != 0 ||
+                _bb_discard(bb, pos) != 0) {
+            return -1;
+        }
+    }
+    BB(bb)->line_number = line_number;
+    BB(bb)->buffer_source_pos = pos;
+    BB(bb)->current_buffer_pos = 0;
+    BB(bb)->last_pos = 0;
+    BB(bb)->reached_eof = false;
+    return 0;
+}
+
+static
+int stream_del(void *strm, int restore)
+{
+    byte_buffer *bb = (byte_buffer *) (((stream *) strm)->stream_data);
+
+    if (BB(bb)->source.close != NULL) {
+        BB(bb)->source.close(BB(bb)->source.data, restore, bb_tell(bb));
+    }
+
+    free(BB(bb)->buffer);
+    free(bb);
+    free(strm);
+
+    return 0;
+}
+
+
+stream *stream_buffered(buffered_source *source, int buffer_size, int encoding,
+                        int readahead, int hints)
+{
+    byte_buffer *bb;
+    stream *strm;
+
+    bb = (byte_buffer *) malloc(sizeof(byte_buffer));
+    if (bb == NULL) {
+        return NULL;
+    }
+
+    strm = (stream *) malloc(sizeof(stream));
+    if (strm == NULL) {
+        free(bb);
+        return NULL;
+    }
+
+    if (buffer_size < MIN_UNREAD) {
+        buffer_size = DEFAULT_BUFFER_SIZE;
+    }
+
+    bb->buffer_size = buffer_size;
+    bb->buffer = hints_malloc(bb->buffer_size, hints);
+    if (bb->buffer == NULL) {
+        free(bb);
+        free(strm);
+        return NULL;
+    }
+
+    bb->source = *source;
+    // This is done last, so the caller can still close the original
+    // source if anything fails.
+    if (readahead > 0 &&
+            readahead_source(&(bb->source), buffer_size, readahead,
+                             hints) != 0) {
+        free(bb->buffer);
+        free(bb);
+        free(strm);
+        return NULL;
+    }
+    bb->line_number = 1;
+    bb->buffer_source_pos = 0;
+    bb->current_buffer_pos = 0;
+    bb->last_pos = 0;
+    bb->reached_eof = false;
+    bb->encoding = encoding;
+
+    strm->stream_data = (void *) bb;
+    strm->stream_fetch = &bb_fetch;
+    strm->stream_peek = &bb_next;
+    strm->stream_skipline = &bb_skipline;
+    strm->stream_skiplines = &bb_skiplines;
+    strm->stream_linenumber = &bb_line_number;
+    strm->stream_tell = &bb_tell;
+    strm->stream_seek = &bb_seek;
+    strm->stream_span = &bb_span;
+    strm->stream_advance = &bb_advance;
+    strm->stream_close = &stream_del;
+
+    return strm;
+}
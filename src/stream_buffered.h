@@ -0,0 +1,46 @@
+#ifndef STREAM_BUFFERED_H
+#define STREAM_BUFFERED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stream.h"
+
+//
+// A buffered_source provides the bytes for a stream created by
+// stream_buffered().  Positions are byte offsets from the start of the
+// source (i.e. from where the source was when the stream was created).
+//
+typedef struct _buffered_source {
+
+    /* The source's own data; passed to the functions below. */
+    void *data;
+
+    /*
+     *  Read at most n bytes into buf.  Returns the number of bytes read,
+     *  0 at the end of the source, or -1 on error.
+     */
+    long int (*read)(void *data, uint8_t *buf, size_t n);
+
+    /*
+     *  Reposition the source at offset pos.  Returns 0 on success, or -1
+     *  if the source can not be repositioned.  NULL if the source can not
+     *  be repositioned at all.  A source that can only be rewound (pos == 0)
+     *  is still seekable: stream_buffered() then rewinds it and discards
+     *  pos bytes.
+     */
+    int (*seek)(void *data, long int pos);
+
+    /*
+     *  Release the source.  `restore` is one of the RESTORE_* constants
+     *  from stream.h; `pos` is the offset of the first byte that the
+     *  stream has not consumed (used for RESTORE_FINAL).
+     */
+    void (*close)(void *data, int restore, long int pos);
+
+} buffered_source;
+
+stream *stream_buffered(buffered_source *source, int buffer_size, int encoding,
+                        int readahead, int hints);
+
+#endif
@@ -0,0 +1,263 @@
+//
+// stream_bz2.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_bz2_from_filename(char *filename, int buffer_size,
+//                                      int encoding, int readahead,
+//                                      int hints)
+//
+// If the file with the given name starts with the bzip2 magic bytes, the
+// function creates a stream that decompresses the file with libbz2
+// directly into the stream's buffer (see stream_buffered.c).  `encoding`
+// is one of the ENCODING_* constants defined in encoding.h.  Concatenated
+// bzip2 streams (e.g. from pbzip2) are read as one file.
+//
+// NULL is returned if the file can not be opened, if it is not a regular
+// file that starts with the bzip2 magic bytes, or if the memory allocation
+// fails.
+//
+// This file is only compiled if libbz2 is available (see setup.py).
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include <sys/stat.h>
+
+#include <bzlib.h>
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "hints.h"
+
+#define INPUT_BUFFER_SIZE 1048576
+
+
+typedef struct _bz2_source {
+
+    /* The compressed file. */
+    FILE *file;
+
+    /* libbz2 state. */
+    bz_stream bs;
+
+    /* Boolean: has the end of the compressed file been reached? */
+    bool input_eof;
+
+    /* Boolean: has the end of the last bzip2 stream been reached? */
+    bool output_eof;
+
+    /* HINT_* flags, and the offset up to which pages have been dropped. */
+    int hints;
+    long int dropped;
+
+    /* Buffer holding compressed data read from the file. */
+    char *input;
+
+} bz2_source;
+
+#define BS(bs)  ((bz2_source *)bs)
+
+
+/*
+ *  int _bs_fill(void *bs)
+ *
+ *  Read more compressed data from the file, if the input buffer is empty.
+ *  Returns 0 on success, or -1 on error.
+ */
+
+static
+int _bs_fill(void *bs)
+{
+    bz_stream *z = &(BS(bs)->bs);
+
+    if (z->avail_in == 0 && !BS(bs)->input_eof) {
+        size_t num_read;
+        num_read = fread(BS(bs)->input, 1, INPUT_BUFFER_SIZE, BS(bs)->file);
+        if (num_read < INPUT_BUFFER_SIZE) {
+            if (ferror(BS(bs)->file)) {
+                return -1;
+            }
+            BS(bs)->input_eof = true;
+        }
+        hints_file_consumed(fileno(BS(bs)->file), BS(bs)->hints,
+                            &(BS(bs)->dropped), ftell(BS(bs)->file));
+        z->next_in = BS(bs)->input;
+        z->avail_in = num_read;
+    }
+    return 0;
+}
+
+/*
+ *  int _bs_restart(void *bs)
+ *
+ *  Start decoding a new bzip2 stream.  The unread input and the output
+ *  buffer are kept.
+ */
+
+static
+int _bs_restart(void *bs)
+{
+    bz_stream *z = &(BS(bs)->bs);
+    bz_stream saved = *z;
+
+    BZ2_bzDecompressEnd(z);
+    memset(z, 0, sizeof(bz_stream));
+    if (BZ2_bzDecompressInit(z, 0, 0) != BZ_OK) {
+        return -1;
+    }
+    z->next_in = saved.next_in;
+    z->avail_in = saved.avail_in;
+    z->next_out = saved.next_out;
+    z->avail_out = saved.avail_out;
+    return 0;
+}
+
+
+/*
+ *  long int bs_read(void *bs, uint8_t *buf, size_t n)
+ *
+ *  Decompress at most n bytes into buf.  Returns the number of bytes
+ *  decompressed, 0 at the end of the data, or -1 on error (including
+ *  corrupt or truncated compressed data).
+ */
+
+static
+long int bs_read(void *bs, uint8_t *buf, size_t n)
+{
+    bz_stream *z = &(BS(bs)->bs);
+
+    if (BS(bs)->output_eof) {
+        return 0;
+    }
+    if (n > UINT_MAX) {
+        n = UINT_MAX;
+    }
+    z->next_out = (char *) buf;
+    z->avail_out = n;
+
+    while (z->avail_out == n) {
+        int status;
+
+        if (_bs_fill(bs) != 0) {
+            return -1;
+        }
+
+        status = BZ2_bzDecompress(z);
+        if (status == BZ_STREAM_END) {
+            // Another bzip2 stream may follow.
+            if (_bs_fill(bs) != 0) {
+                return -1;
+            }
+            if (z->avail_in == 0) {
+                BS(bs)->output_eof = true;
+                break;
+            }
+            if (_bs_restart(bs) != 0) {
+                return -1;
+            }
+        }
+        else if (status != BZ_OK) {
+            return -1;
+        }
+        else if (z->avail_out == n && z->avail_in == 0 && BS(bs)->input_eof) {
+            // No progress, and no more input: the file is truncated.
+            return -1;
+        }
+    }
+    return n - z->avail_out;
+}
+
+static
+int bs_seek(void *bs, long int pos)
+{
+    if (pos != 0 || fseek(BS(bs)->file, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+    BS(bs)->bs.avail_in = 0;
+    if (_bs_restart(bs) != 0) {
+        return -1;
+    }
+    BS(bs)->input_eof = false;
+    BS(bs)->output_eof = false;
+    return 0;
+}
+
+static
+void bs_close(void *bs, int restore, long int pos)
+{
+    BZ2_bzDecompressEnd(&(BS(bs)->bs));
+    fclose(BS(bs)->file);
+    free(BS(bs)->input);
+    free(bs);
+}
+
+
+stream *stream_bz2_from_filename(char *filename, int buffer_size,
+                                 int encoding, int readahead, int hints)
+{
+    bz2_source *bs;
+    buffered_source source;
+    stream *strm;
+    FILE *fp;
+    uint8_t magic[4];
+    struct stat st;
+
+    if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    // "BZh" followed by the block size, '1' to '9'.
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, "BZh", 3) != 0 ||
+            magic[3] < '1' || magic[3] > '9') {
+        fclose(fp);
+        return NULL;
+    }
+    rewind(fp);
+    hints_file_start(fileno(fp), hints);
+
+    bs = (bz2_source *) malloc(sizeof(bz2_source));
+    if (bs == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    bs->input = malloc(INPUT_BUFFER_SIZE);
+    if (bs->input == NULL) {
+        free(bs);
+        fclose(fp);
+        return NULL;
+    }
+    bs->file = fp;
+    bs->input_eof = false;
+    bs->output_eof = false;
+    bs->hints = hints;
+    bs->dropped = 0;
+
+    memset(&(bs->bs), 0, sizeof(bz_stream));
+    if (BZ2_bzDecompressInit(&(bs->bs), 0, 0) != BZ_OK) {
+        free(bs->input);
+        free(bs);
+        fclose(fp);
+        return NULL;
+    }
+
+    source.data = (void *) bs;
+    source.read = &bs_read;
+    source.seek = &bs_seek;
+    source.close = &bs_close;
+
+    strm = stream_buffered(&source, buffer_size, encoding, readahead,
+                           hints);
+    if (strm == NULL) {
+        bs_close(bs, RESTORE_NOT, 0);
+    }
+    return strm;
+}
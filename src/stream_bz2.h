@@ -0,0 +1,9 @@
+#ifndef STREAM_BZ2_H
+#define STREAM_BZ2_H
+
+#include "stream.h"
+
+stream *stream_bz2_from_filename(char *filename, int buffer_size,
+                                 int encoding, int readahead, int hints);
+
+#endif
@@ -0,0 +1,210 @@
+//
+// stream_fd.c
+//
+// The public functions defined in this file are
+//
+//     stream *stream_fd(int fd, const uint8_t *prefix, size_t prefix_len,
+//                       int buffer_size, int encoding, bool spool,
+//                       int readahead)
+//     stream *stream_fd_from_filename(char *filename, int buffer_size,
+//                                     int encoding, bool spool,
+//                                     int readahead)
+//
+// The functions create a stream that reads from a file descriptor with
+// large read(2) calls, for input that can not be repositioned: pipes,
+// sockets, terminals and FIFOs.  `encoding` is one of the ENCODING_*
+// constants defined in encoding.h.  The buffering and decoding is done by
+// stream_buffered().
+//
+// stream_fd() reads from `fd`, which belongs to the caller.  The
+// prefix_len bytes at `prefix` (e.g. data that a Python file object has
+// already read from fd into its own buffer) are copied, and returned
+// before the data read from fd.
+//
+// stream_fd_from_filename() opens the file with the given name, and
+// returns NULL if it is a regular file (those are read by the other file
+// streams) or if it can not be opened.  The file is closed when the stream
+// is closed.
+//
+// read(2) can block for a long time (e.g. waiting for a socket peer that
+// is a thread of this process), so it is called without the Python GIL.
+//
+// If `spool` is true, the data read is kept (see spool.c), so the stream
+// can be repositioned (e.g. rewound for the second pass of the reader when
+// the dtype is not given).  Otherwise the stream can only be "repositioned"
+// to where it already is.
+//
+// NULL is returned if the memory allocation fails.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "stream_fd.h"
+#include "spool.h"
+
+
+typedef struct _fd_source {
+
+    /* The file descriptor being read. */
+    int fd;
+
+    /* Boolean: was fd opened by stream_fd_from_filename()? */
+    bool close_fd;
+
+    /* Bytes to return before the data read from fd. */
+    uint8_t *prefix;
+    size_t prefix_len;
+    size_t prefix_pos;
+
+    /* Offset of the next byte to be returned. */
+    long int pos;
+
+} fd_source;
+
+#define FD(fd)  ((fd_source *)fd)
+
+
+static
+long int fd_read(void *fd, uint8_t *buf, size_t n)
+{
+    long int k;
+
+    if (FD(fd)->prefix_pos < FD(fd)->prefix_len) {
+        k = FD(fd)->prefix_len - FD(fd)->prefix_pos;
+        if ((size_t) k > n) {
+            k = n;
+        }
+        memcpy(buf, FD(fd)->prefix + FD(fd)->prefix_pos, k);
+        FD(fd)->prefix_pos += k;
+    }
+    else {
+        do {
+            // With read-ahead, this is called from a thread that does not
+            // hold the GIL.
+            if (PyGILState_Check()) {
+                Py_BEGIN_ALLOW_THREADS
+                k = read(FD(fd)->fd, buf, n);
+                Py_END_ALLOW_THREADS
+            }
+            else {
+                k = read(FD(fd)->fd, buf, n);
+            }
+        } while (k < 0 && errno == EINTR);
+        if (k < 0) {
+            return -1;
+        }
+    }
+    FD(fd)->pos += k;
+    return k;
+}
+
+static
+int fd_seek(void *fd, long int pos)
+{
+    // stream_buffered() handles the other positions (if they are ahead)
+    // by reading up to them.
+    return pos == FD(fd)->pos ? 0 : -1;
+}
+
+static
+void fd_close(void *fd, int restore, long int pos)
+{
+    // The data read can not be pushed back, so `restore` is ignored.
+    if (FD(fd)->close_fd) {
+        close(FD(fd)->fd);
+    }
+    free(FD(fd)->prefix);
+    free(fd);
+}
+
+
+static
+stream *_stream_fd(int fd, bool close_fd, const uint8_t *prefix,
+                   size_t prefix_len, int buffer_size, int encoding,
+                   bool spool, int readahead)
+{
+    fd_source *fs;
+    buffered_source source;
+    stream *strm;
+
+    fs = (fd_source *) calloc(1, sizeof(fd_source));
+    if (fs == NULL) {
+        return NULL;
+    }
+    fs->fd = fd;
+    if (prefix_len > 0) {
+        fs->prefix = malloc(prefix_len);
+        if (fs->prefix == NULL) {
+            free(fs);
+            return NULL;
+        }
+        memcpy(fs->prefix, prefix, prefix_len);
+        fs->prefix_len = prefix_len;
+    }
+
+    source.data = (void *) fs;
+    source.read = &fd_read;
+    source.seek = &fd_seek;
+    source.close = &fd_close;
+    if (spool && spool_source(&source) != 0) {
+        fd_close(fs, RESTORE_NOT, 0);
+        return NULL;
+    }
+
+    strm = stream_buffered(&source, buffer_size, encoding, readahead, 0);
+    if (strm == NULL) {
+        // Closes fs too (through the spool, if there is one).
+        source.close(source.data, RESTORE_NOT, 0);
+        return NULL;
+    }
+    // Set last, so the caller still owns fd if anything fails.
+    fs->close_fd = close_fd;
+    return strm;
+}
+
+
+stream *stream_fd(int fd, const uint8_t *prefix, size_t prefix_len,
+                  int buffer_size, int encoding, bool spool, int readahead)
+{
+    return _stream_fd(fd, false, prefix, prefix_len, buffer_size, encoding,
+                      spool, readahead);
+}
+
+
+stream *stream_fd_from_filename(char *filename, int buffer_size,
+                                int encoding, bool spool, int readahead)
+{
+    int fd;
+    struct stat st;
+    stream *strm;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    strm = _stream_fd(fd, true, NULL, 0, buffer_size, encoding, spool,
+                      readahead);
+    if (strm == NULL) {
+        close(fd);
+    }
+    return strm;
+}
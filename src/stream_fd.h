@@ -0,0 +1,15 @@
+#ifndef STREAM_FD_H
+#define STREAM_FD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stream.h"
+
+stream *stream_fd(int fd, const uint8_t *prefix, size_t prefix_len,
+                  int buffer_size, int encoding, bool spool, int readahead);
+stream *stream_fd_from_filename(char *filename, int buffer_size,
+                                int encoding, bool spool, int readahead);
+
+#endif
@@ -3,11 +3,28 @@
 //
 // The public functions defined in this file are
 //
-//     stream *stream_file(FILE *f, int buffer_size)
-//     stream *stream_file_from_filename(char *filename, int buffer_size)
+//     stream *stream_file(FILE *f, int buffer_size, int encoding)
+//     stream *stream_file_from_filename(char *filename, int buffer_size,
+//                                       int encoding, int readahead,
+//                                       int hints)
 //
 // The functions accept a C FILE object or a filename, respectively, and
-// create a stream that can be used by the text file reader.
+// create a stream that can be used by the text file reader.  `encoding`
+// is one of the ENCODING_* constants defined in encoding.h.
+//
+// The buffering and decoding is done by stream_buffered(); this file
+// only provides the buffered_source that reads from the FILE.  A FILE
+// opened by stream_file_from_filename() is closed when the stream is
+// closed; a FILE passed to stream_file() belongs to the caller.
+//
+// If `readahead` is positive, the file is read by a background thread
+// that keeps up to `readahead` blocks of buffer_size bytes filled ahead of
+// the tokenizer (see readahead.c), so that I/O and parsing overlap.
+//
+// `hints` is a combination of the HINT_* flags defined in hints.h.  They
+// are given to the kernel for the file opened by stream_file_from_filename();
+// with HINT_DONTNEED, the pages that have been read are dropped from the
+// page cache as the file is read.
 //
 
 #include <stdio.h>
@@ -16,343 +33,132 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#include <sys/types.h>
-#include <unistd.h>
-
 #include "stream.h"
+#include "stream_buffered.h"
+#include "hints.h"
 
-#define DEFAULT_BUFFER_SIZE 16777216
 
-
-typedef struct _file_buffer {
+typedef struct _file_source {
 
     /* The file being read. */
     FILE *file;
 
-    /* Size of the file, in bytes. */
-    off_t size;
-
-    /* file position when the file_buffer was created. */
-    off_t initial_file_pos;
-
-    int32_t line_number;
-
-    /* Boolean: has the end of the file been reached? */
-    bool reached_eof;
-
-    /* Offset in the file of the data currently in the buffer. */
-    off_t buffer_file_pos;
-
-    /* Position in the buffer of the next character to read. */
-    off_t current_buffer_pos;
-
-    /* Actual number of bytes in the current buffer. (Can be less than buffer_size.) */
-    off_t last_pos;
-
-    /* Size (in bytes) of the buffer. */
-    off_t buffer_size;
-
-    /* Pointer to the buffer. */
-    uint8_t *buffer;
-
-} file_buffer;
-
-#define FB(fb)  ((file_buffer *)fb)
-
-
-static
-int32_t fb_line_number(void *fb)
-{
-    return FB(fb)->line_number;
-}
-
-/*
- *  int _fb_load(void *fb)
- *
- *  Get data from the file into the buffer.
- *
- *  Returns 0 on success.
- *  Returns STREAM_ERROR on error.
- */
-
-static
-uint32_t _fb_load(void *fb)
-{
-    uint8_t *buffer = FB(fb)->buffer;
+    /* file position when the stream was created. */
+    long int initial_file_pos;
 
-    if (!FB(fb)->reached_eof && (FB(fb)->current_buffer_pos == FB(fb)->last_pos ||
-                                 FB(fb)->current_buffer_pos+1 == FB(fb)->last_pos)) {
-        size_t num_read;
-        /* k will be either 0 or 1. */
-        int k = FB(fb)->last_pos - FB(fb)->current_buffer_pos;
-        if (k) {
-            buffer[0] = buffer[FB(fb)->current_buffer_pos];
-        }
+    /* Boolean: was the file opened by stream_file_from_filename()? */
+    bool close_file;
 
-        FB(fb)->buffer_file_pos = ftell(FB(fb)->file) - k;
-        
-        num_read = fread(&(buffer[k]), 1, FB(fb)->buffer_size - k, FB(fb)->file);
+    /* HINT_* flags, and the offset up to which pages have been dropped. */
+    int hints;
+    long int dropped;
 
-        FB(fb)->current_buffer_pos = 0;
-        FB(fb)->last_pos = num_read + k;
-        if (num_read < FB(fb)->buffer_size - k) {
-            if (feof(FB(fb)->file)) {
-                FB(fb)->reached_eof = 1;
-            }
-            else {
-                return STREAM_ERROR;
-            }
-        }
-    }
-    return 0;
-}
+} file_source;
 
+#define FS(fs)  ((file_source *)fs)
 
-/*
- *  char32_t fb_fetch(file_buffer *fb)
- *
- *  Get a single character from the buffer, and advance the buffer pointer.
- *
- *  Returns STREAM_EOF when the end of the file is reached.
- *  The sequence '\r\n' is treated as a single '\n'.  That is, when the next
- *  two bytes in the buffer are '\r\n', the buffer pointer is advanced by 2
- *  and '\n' is returned.
- *  When '\n' is returned, fb->line_number is incremented.
- */
 
 static
-char32_t fb_fetch(void *fb)
+long int fs_read(void *fs, uint8_t *buf, size_t n)
 {
-    int32_t status;
-    char32_t c;
-    uint8_t *buffer = FB(fb)->buffer;
-  
-    status = _fb_load(fb);
-    if (status != 0) {
-        return status;
-    }
+    size_t num_read;
 
-    if (FB(fb)->current_buffer_pos == FB(fb)->last_pos) {
-        return STREAM_EOF;
+    num_read = fread(buf, 1, n, FS(fs)->file);
+    if (num_read < n && ferror(FS(fs)->file)) {
+        return -1;
     }
-
-    if ((FB(fb)->current_buffer_pos + 1 < FB(fb)->last_pos) &&
-            (buffer[FB(fb)->current_buffer_pos] == '\r') &&
-            (buffer[FB(fb)->current_buffer_pos + 1] == '\n')) {
-        c = '\n';
-        FB(fb)->current_buffer_pos += 2;
-    } else {
-        c = buffer[FB(fb)->current_buffer_pos];
-        FB(fb)->current_buffer_pos += 1;
-    }
-    if (c == '\n') {
-        FB(fb)->line_number++;
+    if (FS(fs)->hints & HINT_DONTNEED) {
+        hints_file_consumed(fileno(FS(fs)->file), FS(fs)->hints,
+                            &(FS(fs)->dropped), ftell(FS(fs)->file));
     }
-    return c;
+    return num_read;
 }
 
-
-/*
- *  char32_t fb_next(file_buffer *fb)
- *
- *  Returns the next byte in the buffer, but does not advance the pointer.
- *  If the next two characters in the buffer are "\r\n", '\n' is returned.
- */
-
 static
-char32_t fb_next(void *fb)
+int fs_seek(void *fs, long int pos)
 {
-    char32_t c;
-    uint8_t *buffer = FB(fb)->buffer;
-
-    _fb_load(fb);
- 
-    if (FB(fb)->current_buffer_pos == FB(fb)->last_pos) {
-        return STREAM_EOF;
-    }
-
-    if ((FB(fb)->current_buffer_pos + 1 < FB(fb)->last_pos) &&
-            (buffer[FB(fb)->current_buffer_pos] == '\r') &&
-            (buffer[FB(fb)->current_buffer_pos + 1] == '\n')) {
-        c = '\n';
-    }
-    else {
-        c = buffer[FB(fb)->current_buffer_pos];
-    }
-    return c;
+    return fseek(FS(fs)->file, FS(fs)->initial_file_pos + pos, SEEK_SET);
 }
 
-/*
- *  fb_skipline(void *fb)
- *
- *  Read bytes from the buffer until a newline or the end of the file is reached.
- *
- *  The return value is 0 if no errors occurred.
- */
-
 static
-uint32_t fb_skipline(void *fb)
+void fs_close(void *fs, int restore, long int pos)
 {
-    char32_t c;
-
-    c = fb_next(fb);
-    if (c == STREAM_ERROR) {
-        return c;
-    }
-    while (c != '\n' && c != STREAM_EOF) {
-        fb_fetch(fb);
-        c = fb_next(fb);
-        if (c == STREAM_ERROR) {
-            return c;
-        }
+    if (FS(fs)->close_file) {
+        fclose(FS(fs)->file);
     }
-    if (c == '\n') {
-        fb_fetch(fb);
+    else if (restore == RESTORE_INITIAL) {
+        fseek(FS(fs)->file, FS(fs)->initial_file_pos, SEEK_SET);
     }
-    return 0;
-}
-
-
-/*
- *  fb_skiplines(void *fb, int num_lines)
- *
- *  Skip num_lines; calls fb_skipline(fb) num_lines times, or until the end of
- *  the file is reached.
- *
- *  The return value is 0 if no errors occurred.
- */
-
-uint32_t fb_skiplines(void *fb, int num_lines)
-{
-    int32_t status;
-    char32_t c;
-
-    while (num_lines > 0) {
-        status = fb_skipline(fb);
-        if (status != 0) {
-            return status;
-        }
-        c = fb_next(fb);
-        if (c == STREAM_EOF) {
-            break;
-        }
-        if (c == STREAM_ERROR) {
-            // Error
-            return c;
-        }
-        --num_lines;
+    else if (restore == RESTORE_FINAL) {
+        fseek(FS(fs)->file, FS(fs)->initial_file_pos + pos, SEEK_SET);
     }
-    return 0;
-}
-
-long int fb_tell(void *fb)
-{
-    return ftell(FB(fb)->file);
+    free(fs);
 }
 
-int fb_seek(void *fb, long int pos)
-{
-    // Not correct, but for now, assume pos == 0.
-    FB(fb)->line_number = 1;
-    FB(fb)->buffer_file_pos = FB(fb)->initial_file_pos;
-    FB(fb)->current_buffer_pos = 0;
-    FB(fb)->last_pos = 0;
-    FB(fb)->reached_eof = false;
-    return fseek(FB(fb)->file, pos, SEEK_SET);
-}
 
 static
-int stream_del(stream *strm, int restore)
+stream *_stream_file(FILE *f, int buffer_size, int encoding, bool close_file,
+                     int readahead, int hints)
 {
-    file_buffer *fb = (file_buffer *) (strm->stream_data);
+    file_source *fs;
+    buffered_source source;
+    stream *strm;
 
-    if (restore == RESTORE_INITIAL) {
-        fseek(FB(fb)->file, FB(fb)->initial_file_pos, SEEK_SET);
+    fs = (file_source *) malloc(sizeof(file_source));
+    if (fs == NULL) {
+        return NULL;
     }
-    else if (restore == RESTORE_FINAL) {
-        fseek(FB(fb)->file, FB(fb)->buffer_file_pos + FB(fb)->current_buffer_pos, SEEK_SET);
+    fs->file = f;
+    fs->initial_file_pos = ftell(f);
+    if (fs->initial_file_pos < 0) {
+        // Not seekable (e.g. a pipe); offsets are then only used by tell().
+        fs->initial_file_pos = 0;
     }
+    fs->close_file = close_file;
+    fs->hints = hints;
+    fs->dropped = 0;
 
-    free(FB(fb)->buffer);
-    free(fb);
-    free(strm);
+    source.data = (void *) fs;
+    source.read = &fs_read;
+    source.seek = &fs_seek;
+    source.close = &fs_close;
 
-    return 0;
+    strm = stream_buffered(&source, buffer_size, encoding, readahead, hints);
+    if (strm == NULL) {
+        free(fs);
+    }
+    return strm;
 }
 
 
 /*
- *  stream *stream_file(FILE *f, int buffer_size)
+ *  stream *stream_file(FILE *f, int buffer_size, int encoding)
  *
- *  Allocate a new file_buffer.
+ *  Create a stream that reads from f, starting at the current position.
  *  Returns NULL if the memory allocation fails.
  */
 
-stream *stream_file(FILE *f, int buffer_size)
+stream *stream_file(FILE *f, int buffer_size, int encoding)
 {
-    file_buffer *fb;
-    stream *strm;
-
-    fb = (file_buffer *) malloc(sizeof(file_buffer));
-    if (fb == NULL) {
-        fprintf(stderr, "stream_file: malloc() failed.\n");
-        return NULL;
-    }
-
-    strm = (stream *) malloc(sizeof(stream));
-    if (strm == NULL) {
-        fprintf(stderr, "stream_file: malloc() failed.\n");
-        free(fb);
-        return NULL;
-    }
-
-    fb->file = f;
-    fb->initial_file_pos = ftell(f);
-
-    fb->line_number = 1;
-
-    fb->buffer_file_pos = fb->initial_file_pos;
-
-    fb->current_buffer_pos = 0;
-    fb->last_pos = 0;
-
-    fb->reached_eof = 0;
-
-    if (buffer_size < 1) {
-        buffer_size = DEFAULT_BUFFER_SIZE;
-    }
-
-    fb->buffer_size = buffer_size;
-    fb->buffer = malloc(fb->buffer_size);
-    if (fb->buffer == NULL) {
-        // FIXME: don't print to stderr!
-        fprintf(stderr, "stream_file: malloc() failed.\n");
-        free(fb);
-        fb = NULL;
-    }
-
-    strm->stream_data = (void *) fb;
-    strm->stream_fetch = &fb_fetch;
-    strm->stream_peek = &fb_next;
-    strm->stream_skipline = &fb_skipline;
-    strm->stream_skiplines = &fb_skiplines;
-    strm->stream_linenumber = &fb_line_number;
-    strm->stream_tell = &fb_tell;
-    strm->stream_seek = &fb_seek;
-    strm->stream_close = &stream_del;
-
-    return strm;
+    return _stream_file(f, buffer_size, encoding, false, 0, 0);
 }
 
 
-stream *stream_file_from_filename(char *filename, int buffer_size)
+stream *stream_file_from_filename(char *filename, int buffer_size,
+                                  int encoding, int readahead, int hints)
 {
     FILE *fp;
+    stream *strm;
 
     fp = fopen(filename, "rb");
     if (fp == NULL) {
         return NULL;
     }
+    hints_file_start(fileno(fp), hints);
 
-    return stream_file(fp, buffer_size);    
+    strm = _stream_file(fp, buffer_size, encoding, true, readahead, hints);
+    if (strm == NULL) {
+        fclose(fp);
+    }
+    return strm;
 }
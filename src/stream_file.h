@@ -3,7 +3,8 @@
 
 #include "stream.h"
 
-stream *stream_file(FILE *f, int buffer_size);
-stream *stream_file_from_filename(char *filename, int buffer_size);
+stream *stream_file(FILE *f, int buffer_size, int encoding);
+stream *stream_file_from_filename(char *filename, int buffer_size,
+                                  int encoding, int readahead, int hints);
 
 #endif
@@ -0,0 +1,242 @@
+//
+// stream_gzip.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_gzip_from_filename(char *filename, int buffer_size,
+//                                       int encoding, int readahead,
+//                                       int hints)
+//
+// If the file with the given name starts with the gzip magic bytes, the
+// function creates a stream that decompresses the file with zlib's
+// inflate() directly into the stream's buffer (see stream_buffered.c).
+// `encoding` is one of the ENCODING_* constants defined in encoding.h.
+// Files made of several concatenated gzip members are read as one file.
+//
+// NULL is returned if the file can not be opened, if it is not a regular
+// file that starts with the gzip magic bytes, or if the memory allocation
+// fails.  In that case, the caller can fall back to one of the uncompressed
+// streams.  (Nothing is read from a pipe or a device, so the fallback
+// stream still sees all the data.)
+//
+// The source can only be rewound; it restarts the decompression.  (Seeking
+// to another offset decompresses the data up to it; see stream_buffered.c.)
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "hints.h"
+
+#define INPUT_BUFFER_SIZE 1048576
+
+
+typedef struct _gzip_source {
+
+    /* The compressed file. */
+    FILE *file;
+
+    /* zlib state. */
+    z_stream zs;
+
+    /* Boolean: has the end of the compressed file been reached? */
+    bool input_eof;
+
+    /* Boolean: has the end of the last gzip member been reached? */
+    bool output_eof;
+
+    /* HINT_* flags, and the offset up to which pages have been dropped. */
+    int hints;
+    long int dropped;
+
+    /* Buffer holding compressed data read from the file. */
+    uint8_t *input;
+
+} gzip_source;
+
+#define GS(gs)  ((gzip_source *)gs)
+
+
+/*
+ *  int _gs_fill(void *gs)
+ *
+ *  Read more compressed data from the file, if the input buffer is empty.
+ *  Returns 0 on success, or -1 on error.
+ */
+
+static
+int _gs_fill(void *gs)
+{
+    z_stream *zs = &(GS(gs)->zs);
+
+    if (zs->avail_in == 0 && !GS(gs)->input_eof) {
+        size_t num_read;
+        num_read = fread(GS(gs)->input, 1, INPUT_BUFFER_SIZE, GS(gs)->file);
+        if (num_read < INPUT_BUFFER_SIZE) {
+            if (ferror(GS(gs)->file)) {
+                return -1;
+            }
+            GS(gs)->input_eof = true;
+        }
+        hints_file_consumed(fileno(GS(gs)->file), GS(gs)->hints,
+                            &(GS(gs)->dropped), ftell(GS(gs)->file));
+        zs->next_in = GS(gs)->input;
+        zs->avail_in = num_read;
+    }
+    return 0;
+}
+
+
+/*
+ *  long int gs_read(void *gs, uint8_t *buf, size_t n)
+ *
+ *  Decompress at most n bytes into buf.  Returns the number of bytes
+ *  decompressed, 0 at the end of the data, or -1 on error (including
+ *  corrupt or truncated compressed data).
+ */
+
+static
+long int gs_read(void *gs, uint8_t *buf, size_t n)
+{
+    z_stream *zs = &(GS(gs)->zs);
+
+    if (GS(gs)->output_eof) {
+        return 0;
+    }
+    if (n > UINT_MAX) {
+        n = UINT_MAX;
+    }
+    zs->next_out = buf;
+    zs->avail_out = n;
+
+    while (zs->avail_out == n) {
+        int status;
+
+        if (_gs_fill(gs) != 0) {
+            return -1;
+        }
+
+        status = inflate(zs, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            // End of a gzip member.  Another member may follow.
+            if (_gs_fill(gs) != 0) {
+                return -1;
+            }
+            if (zs->avail_in == 0) {
+                GS(gs)->output_eof = true;
+                break;
+            }
+            if (inflateReset(zs) != Z_OK) {
+                return -1;
+            }
+        }
+        else if (status == Z_BUF_ERROR) {
+            // No progress was possible: the input ended within a member.
+            if (GS(gs)->input_eof && zs->avail_in == 0) {
+                return -1;
+            }
+        }
+        else if (status != Z_OK) {
+            return -1;
+        }
+    }
+    return n - zs->avail_out;
+}
+
+static
+int gs_seek(void *gs, long int pos)
+{
+    if (pos != 0 || fseek(GS(gs)->file, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+    if (inflateReset(&(GS(gs)->zs)) != Z_OK) {
+        return -1;
+    }
+    GS(gs)->zs.avail_in = 0;
+    GS(gs)->input_eof = false;
+    GS(gs)->output_eof = false;
+    return 0;
+}
+
+static
+void gs_close(void *gs, int restore, long int pos)
+{
+    inflateEnd(&(GS(gs)->zs));
+    fclose(GS(gs)->file);
+    free(GS(gs)->input);
+    free(gs);
+}
+
+
+stream *stream_gzip_from_filename(char *filename, int buffer_size,
+                                  int encoding, int readahead, int hints)
+{
+    gzip_source *gs;
+    buffered_source source;
+    stream *strm;
+    FILE *fp;
+    uint8_t magic[2];
+    struct stat st;
+
+    if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    if (fread(magic, 1, 2, fp) != 2 || magic[0] != 0x1f || magic[1] != 0x8b) {
+        fclose(fp);
+        return NULL;
+    }
+    rewind(fp);
+    hints_file_start(fileno(fp), hints);
+
+    gs = (gzip_source *) malloc(sizeof(gzip_source));
+    if (gs == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    gs->input = malloc(INPUT_BUFFER_SIZE);
+    if (gs->input == NULL) {
+        free(gs);
+        fclose(fp);
+        return NULL;
+    }
+    gs->file = fp;
+    gs->input_eof = false;
+    gs->output_eof = false;
+    gs->hints = hints;
+    gs->dropped = 0;
+
+    memset(&(gs->zs), 0, sizeof(z_stream));
+    // 16 + MAX_WBITS: expect a gzip header and trailer.
+    if (inflateInit2(&(gs->zs), 16 + MAX_WBITS) != Z_OK) {
+        free(gs->input);
+        free(gs);
+        fclose(fp);
+        return NULL;
+    }
+
+    source.data = (void *) gs;
+    source.read = &gs_read;
+    source.seek = &gs_seek;
+    source.close = &gs_close;
+
+    strm = stream_buffered(&source, buffer_size, encoding, readahead,
+                           hints);
+    if (strm == NULL) {
+        gs_close(gs, RESTORE_NOT, 0);
+    }
+    return strm;
+}
@@ -0,0 +1,9 @@
+#ifndef STREAM_GZIP_H
+#define STREAM_GZIP_H
+
+#include "stream.h"
+
+stream *stream_gzip_from_filename(char *filename, int buffer_size,
+                                  int encoding, int readahead, int hints);
+
+#endif
@@ -0,0 +1,288 @@
+//
+// stream_memory.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_memory(const uint8_t *data, size_t size, int encoding,
+//                           void (*release)(void *), void *release_data)
+//
+// The function creates a stream that reads the characters directly from
+// the `size` bytes at `data`, so the data is not copied into a buffer, and
+// a second pass over the data (e.g. after analyze()) costs nothing extra.
+// `encoding` is one of the ENCODING_* constants defined in encoding.h.
+//
+// The memory must remain valid until the stream is closed.  When the
+// stream is closed, release(release_data) is called (if release is not
+// NULL), so the owner of the memory can unmap or unpin it.
+//
+// NULL is returned if the memory allocation fails; release is not called
+// in that case.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stream.h"
+#include "stream_memory.h"
+#include "encoding.h"
+#include "scan.h"
+
+
+typedef struct _memory_buffer {
+
+    /* Start of the data.  May be NULL if size is 0. */
+    const uint8_t *data;
+
+    /* Size of the data, in bytes. */
+    size_t size;
+
+    /* Position in data of the next character to read. */
+    size_t pos;
+
+    int32_t line_number;
+
+    /* Encoding of the data (one of the ENCODING_* constants). */
+    int encoding;
+
+    /* Called with release_data when the stream is closed, or NULL. */
+    void (*release)(void *);
+    void *release_data;
+
+} memory_buffer;
+
+#define MB(mb)  ((memory_buffer *)mb)
+
+
+static
+int32_t mb_line_number(void *mb)
+{
+    return MB(mb)->line_number;
+}
+
+
+/*
+ *  char32_t mb_fetch(void *mb)
+ *
+ *  Get a single character from the memory, and advance the position.
+ *
+ *  Returns STREAM_EOF when the end of the data is reached.
+ *  The sequence '\r\n' is treated as a single '\n'.
+ *  A non-ASCII character is decoded according to mb->encoding;
+ *  STREAM_DECODE_ERROR is returned if the bytes are not valid.
+ *  When '\n' is returned, mb->line_number is incremented.
+ */
+
+static
+char32_t mb_fetch(void *mb)
+{
+    const uint8_t *data = MB(mb)->data;
+    size_t pos = MB(mb)->pos;
+    char32_t c;
+
+    if (pos == MB(mb)->size) {
+        return STREAM_EOF;
+    }
+
+    c = data[pos];
+    if (c == '\r' && pos + 1 < MB(mb)->size && data[pos + 1] == '\n') {
+        c = '\n';
+        pos += 2;
+    }
+    else if (c < 0x80) {
+        pos += 1;
+    }
+    else {
+        int len;
+        c = decode_char(data + pos, MB(mb)->size - pos, MB(mb)->encoding, &len);
+        pos += len;
+    }
+    MB(mb)->pos = pos;
+    if (c == '\n') {
+        MB(mb)->line_number++;
+    }
+    return c;
+}
+
+
+/*
+ *  char32_t mb_next(void *mb)
+ *
+ *  Returns the next character in the data, but does not advance
+ *  the position.  If the next two characters are "\r\n", '\n' is returned.
+ */
+
+static
+char32_t mb_next(void *mb)
+{
+    const uint8_t *data = MB(mb)->data;
+    size_t pos = MB(mb)->pos;
+
+    if (pos == MB(mb)->size) {
+        return STREAM_EOF;
+    }
+    if (data[pos] == '\r' && pos + 1 < MB(mb)->size && data[pos + 1] == '\n') {
+        return '\n';
+    }
+    if (data[pos] >= 0x80) {
+        int len;
+        return decode_char(data + pos, MB(mb)->size - pos, MB(mb)->encoding, &len);
+    }
+    return data[pos];
+}
+
+
+/*
+ *  mb_skipline(void *mb)
+ *
+ *  Advance past the next newline, or to the end of the data if there
+ *  are no more newlines.  Since all the data is in memory, the newline
+ *  is found with memchr().  ("\r\n" needs no special handling here: the
+ *  position ends up just past the '\n' either way.)
+ *
+ *  The return value is 0 if no errors occurred.
+ */
+
+static
+uint32_t mb_skipline(void *mb)
+{
+    size_t pos = MB(mb)->pos;
+    size_t size = MB(mb)->size;
+    const uint8_t *nl;
+
+    if (pos == size) {
+        return 0;
+    }
+    nl = memchr(MB(mb)->data + pos, '\n', size - pos);
+    if (nl == NULL) {
+        MB(mb)->pos = size;
+    }
+    else {
+        MB(mb)->pos = (nl - MB(mb)->data) + 1;
+        MB(mb)->line_number++;
+    }
+    return 0;
+}
+
+
+/*
+ *  mb_skiplines(void *mb, int num_lines)
+ *
+ *  Skip num_lines, or up to the end of the data.  The newlines are found
+ *  (and counted) in bulk by scan_lines().
+ *
+ *  The return value is 0 if no errors occurred.
+ */
+
+static
+uint32_t mb_skiplines(void *mb, int num_lines)
+{
+    const uint8_t *p = MB(mb)->data + MB(mb)->pos;
+    int remaining = num_lines;
+
+    if (num_lines <= 0 || MB(mb)->pos == MB(mb)->size) {
+        return 0;
+    }
+    MB(mb)->pos += scan_lines(p, MB(mb)->data + MB(mb)->size, &remaining);
+    MB(mb)->line_number += num_lines - remaining;
+    return 0;
+}
+
+
+/*
+ *  long int mb_span(void *mb, const uint8_t **p)
+ *
+ *  The span is simply the rest of the data.
+ */
+
+static
+long int mb_span(void *mb, const uint8_t **p)
+{
+    *p = MB(mb)->data + MB(mb)->pos;
+    return MB(mb)->size - MB(mb)->pos;
+}
+
+static
+void mb_advance(void *mb, size_t n, int num_newlines)
+{
+    MB(mb)->pos += n;
+    MB(mb)->line_number += num_newlines;
+}
+
+
+static
+long int mb_tell(void *mb)
+{
+    return MB(mb)->pos;
+}
+
+
+static
+int mb_seek(void *mb, long int pos, int line_number)
+{
+    if (pos < 0 || (size_t) pos > MB(mb)->size) {
+        return -1;
+    }
+    MB(mb)->line_number = line_number;
+    MB(mb)->pos = pos;
+    return 0;
+}
+
+
+static
+int stream_del(void *strm, int restore)
+{
+    memory_buffer *mb = (memory_buffer *) (((stream *) strm)->stream_data);
+
+    // There is no file position to restore.
+    if (mb->release != NULL) {
+        mb->release(mb->release_data);
+    }
+    free(mb);
+    free(strm);
+
+    return 0;
+}
+
+
+stream *stream_memory(const uint8_t *data, size_t size, int encoding,
+                      void (*release)(void *), void *release_data)
+{
+    memory_buffer *mb;
+    stream *strm;
+
+    mb = (memory_buffer *) malloc(sizeof(memory_buffer));
+    if (mb == NULL) {
+        return NULL;
+    }
+
+    strm = (stream *) malloc(sizeof(stream));
+    if (strm == NULL) {
+        free(mb);
+        return NULL;
+    }
+
+    mb->data = data;
+    mb->size = size;
+    mb->pos = 0;
+    mb->line_number = 1;
+    mb->encoding = encoding;
+    mb->release = release;
+    mb->release_data = release_data;
+
+    strm->stream_data = (void *) mb;
+    strm->stream_fetch = &mb_fetch;
+    strm->stream_peek = &mb_next;
+    strm->stream_skipline = &mb_skipline;
+    strm->stream_skiplines = &mb_skiplines;
+    strm->stream_linenumber = &mb_line_number;
+    strm->stream_tell = &mb_tell;
+    strm->stream_seek = &mb_seek;
+    strm->stream_span = &mb_span;
+    strm->stream_advance = &mb_advance;
+    strm->stream_close = &stream_del;
+
+    return strm;
+}
@@ -0,0 +1,12 @@
+#ifndef STREAM_MEMORY_H
+#define STREAM_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stream.h"
+
+stream *stream_memory(const uint8_t *data, size_t size, int encoding,
+                      void (*release)(void *), void *release_data);
+
+#endif
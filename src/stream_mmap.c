@@ -0,0 +1,102 @@
+//
+// stream_mmap.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_mmap_from_filename(char *filename, int encoding,
+//                                       int hints)
+//
+// The function memory-maps the file with the given name and creates a
+// stream that can be used by the text file reader.  The characters are
+// read directly from the mapping by a stream_memory() stream, so the file is not copied into a
+// buffer in user space, and a second pass over the file (e.g. after
+// analyze()) is served from the page cache.  `encoding` is one of the
+// ENCODING_* constants defined in encoding.h.  `hints` is a combination of
+// the HINT_* flags defined in hints.h; they are applied to the mapping with
+// madvise().
+//
+// NULL is returned if the file can not be opened, if it is not a regular
+// file (e.g. a pipe or a character device), or if mmap() fails.  In that
+// case, the caller can fall back to stream_file_from_filename().
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "stream.h"
+#include "stream_memory.h"
+#include "hints.h"
+
+
+typedef struct _mapping {
+    void *data;
+    size_t size;
+} mapping;
+
+
+static
+void release_mapping(void *m)
+{
+    munmap(((mapping *) m)->data, ((mapping *) m)->size);
+    free(m);
+}
+
+
+stream *stream_mmap_from_filename(char *filename, int encoding, int hints)
+{
+    mapping *m;
+    stream *strm;
+    struct stat st;
+    void *data = NULL;
+    int fd;
+
+    // Check the file type before opening the file, because opening
+    // a FIFO blocks until the other end is opened.
+    if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+            (uint64_t) st.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        // Nothing to map.
+        close(fd);
+        return stream_memory(NULL, 0, encoding, NULL, NULL);
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping remains valid after the file descriptor is closed.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    hints_mapping(data, st.st_size, hints);
+
+    m = (mapping *) malloc(sizeof(mapping));
+    if (m == NULL) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    m->data = data;
+    m->size = st.st_size;
+
+    strm = stream_memory(data, st.st_size, encoding, &release_mapping, m);
+    if (strm == NULL) {
+        release_mapping(m);
+    }
+    return strm;
+}
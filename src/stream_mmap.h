@@ -0,0 +1,8 @@
+#ifndef STREAM_MMAP_H
+#define STREAM_MMAP_H
+
+#include "stream.h"
+
+stream *stream_mmap_from_filename(char *filename, int encoding, int hints);
+
+#endif
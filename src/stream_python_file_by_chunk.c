@@ -0,0 +1,406 @@
+//
+// stream_python_file_by_chunk.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_python_file_by_chunk(PyObject *obj, int encoding,
+//                                         PyObject *codec_name,
+//                                         int buffer_size, bool spool)
+//
+// This function wraps a Python file object that has a `read` method in a
+// stream that can be used by the text file reader.  Unlike the stream
+// created by stream_python_file_by_line(), which calls readline() once
+// per line, the data is read in large blocks with read(n) (or readinto()
+// for binary files), and the blocks are buffered by stream_buffered(),
+// so the tokenizer can work directly on the bytes.
+//
+// If read() returns str objects (a file opened in text mode), the data is
+// UTF-8 encoded and the stream decodes it as UTF-8.  If read() returns
+// bytes, the bytes are passed through unchanged and decoded by the stream
+// according to `encoding` (one of the ENCODING_* constants).  If `encoding`
+// is -1, the bytes are instead decoded in Python with the incremental
+// decoder of the codec named `codec_name`.
+//
+// The file object must be positioned at the start of the data.  The stream
+// can only be repositioned if the file object has `seek` and `tell`
+// methods.  A binary file that is not decoded in Python is repositioned
+// with seek(); otherwise the stream offsets are offsets in the UTF-8 data,
+// so the file is rewound and read up to the offset.
+//
+// If the file object can not be rewound (e.g. a pipe, or a generator) and
+// `spool` is true, the data read is kept (see spool.c), so the stream can
+// still be repositioned.
+//
+// Returns NULL with a Python exception set on failure.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "spool.h"
+#include "encoding.h"
+
+
+typedef struct _python_file_by_chunk {
+
+    /* The Python file object being read. */
+    PyObject *file;
+
+    /* The `read` attribute of the file object. */
+    PyObject *read;
+
+    /* The `readinto` attribute of the file object, or NULL. */
+    PyObject *readinto;
+
+    /* The `seek` attribute of the file object, or NULL. */
+    PyObject *seek;
+
+    /*
+     *  Position of the file object when the stream was created, as
+     *  returned by tell().  NULL if the file object can not be rewound.
+     *  (For a text file, this is an opaque cookie.)
+     */
+    PyObject *initial_pos;
+
+    /* Incremental decoder for codec_name, or NULL. */
+    PyObject *decoder;
+
+    /* Boolean: does read() return str objects? */
+    bool text;
+
+    /* Boolean: has read() returned an empty chunk? */
+    bool reached_eof;
+
+    /* Offset of the next byte to be returned by fc_read(). */
+    long int pos;
+
+    /*
+     *  The chunk most recently returned by read() (bytes or str), and
+     *  its data.  Bytes from chunk_data[chunk_pos:chunk_len] have not
+     *  been copied to the stream's buffer yet.
+     */
+    PyObject *chunk;
+    const char *chunk_data;
+    Py_ssize_t chunk_len;
+    Py_ssize_t chunk_pos;
+
+} python_file_by_chunk;
+
+#define FC(fc)  ((python_file_by_chunk *)fc)
+
+
+/*
+ *  int _fc_next_chunk(void *fc, size_t n)
+ *
+ *  Call read(n) and make the result the current chunk.  A str chunk is
+ *  accessed through its UTF-8 representation; a bytes chunk is decoded to
+ *  str first if the stream has a decoder.  An empty result from read()
+ *  marks the end of the file.
+ *
+ *  Returns 0 on success, or -1 with a Python exception set.
+ */
+
+static
+int _fc_next_chunk(void *fc, size_t n)
+{
+    PyObject *chunk;
+
+    Py_CLEAR(FC(fc)->chunk);
+    FC(fc)->chunk_len = 0;
+    FC(fc)->chunk_pos = 0;
+
+    chunk = PyObject_CallFunction(FC(fc)->read, "n", (Py_ssize_t) n);
+    if (chunk == NULL) {
+        return -1;
+    }
+    if (!PyUnicode_Check(chunk) && !PyBytes_Check(chunk)) {
+        PyErr_Format(PyExc_TypeError,
+                     "read() returned %.200s, expected str or bytes",
+                     Py_TYPE(chunk)->tp_name);
+        Py_DECREF(chunk);
+        return -1;
+    }
+    if (PyObject_Length(chunk) == 0) {
+        FC(fc)->reached_eof = true;
+    }
+    if (FC(fc)->decoder != NULL && PyBytes_Check(chunk)) {
+        // The decoded chunk may be empty before the end of the file, if
+        // the decoder is waiting for the rest of a character.
+        PyObject *s;
+        s = PyObject_CallMethod(FC(fc)->decoder, "decode", "Oi", chunk,
+                                FC(fc)->reached_eof);
+        Py_DECREF(chunk);
+        if (s == NULL) {
+            return -1;
+        }
+        chunk = s;
+    }
+    if (PyUnicode_Check(chunk)) {
+        FC(fc)->chunk_data = PyUnicode_AsUTF8AndSize(chunk, &(FC(fc)->chunk_len));
+        if (FC(fc)->chunk_data == NULL) {
+            Py_DECREF(chunk);
+            return -1;
+        }
+    }
+    else {
+        FC(fc)->chunk_data = PyBytes_AS_STRING(chunk);
+        FC(fc)->chunk_len = PyBytes_GET_SIZE(chunk);
+    }
+    FC(fc)->chunk = chunk;
+    return 0;
+}
+
+
+/*
+ *  long int fc_read(void *fc, uint8_t *buf, size_t n)
+ *
+ *  The buffered_source read function.  Bytes left over from the previous
+ *  chunk are returned first (a text chunk of n characters can be longer
+ *  than n bytes).  When a binary file has a readinto method, the data is
+ *  read directly into buf.
+ */
+
+static
+long int fc_read(void *fc, uint8_t *buf, size_t n)
+{
+    Py_ssize_t k;
+
+    while (FC(fc)->chunk_pos == FC(fc)->chunk_len) {
+        if (FC(fc)->reached_eof) {
+            return 0;
+        }
+        if (FC(fc)->readinto != NULL) {
+            PyObject *view, *result;
+            view = PyMemoryView_FromMemory((char *) buf, n, PyBUF_WRITE);
+            if (view == NULL) {
+                return -1;
+            }
+            result = PyObject_CallFunctionObjArgs(FC(fc)->readinto, view, NULL);
+            Py_DECREF(view);
+            if (result == NULL) {
+                return -1;
+            }
+            k = PyLong_AsSsize_t(result);
+            Py_DECREF(result);
+            if (k == -1 && PyErr_Occurred()) {
+                return -1;
+            }
+            if (k == 0) {
+                FC(fc)->reached_eof = true;
+            }
+            FC(fc)->pos += k;
+            return k;
+        }
+        if (_fc_next_chunk(fc, n) == -1) {
+            return -1;
+        }
+    }
+
+    k = FC(fc)->chunk_len - FC(fc)->chunk_pos;
+    if ((size_t) k > n) {
+        k = n;
+    }
+    memcpy(buf, FC(fc)->chunk_data + FC(fc)->chunk_pos, k);
+    FC(fc)->chunk_pos += k;
+    FC(fc)->pos += k;
+    return k;
+}
+
+
+/*
+ *  int fc_seek(void *fc, long int pos)
+ *
+ *  The positions of a text file are opaque, and the offsets of decoded
+ *  data are not file positions, so in those cases only rewinding to the
+ *  start of the data is supported.  (stream_buffered() handles other
+ *  offsets by reading from the start.)
+ */
+
+static
+int fc_seek(void *fc, long int pos)
+{
+    PyObject *result;
+
+    if (FC(fc)->initial_pos == NULL) {
+        // Only "repositioning" to the current offset is possible.
+        return pos == FC(fc)->pos ? 0 : -1;
+    }
+    if (pos != 0) {
+        PyObject *offset, *target;
+        if (FC(fc)->readinto == NULL || !PyLong_Check(FC(fc)->initial_pos)) {
+            return -1;
+        }
+        // A binary file read directly into the buffer: pos is a byte
+        // offset from initial_pos.
+        offset = PyLong_FromLong(pos);
+        if (offset == NULL) {
+            return -1;
+        }
+        target = PyNumber_Add(FC(fc)->initial_pos, offset);
+        Py_DECREF(offset);
+        if (target == NULL) {
+            return -1;
+        }
+        result = PyObject_CallFunctionObjArgs(FC(fc)->seek, target, NULL);
+        Py_DECREF(target);
+        if (result == NULL) {
+            // Let stream_buffered() fall back to rewinding.
+            PyErr_Clear();
+            return -1;
+        }
+    }
+    else {
+        result = PyObject_CallFunctionObjArgs(FC(fc)->seek,
+                                              FC(fc)->initial_pos, NULL);
+    }
+    if (result == NULL) {
+        return -1;
+    }
+    Py_DECREF(result);
+
+    Py_CLEAR(FC(fc)->chunk);
+    FC(fc)->chunk_len = 0;
+    FC(fc)->chunk_pos = 0;
+    FC(fc)->reached_eof = false;
+    if (FC(fc)->decoder != NULL) {
+        result = PyObject_CallMethod(FC(fc)->decoder, "reset", NULL);
+        if (result == NULL) {
+            return -1;
+        }
+        Py_DECREF(result);
+    }
+    FC(fc)->pos = pos;
+    return 0;
+}
+
+static
+void fc_close(void *fc, int restore, long int pos)
+{
+    // Only RESTORE_INITIAL can be honored: the file object has been read
+    // ahead of the stream, and text file positions are opaque.
+    if (restore == RESTORE_INITIAL && FC(fc)->initial_pos != NULL) {
+        PyObject *result;
+        result = PyObject_CallFunctionObjArgs(FC(fc)->seek,
+                                              FC(fc)->initial_pos, NULL);
+        Py_XDECREF(result);
+    }
+    Py_XDECREF(FC(fc)->file);
+    Py_XDECREF(FC(fc)->read);
+    Py_XDECREF(FC(fc)->readinto);
+    Py_XDECREF(FC(fc)->seek);
+    Py_XDECREF(FC(fc)->initial_pos);
+    Py_XDECREF(FC(fc)->decoder);
+    Py_XDECREF(FC(fc)->chunk);
+    free(fc);
+}
+
+
+stream *stream_python_file_by_chunk(PyObject *obj, int encoding,
+                                    PyObject *codec_name, int buffer_size,
+                                    bool spool)
+{
+    python_file_by_chunk *fc;
+    buffered_source source;
+    stream *strm;
+    int stream_encoding;
+
+    fc = (python_file_by_chunk *) calloc(1, sizeof(python_file_by_chunk));
+    if (fc == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    fc->file = obj;
+    Py_INCREF(fc->file);
+
+    fc->read = PyObject_GetAttrString(obj, "read");
+    if (fc->read == NULL) {
+        goto fail;
+    }
+
+    if (encoding == -1) {
+        PyObject *codecs = PyImport_ImportModule("codecs");
+        if (codecs == NULL) {
+            goto fail;
+        }
+        fc->decoder = PyObject_CallMethod(codecs, "getincrementaldecoder",
+                                          "O", codec_name);
+        Py_DECREF(codecs);
+        if (fc->decoder != NULL) {
+            PyObject *cls = fc->decoder;
+            fc->decoder = PyObject_CallObject(cls, NULL);
+            Py_DECREF(cls);
+        }
+        if (fc->decoder == NULL) {
+            goto fail;
+        }
+    }
+
+    // The stream can only be rewound if tell() works.  (It raises an
+    // exception for unseekable files, e.g. pipes and sockets.)
+    if (PyObject_HasAttrString(obj, "seek") &&
+            PyObject_HasAttrString(obj, "tell")) {
+        fc->initial_pos = PyObject_CallMethod(obj, "tell", NULL);
+        if (fc->initial_pos == NULL) {
+            PyErr_Clear();
+        }
+        else {
+            fc->seek = PyObject_GetAttrString(obj, "seek");
+            if (fc->seek == NULL) {
+                goto fail;
+            }
+        }
+    }
+
+    // Read the first chunk, to find out if the file returns str or bytes.
+    if (_fc_next_chunk(fc, buffer_size) == -1) {
+        goto fail;
+    }
+    fc->text = PyUnicode_Check(fc->chunk);
+
+    if (fc->text || fc->decoder != NULL) {
+        stream_encoding = ENCODING_UTF8;
+    }
+    else {
+        stream_encoding = encoding;
+        // A binary file that is not decoded in Python can be read
+        // directly into the stream's buffer.
+        if (PyObject_HasAttrString(obj, "readinto")) {
+            fc->readinto = PyObject_GetAttrString(obj, "readinto");
+            if (fc->readinto == NULL) {
+                goto fail;
+            }
+        }
+    }
+
+    source.data = (void *) fc;
+    source.read = &fc_read;
+    source.seek = &fc_seek;
+    source.close = &fc_close;
+    if (spool && fc->initial_pos == NULL && spool_source(&source) != 0) {
+        PyErr_NoMemory();
+        fc_close(fc, RESTORE_NOT, 0);
+        return NULL;
+    }
+
+    // No read-ahead: read() must be called with the GIL held.
+    strm = stream_buffered(&source, buffer_size, stream_encoding, 0, 0);
+    if (strm == NULL) {
+        PyErr_NoMemory();
+        // Closes fc too (through the spool, if there is one).
+        source.close(source.data, RESTORE_NOT, 0);
+    }
+    return strm;
+
+fail:
+    fc_close(fc, RESTORE_NOT, 0);
+    return NULL;
+}
@@ -0,0 +1,15 @@
+#ifndef _STREAM_PYTHON_FILE_BY_CHUNK
+#define _STREAM_PYTHON_FILE_BY_CHUNK
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdbool.h>
+
+#include "stream.h"
+
+stream *stream_python_file_by_chunk(PyObject *obj, int encoding,
+                                    PyObject *codec_name, int buffer_size,
+                                    bool spool);
+
+#endif
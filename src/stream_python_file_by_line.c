@@ -8,6 +8,11 @@
 // This function wraps a Python file object in a stream that
 // can be used by the text file reader.
 //
+// The offsets used by stream_tell() and stream_seek() count the characters
+// returned by readline() since the stream was created.  Seeking rewinds the
+// file to the position returned by tell() when the stream was created, and
+// reads lines up to the offset.
+//
 
 #include <stdio.h>
 #include <string.h>
@@ -38,8 +43,14 @@ typedef struct _python_file_by_line {
     /* The `tell` attribute of the file object. */
     PyObject *tell;
 
-    /* file position when the file_buffer was created. */
-    off_t initial_file_pos;
+    /*
+     *  Position of the file object when the stream was created, as
+     *  returned by tell().  NULL if tell() failed.
+     */
+    PyObject *initial_pos;
+
+    /* Stream offset of the first character of line. */
+    long int line_offset;
 
     int32_t line_number;
 
@@ -64,8 +75,8 @@ typedef struct _python_file_by_line {
     /* Position in the buffer of the next character to read. */
     Py_ssize_t current_buffer_pos;
 
-    // encoding must be None or a bytes object holding an
-    // ASCII-encoding string, e.g. b'utf-8'.
+    // encoding must be None or a str holding the name of
+    // a codec, e.g. 'utf-8'.
     PyObject *encoding;
 
 } python_file_by_line;
@@ -97,6 +108,7 @@ uint32_t _fb_load(void *fb)
 
     if (!FB(fb)->reached_eof && (FB(fb)->current_buffer_pos == FB(fb)->linelen)) {
         // Read a line from the file.
+        FB(fb)->line_offset += FB(fb)->linelen;
         //printf("_fb_load: calling readline\n");
         PyObject *line = PyObject_Call(FB(fb)->readline, FB(fb)->empty_tuple, NULL);
         //printf("_fb_load: back from readline\n");
@@ -115,7 +127,11 @@ uint32_t _fb_load(void *fb)
                 enc = "utf-8";
             }
             else {
-                enc = PyBytes_AsString(FB(fb)->encoding);
+                enc = (char *) PyUnicode_AsUTF8(FB(fb)->encoding);
+                if (enc == NULL) {
+                    Py_DECREF(line);
+                    return STREAM_ERROR;
+                }
             }
             uline = PyUnicode_FromEncodedObject(line, enc, NULL);
             if (uline == NULL) {
@@ -213,7 +229,9 @@ char32_t fb_next(void *fb)
 /*
  *  fb_skipline(void *fb)
  *
- *  Read bytes from the buffer until a newline or the end of the file is reached.
+ *  Skip the characters of the buffer until a newline or the end of the
+ *  file is reached.  The newline is found with PyUnicode_FindChar(), so
+ *  the rest of a line is skipped at once.
  *
  *  The return value is 0 if no errors occurred.
  */
@@ -221,23 +239,28 @@ char32_t fb_next(void *fb)
 static
 uint32_t fb_skipline(void *fb)
 {
-    char32_t c;
+    while (1) {
+        Py_ssize_t pos;
 
-    c = fb_next(fb);
-    if (c == STREAM_ERROR) {
-        return c;
-    }
-    while (c != '\n' && c != STREAM_EOF) {
-        fb_fetch(fb);
-        c = fb_next(fb);
-        if (c == STREAM_ERROR) {
-            return c;
+        if (_fb_load(fb) != 0) {
+            return STREAM_ERROR;
         }
+        if (FB(fb)->reached_eof) {
+            return 0;
+        }
+        pos = PyUnicode_FindChar(FB(fb)->line, '\n',
+                                 FB(fb)->current_buffer_pos,
+                                 FB(fb)->linelen, 1);
+        if (pos == -2) {
+            return STREAM_ERROR;
+        }
+        if (pos >= 0) {
+            FB(fb)->current_buffer_pos = pos + 1;
+            FB(fb)->line_number++;
+            return 0;
+        }
+        FB(fb)->current_buffer_pos = FB(fb)->linelen;
     }
-    if (c == '\n') {
-        fb_fetch(fb);
-    }
-    return 0;
 }
 
 
@@ -274,33 +297,54 @@ uint32_t fb_skiplines(void *fb, int num_lines)
     return 0;
 }
 
-// XXX Is long int really the correct type?
 static
 long int fb_tell(void *fb)
 {
-    long int pos;
-    PyObject *obj = PyObject_Call(FB(fb)->tell, FB(fb)->empty_tuple, NULL);
-    // XXX Check for error.
-    pos = PyLong_AsLong(obj);
-    return pos;
+    return FB(fb)->line_offset + FB(fb)->current_buffer_pos;
 }
 
+/*
+ *  int fb_seek(void *fb, long int pos, int line_number)
+ *
+ *  Rewind the file to its initial position, and read lines until the
+ *  stream offset pos is reached.
+ *
+ *  Returns 0 on success, or -1 (possibly with a Python exception set) if
+ *  the file can not be rewound or has fewer than pos characters.
+ */
+
 static
-int fb_seek(void *fb, long int pos)
+int fb_seek(void *fb, long int pos, int line_number)
 {
-    int status = 0;
-
-    PyObject *args = Py_BuildValue("(n)", (Py_ssize_t) pos);
-    // XXX Check for error, and
-    // DECREF where appropriate...
-    PyObject *result = PyObject_Call(FB(fb)->seek, args, NULL);
-    // XXX Check for error!
-    FB(fb)->line_number = 1;
-    //FB(fb)->buffer_file_pos = FB(fb)->initial_file_pos;
+    PyObject *result;
+
+    if (FB(fb)->initial_pos == NULL) {
+        return -1;
+    }
+    result = PyObject_CallFunctionObjArgs(FB(fb)->seek, FB(fb)->initial_pos,
+                                          NULL);
+    if (result == NULL) {
+        return -1;
+    }
+    Py_DECREF(result);
+
+    FB(fb)->line_offset = 0;
+    FB(fb)->linelen = 0;
     FB(fb)->current_buffer_pos = 0;
-    //FB(fb)->last_pos = 0;
     FB(fb)->reached_eof = false;
-    return status;
+    while (fb_tell(fb) < pos) {
+        long int k;
+        if (_fb_load(fb) != 0 || FB(fb)->reached_eof) {
+            return -1;
+        }
+        k = FB(fb)->linelen - FB(fb)->current_buffer_pos;
+        if (k > pos - fb_tell(fb)) {
+            k = pos - fb_tell(fb);
+        }
+        FB(fb)->current_buffer_pos += k;
+    }
+    FB(fb)->line_number = line_number;
+    return 0;
 }
 
 static
@@ -310,12 +354,12 @@ int stream_del(stream *strm, int restore)
 
     if (restore == RESTORE_INITIAL) {
         // XXX
-        stream_seek(strm, SEEK_SET);
+        stream_seek(strm, 0, 1);
         //fseek(FB(fb)->file, FB(fb)->initial_file_pos, SEEK_SET);
     }
     else if (restore == RESTORE_FINAL) {
         // XXX
-        stream_seek(strm, SEEK_SET);
+        stream_seek(strm, 0, 1);
         //fseek(FB(fb)->file, FB(fb)->buffer_file_pos + FB(fb)->current_buffer_pos, SEEK_SET);
     }
 
@@ -324,6 +368,7 @@ int stream_del(stream *strm, int restore)
     Py_XDECREF(fb->readline);
     Py_XDECREF(fb->seek);
     Py_XDECREF(fb->tell);
+    Py_XDECREF(fb->initial_pos);
     Py_XDECREF(fb->empty_tuple);
 
     free(fb);
@@ -351,6 +396,7 @@ stream *stream_python_file_by_line(PyObject *obj, PyObject *encoding)
     fb->readline = NULL;
     fb->seek = NULL;
     fb->tell = NULL;
+    fb->initial_pos = NULL;
     fb->empty_tuple = NULL;
     fb->encoding = encoding;
 
@@ -391,7 +437,14 @@ stream *stream_python_file_by_line(PyObject *obj, PyObject *encoding)
         goto fail;
     }
 
+    // The stream can only be repositioned if tell() works.
+    fb->initial_pos = PyObject_Call(fb->tell, fb->empty_tuple, NULL);
+    if (fb->initial_pos == NULL) {
+        PyErr_Clear();
+    }
+
     fb->line_number = 1;
+    fb->line_offset = 0;
     fb->linelen = 0;
 
     fb->current_buffer_pos = 0;
@@ -406,6 +459,8 @@ stream *stream_python_file_by_line(PyObject *obj, PyObject *encoding)
     strm->stream_linenumber = &fb_line_number;
     strm->stream_tell = &fb_tell;
     strm->stream_seek = &fb_seek;
+    strm->stream_span = NULL;
+    strm->stream_advance = NULL;
     strm->stream_close = &stream_del;  // FIXME: compiler warning
 
     return strm;
@@ -415,6 +470,7 @@ fail:
     Py_XDECREF(fb->readline);
     Py_XDECREF(fb->seek);
     Py_XDECREF(fb->tell);
+    Py_XDECREF(fb->initial_pos);
     Py_XDECREF(fb->empty_tuple);
 
     free(fb);
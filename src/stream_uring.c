@@ -0,0 +1,589 @@
+//
+// stream_uring.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_uring_from_filename(char *filename, int buffer_size,
+//                                        int encoding, int depth,
+//                                        bool direct, int hints)
+//
+// The function creates a stream that reads the regular file with the given
+// name with up to `depth` reads of buffer_size bytes in flight at the same
+// time, using io_uring, so a fast device (e.g. an NVMe array) is kept busy
+// while the tokenizer works.  If io_uring is not available (not compiled
+// in, or io_uring_setup() fails, e.g. on an old kernel or in a sandbox),
+// the blocks are read synchronously with pread().  `encoding` is one of
+// the ENCODING_* constants defined in encoding.h.
+//
+// If `direct` is true, the file is opened with O_DIRECT, so the data does
+// not go through (and does not evict other data from) the page cache.  If
+// the file system does not support O_DIRECT, the flag is silently dropped.
+// `hints` is a combination of the HINT_* flags defined in hints.h; with
+// HINT_DONTNEED, the blocks are dropped from the page cache once they have
+// been consumed.
+//
+// NULL is returned if the file can not be opened, if it is not a regular
+// file, or if the memory allocation fails.
+//
+// io_uring is used through the raw system calls, so liburing is not needed;
+// HAVE_IO_URING is defined by setup.py if <linux/io_uring.h> is found.
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "hints.h"
+
+// Alignment of the blocks (address, offset and size) required by O_DIRECT.
+#define DIRECT_ALIGNMENT 4096
+
+#define BLOCK_EMPTY     0
+#define BLOCK_IN_FLIGHT 1
+#define BLOCK_READY     2
+
+
+typedef struct _uring_block {
+
+    /* Buffer, aligned to DIRECT_ALIGNMENT. */
+    uint8_t *data;
+
+    /* One of the BLOCK_* constants. */
+    int state;
+
+    /* Offset in the file of data[0]. */
+    off_t offset;
+
+    /* Number of bytes that should be read (less than the block size at
+       the end of the file). */
+    size_t expected;
+
+    /* Number of bytes read so far, or -1 on error. */
+    long int filled;
+
+    /* Position in data of the next byte to be returned by us_read(). */
+    long int pos;
+
+#ifdef HAVE_IO_URING
+    struct iovec iov;
+#endif
+
+} uring_block;
+
+
+typedef struct _uring_source {
+
+    int fd;
+
+    /* Size of the file, in bytes. */
+    off_t size;
+
+    /* The ring of blocks; blocks[head] is being read by us_read(). */
+    uring_block *blocks;
+    int num_blocks;
+    size_t block_size;
+    int head;
+
+    /* Offset of the next block to be submitted. */
+    off_t next_offset;
+
+    /* HINT_* flags, and the offset up to which pages have been dropped. */
+    int hints;
+    long int dropped;
+
+#ifdef HAVE_IO_URING
+    /* io_uring file descriptor; -1 if pread() is used instead. */
+    int ring_fd;
+
+    /* The mapped rings. */
+    void *sq_ptr;
+    size_t sq_map_size;
+    void *cq_ptr;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_map_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Number of submitted reads that have not completed. */
+    int in_flight;
+#endif
+
+} uring_source;
+
+#define US(us)  ((uring_source *)us)
+
+
+#ifdef HAVE_IO_URING
+
+/*
+ *  int _us_ring_init(void *us)
+ *
+ *  Create the io_uring instance and map its rings.  Returns 0 on success;
+ *  on failure, ring_fd is left at -1 and pread() is used.
+ */
+
+static
+int _us_ring_init(void *us)
+{
+    struct io_uring_params p;
+    int fd;
+
+    US(us)->ring_fd = -1;
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, US(us)->num_blocks, &p);
+    if (fd < 0) {
+        return -1;
+    }
+
+    US(us)->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    US(us)->cq_map_size = p.cq_off.cqes +
+                          p.cq_entries * sizeof(struct io_uring_cqe);
+    US(us)->sqes_map_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    US(us)->sq_ptr = mmap(NULL, US(us)->sq_map_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    US(us)->cq_ptr = mmap(NULL, US(us)->cq_map_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    US(us)->sqes = mmap(NULL, US(us)->sqes_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (US(us)->sq_ptr == MAP_FAILED || US(us)->cq_ptr == MAP_FAILED ||
+            US(us)->sqes == MAP_FAILED) {
+        if (US(us)->sq_ptr != MAP_FAILED) {
+            munmap(US(us)->sq_ptr, US(us)->sq_map_size);
+        }
+        if (US(us)->cq_ptr != MAP_FAILED) {
+            munmap(US(us)->cq_ptr, US(us)->cq_map_size);
+        }
+        if (US(us)->sqes != MAP_FAILED) {
+            munmap(US(us)->sqes, US(us)->sqes_map_size);
+        }
+        close(fd);
+        return -1;
+    }
+
+    US(us)->sq_head = (unsigned *) ((char *) US(us)->sq_ptr + p.sq_off.head);
+    US(us)->sq_tail = (unsigned *) ((char *) US(us)->sq_ptr + p.sq_off.tail);
+    US(us)->sq_mask = (unsigned *) ((char *) US(us)->sq_ptr + p.sq_off.ring_mask);
+    US(us)->sq_array = (unsigned *) ((char *) US(us)->sq_ptr + p.sq_off.array);
+    US(us)->cq_head = (unsigned *) ((char *) US(us)->cq_ptr + p.cq_off.head);
+    US(us)->cq_tail = (unsigned *) ((char *) US(us)->cq_ptr + p.cq_off.tail);
+    US(us)->cq_mask = (unsigned *) ((char *) US(us)->cq_ptr + p.cq_off.ring_mask);
+    US(us)->cqes = (struct io_uring_cqe *) ((char *) US(us)->cq_ptr +
+                                            p.cq_off.cqes);
+    US(us)->ring_fd = fd;
+    US(us)->in_flight = 0;
+    return 0;
+}
+
+static
+void _us_ring_free(void *us)
+{
+    if (US(us)->ring_fd < 0) {
+        return;
+    }
+    munmap(US(us)->sqes, US(us)->sqes_map_size);
+    munmap(US(us)->cq_ptr, US(us)->cq_map_size);
+    munmap(US(us)->sq_ptr, US(us)->sq_map_size);
+    close(US(us)->ring_fd);
+    US(us)->ring_fd = -1;
+}
+
+/*
+ *  int _us_submit(void *us, int i)
+ *
+ *  Queue a read of the unfilled part of blocks[i], and pass it to the
+ *  kernel.  Returns 0 on success, or -1 on error.
+ */
+
+static
+int _us_submit(void *us, int i)
+{
+    uring_block *b = &(US(us)->blocks[i]);
+    struct io_uring_sqe *sqe;
+    unsigned tail, index;
+
+    tail = *(US(us)->sq_tail);
+    index = tail & *(US(us)->sq_mask);
+    sqe = &(US(us)->sqes[index]);
+    memset(sqe, 0, sizeof(*sqe));
+
+    b->iov.iov_base = b->data + b->filled;
+    // With O_DIRECT, the length must be a multiple of the alignment; a
+    // read past the end of the file just returns fewer bytes.
+    b->iov.iov_len = US(us)->block_size - b->filled;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = US(us)->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &(b->iov);
+    sqe->len = 1;
+    sqe->off = b->offset + b->filled;
+    sqe->user_data = i;
+
+    US(us)->sq_array[index] = index;
+    __atomic_store_n(US(us)->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, US(us)->ring_fd, 1, 0, 0, NULL, 0) < 0) {
+        return -1;
+    }
+    b->state = BLOCK_IN_FLIGHT;
+    US(us)->in_flight++;
+    return 0;
+}
+
+/*
+ *  int _us_reap(void *us, bool wait)
+ *
+ *  Process the completed reads.  If wait is true and nothing has
+ *  completed, wait for one read to complete.  A short read (that is
+ *  not at the end of the file) is resubmitted for the rest of the block.
+ *
+ *  Returns 0 on success, or -1 on error.
+ */
+
+static
+int _us_reap(void *us, bool wait)
+{
+    unsigned head, tail;
+
+    head = *(US(us)->cq_head);
+    tail = __atomic_load_n(US(us)->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail && wait) {
+        if (syscall(__NR_io_uring_enter, US(us)->ring_fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+            return -1;
+        }
+        tail = __atomic_load_n(US(us)->cq_tail, __ATOMIC_ACQUIRE);
+    }
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &(US(us)->cqes[head & *(US(us)->cq_mask)]);
+        uring_block *b = &(US(us)->blocks[cqe->user_data]);
+        int res = cqe->res;
+
+        head++;
+        __atomic_store_n(US(us)->cq_head, head, __ATOMIC_RELEASE);
+        US(us)->in_flight--;
+
+        if (res < 0) {
+            b->filled = -1;
+            b->state = BLOCK_READY;
+        }
+        else if (res > 0 && b->filled + res < (long int) b->expected) {
+            b->filled += res;
+            if (_us_submit(us, cqe->user_data) != 0) {
+                b->filled = -1;
+                b->state = BLOCK_READY;
+            }
+        }
+        else {
+            // res == 0: the file was truncated while it was being read.
+            b->filled = (res == 0) ? b->filled : b->filled + res;
+            b->state = BLOCK_READY;
+        }
+    }
+    return 0;
+}
+
+/*
+ *  void _us_drain(void *us)
+ *
+ *  Wait for all the reads in flight to complete; the buffers may not be
+ *  reused or freed before that.
+ */
+
+static
+void _us_drain(void *us)
+{
+    while (US(us)->ring_fd >= 0 && US(us)->in_flight > 0) {
+        if (_us_reap(us, true) != 0) {
+            break;
+        }
+    }
+}
+
+#endif
+
+
+/*
+ *  void _us_start_block(void *us, int i)
+ *
+ *  Assign the next offset of the file to blocks[i], and start reading it.
+ *  Blocks past the end of the file are left empty.
+ */
+
+static
+void _us_start_block(void *us, int i)
+{
+    uring_block *b = &(US(us)->blocks[i]);
+
+    b->pos = 0;
+    b->filled = 0;
+    if (US(us)->next_offset >= US(us)->size) {
+        b->state = BLOCK_EMPTY;
+        return;
+    }
+    b->offset = US(us)->next_offset;
+    b->expected = US(us)->size - b->offset;
+    if (b->expected > US(us)->block_size) {
+        b->expected = US(us)->block_size;
+    }
+    US(us)->next_offset += US(us)->block_size;
+
+#ifdef HAVE_IO_URING
+    if (US(us)->ring_fd >= 0) {
+        if (_us_submit(us, i) != 0) {
+            b->filled = -1;
+            b->state = BLOCK_READY;
+        }
+        return;
+    }
+#endif
+    // Read synchronously, when the block is needed.
+    b->state = BLOCK_IN_FLIGHT;
+}
+
+/*
+ *  int _us_wait_block(void *us, int i)
+ *
+ *  Wait for blocks[i] to be filled.  Returns 0 on success, or -1 on error.
+ */
+
+static
+int _us_wait_block(void *us, int i)
+{
+    uring_block *b = &(US(us)->blocks[i]);
+
+#ifdef HAVE_IO_URING
+    if (US(us)->ring_fd >= 0) {
+        while (b->state == BLOCK_IN_FLIGHT) {
+            if (_us_reap(us, true) != 0) {
+                return -1;
+            }
+        }
+        return b->filled < 0 ? -1 : 0;
+    }
+#endif
+    while (b->state == BLOCK_IN_FLIGHT) {
+        ssize_t res;
+        res = pread(US(us)->fd, b->data + b->filled,
+                    US(us)->block_size - b->filled, b->offset + b->filled);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            b->filled = -1;
+            b->state = BLOCK_READY;
+        }
+        else {
+            b->filled += res;
+            if (res == 0 || b->filled >= (long int) b->expected) {
+                b->state = BLOCK_READY;
+            }
+        }
+    }
+    return b->filled < 0 ? -1 : 0;
+}
+
+
+/*
+ *  long int us_read(void *us, uint8_t *buf, size_t n)
+ *
+ *  Copy at most n bytes from the block at the head of the ring to buf.
+ *  When the block has been copied completely, it is reused for the next
+ *  offset of the file that is not in the ring yet.
+ */
+
+static
+long int us_read(void *us, uint8_t *buf, size_t n)
+{
+    int i = US(us)->head;
+    uring_block *b = &(US(us)->blocks[i]);
+    long int k;
+
+    if (b->state == BLOCK_EMPTY) {
+        return 0;
+    }
+    if (_us_wait_block(us, i) != 0) {
+        return -1;
+    }
+
+    k = b->filled - b->pos;
+    if (k == 0) {
+        // The file was truncated while it was being read.
+        return 0;
+    }
+    if ((size_t) k > n) {
+        k = n;
+    }
+    memcpy(buf, b->data + b->pos, k);
+    b->pos += k;
+
+    if (b->pos == b->filled) {
+        hints_file_consumed(US(us)->fd, US(us)->hints, &(US(us)->dropped),
+                            b->offset + b->filled);
+        _us_start_block(us, i);
+        US(us)->head = (i + 1) % US(us)->num_blocks;
+    }
+    return k;
+}
+
+/*
+ *  int us_seek(void *us, long int pos)
+ *
+ *  Restart reading at pos.  The blocks stay aligned to the block size
+ *  (as required for O_DIRECT), so the first block skips pos % block_size
+ *  bytes.
+ */
+
+static
+int us_seek(void *us, long int pos)
+{
+    int i;
+
+    if (pos < 0) {
+        return -1;
+    }
+#ifdef HAVE_IO_URING
+    _us_drain(us);
+#endif
+    US(us)->head = 0;
+    US(us)->next_offset = pos - pos % US(us)->block_size;
+    for (i = 0; i < US(us)->num_blocks; ++i) {
+        _us_start_block(us, i);
+    }
+    if (US(us)->blocks[0].state != BLOCK_EMPTY) {
+        if (_us_wait_block(us, 0) != 0) {
+            return -1;
+        }
+        US(us)->blocks[0].pos = pos % US(us)->block_size;
+        if (US(us)->blocks[0].pos > US(us)->blocks[0].filled) {
+            US(us)->blocks[0].pos = US(us)->blocks[0].filled;
+        }
+    }
+    return 0;
+}
+
+static
+void us_close(void *us, int restore, long int pos)
+{
+    int i;
+
+#ifdef HAVE_IO_URING
+    _us_drain(us);
+    _us_ring_free(us);
+#endif
+    for (i = 0; i < US(us)->num_blocks; ++i) {
+        free(US(us)->blocks[i].data);
+    }
+    free(US(us)->blocks);
+    if (US(us)->fd >= 0) {
+        close(US(us)->fd);
+    }
+    free(us);
+}
+
+
+stream *stream_uring_from_filename(char *filename, int buffer_size,
+                                   int encoding, int depth, bool direct,
+                                   int hints)
+{
+    uring_source *us;
+    buffered_source source;
+    stream *strm;
+    struct stat st;
+    int fd = -1;
+    int i;
+
+    if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    if (direct) {
+        fd = open(filename, O_RDONLY | O_DIRECT);
+    }
+    if (fd == -1) {
+        fd = open(filename, O_RDONLY);
+        if (fd == -1) {
+            return NULL;
+        }
+    }
+
+    us = (uring_source *) calloc(1, sizeof(uring_source));
+    if (us == NULL) {
+        close(fd);
+        return NULL;
+    }
+    us->fd = fd;
+    us->size = st.st_size;
+    us->hints = hints;
+    hints_file_start(fd, hints);
+    if (depth < 1) {
+        depth = 1;
+    }
+    us->num_blocks = depth;
+    // The blocks must be a multiple of the O_DIRECT alignment.
+    us->block_size = buffer_size - buffer_size % DIRECT_ALIGNMENT;
+    if (us->block_size == 0) {
+        us->block_size = DIRECT_ALIGNMENT;
+    }
+#ifdef HAVE_IO_URING
+    us->ring_fd = -1;
+#endif
+    us->blocks = (uring_block *) calloc(depth, sizeof(uring_block));
+    if (us->blocks == NULL) {
+        us_close(us, RESTORE_NOT, 0);
+        return NULL;
+    }
+    for (i = 0; i < depth; ++i) {
+        if (posix_memalign((void **) &(us->blocks[i].data), DIRECT_ALIGNMENT,
+                           us->block_size) != 0) {
+            us->blocks[i].data = NULL;
+            us_close(us, RESTORE_NOT, 0);
+            return NULL;
+        }
+    }
+
+#ifdef HAVE_IO_URING
+    // If this fails, ring_fd stays -1, and pread() is used.
+    _us_ring_init(us);
+#endif
+    if (us_seek(us, 0) != 0) {
+        us_close(us, RESTORE_NOT, 0);
+        return NULL;
+    }
+
+    source.data = (void *) us;
+    source.read = &us_read;
+    source.seek = &us_seek;
+    source.close = &us_close;
+
+    strm = stream_buffered(&source, buffer_size, encoding, 0, hints);
+    if (strm == NULL) {
+        us_close(us, RESTORE_NOT, 0);
+    }
+    return strm;
+}
@@ -0,0 +1,12 @@
+#ifndef STREAM_URING_H
+#define STREAM_URING_H
+
+#include <stdbool.h>
+
+#include "stream.h"
+
+stream *stream_uring_from_filename(char *filename, int buffer_size,
+                                   int encoding, int depth, bool direct,
+                                   int hints);
+
+#endif
@@ -0,0 +1,215 @@
+//
+// stream_xz.c
+//
+// The public function defined in this file is
+//
+//     stream *stream_xz_from_filename(char *filename, int buffer_size,
+//                                     int encoding, int readahead,
+//                                     int hints)
+//
+// If the file with the given name starts with the xz magic bytes, the
+// function creates a stream that decompresses the file with liblzma
+// directly into the stream's buffer (see stream_buffered.c).  `encoding`
+// is one of the ENCODING_* constants defined in encoding.h.  Concatenated
+// xz streams are read as one file.
+//
+// NULL is returned if the file can not be opened, if it is not a regular
+// file that starts with the xz magic bytes, or if the memory allocation
+// fails.  (The legacy .lzma format has no magic number, so it is not
+// recognized.)
+//
+// This file is only compiled if liblzma is available (see setup.py).
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/stat.h>
+
+#include <lzma.h>
+
+#include "stream.h"
+#include "stream_buffered.h"
+#include "hints.h"
+
+#define INPUT_BUFFER_SIZE 1048576
+
+static const uint8_t xz_magic[6] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+
+
+typedef struct _xz_source {
+
+    /* The compressed file. */
+    FILE *file;
+
+    /* liblzma state. */
+    lzma_stream ls;
+
+    /* Boolean: has the end of the compressed file been reached? */
+    bool input_eof;
+
+    /* Boolean: has liblzma returned LZMA_STREAM_END? */
+    bool output_eof;
+
+    /* HINT_* flags, and the offset up to which pages have been dropped. */
+    int hints;
+    long int dropped;
+
+    /* Buffer holding compressed data read from the file. */
+    uint8_t *input;
+
+} xz_source;
+
+#define XS(xs)  ((xz_source *)xs)
+
+
+static
+int _xs_init_decoder(void *xs)
+{
+    // LZMA_CONCATENATED: decode all the xz streams in the file, and
+    // only report LZMA_STREAM_END when LZMA_FINISH is given.
+    return lzma_stream_decoder(&(XS(xs)->ls), UINT64_MAX,
+                               LZMA_CONCATENATED) == LZMA_OK ? 0 : -1;
+}
+
+
+/*
+ *  long int xs_read(void *xs, uint8_t *buf, size_t n)
+ *
+ *  Decompress at most n bytes into buf.  Returns the number of bytes
+ *  decompressed, 0 at the end of the data, or -1 on error (including
+ *  corrupt or truncated compressed data).
+ */
+
+static
+long int xs_read(void *xs, uint8_t *buf, size_t n)
+{
+    lzma_stream *ls = &(XS(xs)->ls);
+
+    if (XS(xs)->output_eof) {
+        return 0;
+    }
+    ls->next_out = buf;
+    ls->avail_out = n;
+
+    while (ls->avail_out == n) {
+        lzma_ret status;
+
+        if (ls->avail_in == 0 && !XS(xs)->input_eof) {
+            size_t num_read;
+            num_read = fread(XS(xs)->input, 1, INPUT_BUFFER_SIZE, XS(xs)->file);
+            if (num_read < INPUT_BUFFER_SIZE) {
+                if (ferror(XS(xs)->file)) {
+                    return -1;
+                }
+                XS(xs)->input_eof = true;
+            }
+            hints_file_consumed(fileno(XS(xs)->file), XS(xs)->hints,
+                                &(XS(xs)->dropped), ftell(XS(xs)->file));
+            ls->next_in = XS(xs)->input;
+            ls->avail_in = num_read;
+        }
+
+        status = lzma_code(ls, XS(xs)->input_eof ? LZMA_FINISH : LZMA_RUN);
+        if (status == LZMA_STREAM_END) {
+            XS(xs)->output_eof = true;
+            break;
+        }
+        if (status != LZMA_OK) {
+            // LZMA_BUF_ERROR here means the file is truncated.
+            return -1;
+        }
+    }
+    return n - ls->avail_out;
+}
+
+static
+int xs_seek(void *xs, long int pos)
+{
+    if (pos != 0 || fseek(XS(xs)->file, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+    // liblzma has no reset function; a new decoder reuses the allocation.
+    if (_xs_init_decoder(xs) != 0) {
+        return -1;
+    }
+    XS(xs)->ls.avail_in = 0;
+    XS(xs)->input_eof = false;
+    XS(xs)->output_eof = false;
+    return 0;
+}
+
+static
+void xs_close(void *xs, int restore, long int pos)
+{
+    lzma_end(&(XS(xs)->ls));
+    fclose(XS(xs)->file);
+    free(XS(xs)->input);
+    free(xs);
+}
+
+
+stream *stream_xz_from_filename(char *filename, int buffer_size,
+                                int encoding, int readahead, int hints)
+{
+    xz_source *xs;
+    buffered_source source;
+    stream *strm;
+    FILE *fp;
+    uint8_t magic[sizeof(xz_magic)];
+    struct stat st;
+    lzma_stream ls_init = LZMA_STREAM_INIT;
+
+    if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+            memcmp(magic, xz_magic, sizeof(magic)) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    rewind(fp);
+    hints_file_start(fileno(fp), hints);
+
+    xs = (xz_source *) malloc(sizeof(xz_source));
+    if (xs == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    xs->input = malloc(INPUT_BUFFER_SIZE);
+    if (xs->input == NULL) {
+        free(xs);
+        fclose(fp);
+        return NULL;
+    }
+    xs->file = fp;
+    xs->input_eof = false;
+    xs->output_eof = false;
+    xs->hints = hints;
+    xs->dropped = 0;
+
+    xs->ls = ls_init;
+    if (_xs_init_decoder(xs) != 0) {
+        xs_close(xs, RESTORE_NOT, 0);
+        return NULL;
+    }
+
+    source.data = (void *) xs;
+    source.read = &xs_read;
+    source.seek = &xs_seek;
+    source.close = &xs_close;
+
+    strm = stream_buffered(&source, buffer_size, encoding, readahead,
+                           hints);
+    if (strm == NULL) {
+        xs_close(xs, RESTORE_NOT, 0);
+    }
+    return strm;
+}
@@ -0,0 +1,9 @@
+#ifndef STREAM_XZ_H
+#define STREAM_XZ_H
+
+#include "stream.h"
+
+stream *stream_xz_from_filename(char *filename, int buffer_size,
+                                int encoding, int readahead, int hints);
+
+#endif
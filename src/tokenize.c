@@ -1,6 +1,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include "typedefs.h"
@@ -10,6 +13,8 @@
 #include "tokenize.h"
 #include "error_types.h"
 #include "parser_config.h"
+#include "scan.h"
+#include "char32utils.h"
 
 
 /* Tokenization state machine states. */
@@ -18,7 +23,642 @@
 #define TOKENIZE_QUOTED     2
 #define TOKENIZE_WHITESPACE 3
 
-#define ISCOMMENT(c, s, c0, c1) ((c == c0) && ((c1 == 0) || (stream_peek(s) == c1)))
+// For the functions that grow the token index: they are called rarely, and
+// inlined, they make the tokenizer loops slower.  ALWAYS_INLINE is for the
+// generic tokenizer, which is only used through its specialized variants.
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define NOINLINE
+#define ALWAYS_INLINE inline
+#endif
+
+#define ISCOMMENT(c, r, c0, c1) ((c == c0) && ((c1 == 0) || (reader_peek(r) == c1)))
+
+#define ISBLANK(c) ((c) == ' ' || (c) == '\t')
+
+/*
+ *  Variants of tokenize_sep().  Each one is compiled separately, with the
+ *  tests for the features it doesn't have removed; tokenize() uses the one
+ *  chosen for the parser_config by token_index_init().
+ */
+#define TOK_QUOTE       1   /* Quoted fields. */
+#define TOK_COMMENT     2   /* A one character comment. */
+#define TOK_COMMENT2    4   /* A one or two character comment. */
+#define TOK_SPACES      8   /* ignore_leading_spaces, ignore_trailing_spaces. */
+#define TOK_CSV        16   /* The delimiter is ',' and the quote is '"'. */
+#define TOK_BLANKS     32   /* Runs of blanks separate the fields (only
+                               for skip_row(), from tokenize_ws_row()). */
+#define TOK_WS         64   /* The whitespace-delimited tokenizer. */
+
+/* All of the features, for any parser_config. */
+#define TOK_GENERAL    (TOK_QUOTE | TOK_COMMENT2 | TOK_SPACES)
+
+#define IS_COMMENT_VARIANT(c, r, c0, c1, variant)                  \
+    (((variant) & TOK_COMMENT2) ? ISCOMMENT(c, r, c0, c1) :         \
+     ((variant) & TOK_COMMENT) ? ((c) == (c0)) : false)
+
+
+/*
+ *  The fields of the row being tokenized.
+ *
+ *  A field is used in place, i.e. it points into the stream's span, as
+ *  long as its characters are exactly the bytes read from the span: an
+ *  unquoted field, or the inside of a quoted field without doubled quotes.
+ *  When that is no longer the case (the next character does not directly
+ *  follow the field in the span, e.g. after a doubled or closing quote,
+ *  or it was read from the stream itself), the field is copied into the
+ *  word buffer, and the rest of it is stored there.
+ *
+ *  The span is only valid until the stream is used directly, which the
+ *  span_reader does when it needs more data or a character decoded (see
+ *  reader_release()).  Before that, row_materialize() copies the fields
+ *  of the row that are still in the span into the word buffer.
+ */
+
+typedef struct _row_fields {
+    /* The caller's token index, and its array. */
+    token_index *tokens;
+    field_span *fields;
+    int num_fields;
+
+    /* The first field of the current row (the rows of a batch follow each
+       other in the array). */
+    int row_start;
+
+    /* The fields before this one are all in the word buffer. */
+    int first_in_span;
+
+    uint8_t *word_buffer;
+    uint8_t *word_buffer_end;
+
+    /*
+     *  The current field is [span_start, span_end) if in_span is true
+     *  (the span is empty, and both are NULL, until the first character is
+     *  stored), and [word_start, word_end) otherwise.  word_end is where
+     *  the next byte is stored in the word buffer.
+     */
+    bool in_span;
+    const uint8_t *span_start;
+    const uint8_t *span_end;
+    uint8_t *word_start;
+    uint8_t *word_end;
+
+    /* 0, or ERROR_OUT_OF_MEMORY if the word buffer could not be grown. */
+    int error;
+} row_fields;
+
+
+static void
+row_init(row_fields *rf, token_index *tokens)
+{
+    rf->tokens = tokens;
+    rf->fields = tokens->fields;
+    rf->num_fields = 0;
+    rf->row_start = 0;
+    rf->first_in_span = 0;
+    rf->word_buffer = tokens->word_buffer;
+    rf->word_buffer_end = tokens->word_buffer + tokens->word_buffer_size;
+    rf->in_span = false;
+    rf->word_start = rf->word_buffer;
+    rf->word_end = rf->word_buffer;
+    rf->error = 0;
+}
+
+/*
+ *  Start the next row, after the fields of the previous rows of the batch.
+ */
+static inline void
+row_begin(row_fields *rf)
+{
+    rf->row_start = rf->num_fields;
+    rf->in_span = false;
+    rf->word_start = rf->word_end;
+}
+
+/*
+ *  Make room in the token index for at least one more field.
+ *
+ *  Returns 0 or ERROR_OUT_OF_MEMORY.
+ */
+static NOINLINE int
+row_grow(row_fields *rf)
+{
+    token_index *tokens = rf->tokens;
+    int capacity;
+    field_span *fields;
+
+    if (tokens->capacity > INT_MAX / 2) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    capacity = (tokens->capacity == 0) ? INITIAL_NUM_FIELDS
+                                       : 2*tokens->capacity;
+    fields = realloc(tokens->fields, capacity * sizeof(field_span));
+    if (fields == NULL) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    tokens->fields = fields;
+    tokens->capacity = capacity;
+    rf->fields = fields;
+    return 0;
+}
+
+/*
+ *  Make room in the word buffer for at least n more bytes.  The buffer is
+ *  reallocated, so the fields of the row that are in it are moved too.
+ *
+ *  Returns 0 or ERROR_OUT_OF_MEMORY.
+ */
+static NOINLINE int
+row_reserve(row_fields *rf, size_t n)
+{
+    token_index *tokens = rf->tokens;
+    uintptr_t old = (uintptr_t) rf->word_buffer;
+    size_t used = rf->word_end - rf->word_buffer;
+    size_t size;
+    uint8_t *buffer;
+
+    if ((size_t) (rf->word_buffer_end - rf->word_end) >= n) {
+        return 0;
+    }
+    if (n > SIZE_MAX / 2 - used) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    size = (tokens->word_buffer_size == 0) ? INITIAL_WORD_BUFFER_SIZE
+                                           : 2*tokens->word_buffer_size;
+    if (size < used + n) {
+        size = used + n;
+    }
+    buffer = realloc(tokens->word_buffer, size);
+    if (buffer == NULL) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    tokens->word_buffer = buffer;
+    tokens->word_buffer_size = size;
+
+    for (int k = 0; k < rf->num_fields; ++k) {
+        field_span *f = &rf->fields[k];
+        if ((uintptr_t) f->p - old <= used) {
+            f->p = buffer + ((uintptr_t) f->p - old);
+        }
+    }
+    rf->word_start = buffer + (rf->word_start - rf->word_buffer);
+    rf->word_end = buffer + used;
+    rf->word_buffer = buffer;
+    rf->word_buffer_end = buffer + size;
+    return 0;
+}
+
+/*
+ *  Copy the n bytes at p to the end of the word buffer, and return where
+ *  they were stored.
+ */
+static uint8_t *
+row_copy(row_fields *rf, const uint8_t *p, size_t n)
+{
+    uint8_t *dst;
+
+    if (row_reserve(rf, n) != 0) {
+        rf->error = ERROR_OUT_OF_MEMORY;
+        return rf->word_end;
+    }
+    dst = rf->word_end;
+    memcpy(dst, p, n);
+    rf->word_end += n;
+    return dst;
+}
+
+/*
+ *  Copy the finished fields of the row that are in the span into the word
+ *  buffer.  The fields that are not needed (see token_index_project()) are
+ *  not copied, but emptied.
+ */
+static void
+row_copy_span_fields(row_fields *rf)
+{
+    const bool *needed = rf->tokens->needed;
+
+    for (int k = rf->first_in_span; k < rf->num_fields; ++k) {
+        field_span *f = &rf->fields[k];
+        // (The fields of the previous rows of a batch are simply copied.)
+        if (needed != NULL && k >= rf->row_start && !needed[k - rf->row_start]) {
+            f->p = rf->word_end;
+            f->len = 0;
+        }
+        // (row_copy() may move the buffer.)
+        else if ((uintptr_t) f->p - (uintptr_t) rf->word_buffer >
+                    (uintptr_t) (rf->word_end - rf->word_buffer)) {
+            f->p = row_copy(rf, f->p, f->len);
+        }
+    }
+    rf->first_in_span = rf->num_fields;
+}
+
+/*
+ *  Move the current field from the span into the word buffer.  The fields
+ *  before it are copied first, so that the word buffer holds them in order
+ *  and the current field is at its end, where the rest of it is stored.
+ */
+static void
+field_to_word_buffer(row_fields *rf)
+{
+    row_copy_span_fields(rf);
+    rf->in_span = false;
+    rf->word_start = rf->word_end;
+    if (rf->span_end != rf->span_start) {
+        row_copy(rf, rf->span_start, rf->span_end - rf->span_start);
+    }
+}
+
+/*
+ *  Copy every field of the row that is in the span, including the
+ *  current one, into the word buffer.
+ */
+static void
+row_materialize(row_fields *rf)
+{
+    const bool *needed = rf->tokens->needed;
+
+    row_copy_span_fields(rf);
+    if (rf->in_span && rf->span_end != rf->span_start) {
+        int col = rf->num_fields - rf->row_start;
+        if (needed != NULL && (col >= rf->tokens->max_fields || !needed[col])) {
+            // The field isn't used, so it isn't copied (the rest of it is
+            // stored, or skipped by skip_row()).
+            rf->in_span = false;
+            rf->word_start = rf->word_end;
+        }
+        else {
+            field_to_word_buffer(rf);
+        }
+    }
+}
+
+/*
+ *  Start a field.  Where it starts in the span is decided by its first
+ *  stored character (see field_store()).
+ */
+static inline void
+field_begin(row_fields *rf)
+{
+    rf->in_span = true;
+    rf->span_start = NULL;
+    rf->span_end = NULL;
+}
+
+/*
+ *  End the current field, without its last `trailing` bytes.
+ */
+static inline void
+field_end(row_fields *rf, size_t trailing)
+{
+    field_span *f = &rf->fields[rf->num_fields];
+
+    if (rf->in_span) {
+        // (An empty field has no position in the span.)
+        f->p = (rf->span_start != NULL) ? rf->span_start : rf->word_end;
+        f->len = (rf->span_end - rf->span_start) - trailing;
+    }
+    else {
+        rf->word_end -= trailing;
+        f->p = rf->word_start;
+        f->len = rf->word_end - rf->word_start;
+    }
+    ++rf->num_fields;
+}
+
+
+/*
+ *  The tokenizers read the stream through a span_reader.  When the stream
+ *  supports bulk access (stream_span and stream_advance), the reader works
+ *  directly on the bytes in the stream's buffer, and only calls back into
+ *  the stream when the span is used up, or when a character needs more
+ *  than a simple byte lookup (a non-ASCII byte, which the stream might have
+ *  to decode, or a '\r' at the end of the span).  Streams that don't
+ *  support bulk access are read with stream_fetch and stream_peek.
+ *
+ *  The bytes consumed from the span are handed back to the stream with
+ *  reader_commit(); that must be done before the stream is used directly
+ *  (e.g. stream_skipline), and before the tokenizer returns.  Before the
+ *  stream is used, the row's fields are materialized (reader_release()).
+ *
+ *  If the stream reports an error (STREAM_ERROR or STREAM_DECODE_ERROR),
+ *  the reader saves it in `error` and returns STREAM_EOF, so the state
+ *  machine ends the row; the tokenizer checks `error` afterwards.
+ */
+
+typedef struct _span_reader {
+    stream *s;
+
+    /* Start of the bytes that have not yet been committed. */
+    const uint8_t *start;
+
+    /* Next byte to read. */
+    const uint8_t *p;
+
+    /* End of the span. */
+    const uint8_t *end;
+
+    /* Number of '\n' characters between start and p. */
+    int num_newlines;
+
+    /* 0, or the error returned by the stream. */
+    char32_t error;
+
+    /* The row whose fields must be copied before the stream is used. */
+    row_fields *rf;
+} span_reader;
+
+
+static inline void
+reader_commit(span_reader *r)
+{
+    if (r->p != r->start) {
+        stream_advance(r->s, r->p - r->start, r->num_newlines);
+        r->start = r->p;
+        r->num_newlines = 0;
+    }
+}
+
+/*
+ *  Get a new span from the stream.  Any bytes consumed from the
+ *  current span must have been committed.
+ */
+static inline void
+reader_respan(span_reader *r)
+{
+    const uint8_t *p = NULL;
+    long int n = 0;
+
+    if (r->s->stream_span != NULL) {
+        n = stream_span(r->s, &p);
+        if (n < 0) {
+            // Leave the error to be reported by stream_fetch.
+            p = NULL;
+            n = 0;
+        }
+    }
+    r->start = p;
+    r->p = p;
+    r->end = (p != NULL) ? p + n : NULL;
+    r->num_newlines = 0;
+}
+
+static inline void
+reader_init(span_reader *r, stream *s, row_fields *rf)
+{
+    r->s = s;
+    r->error = 0;
+    r->rf = rf;
+    reader_respan(r);
+}
+
+/*
+ *  Commit the consumed bytes before the stream is used directly, which
+ *  might reuse its buffer.
+ */
+static inline void
+reader_release(span_reader *r)
+{
+    row_materialize(r->rf);
+    reader_commit(r);
+}
+
+/*
+ *  Convert the error seen by the reader (if any) to a tokenizer error type.
+ */
+static inline int
+reader_error_type(span_reader *r)
+{
+    if (r->error == 0) {
+        return 0;
+    }
+    return (r->error == STREAM_DECODE_ERROR) ? ERROR_DECODING : ERROR_STREAM;
+}
+
+static char32_t
+reader_fetch_slow(span_reader *r)
+{
+    char32_t c;
+
+    reader_release(r);
+    c = stream_fetch(r->s);
+    if (c == STREAM_ERROR || c == STREAM_DECODE_ERROR) {
+        r->error = c;
+        c = STREAM_EOF;
+    }
+    reader_respan(r);
+    return c;
+}
+
+static char32_t
+reader_peek_slow(span_reader *r)
+{
+    char32_t c;
+
+    reader_release(r);
+    c = stream_peek(r->s);
+    reader_respan(r);
+    return c;
+}
+
+/*
+ *  Equivalent to stream_fetch(r->s): "\r\n" is returned as '\n'.
+ */
+static inline char32_t
+reader_fetch(span_reader *r)
+{
+    const uint8_t *p = r->p;
+
+    if (p + 1 < r->end && *p < 0x80) {
+        char32_t c = *p;
+        if (c == '\r' && p[1] == '\n') {
+            c = '\n';
+            ++p;
+        }
+        r->p = p + 1;
+        if (c == '\n') {
+            ++r->num_newlines;
+        }
+        return c;
+    }
+    return reader_fetch_slow(r);
+}
+
+/*
+ *  Equivalent to stream_peek(r->s).
+ */
+static inline char32_t
+reader_peek(span_reader *r)
+{
+    const uint8_t *p = r->p;
+
+    if (p + 1 < r->end && *p < 0x80) {
+        if (*p == '\r' && p[1] == '\n') {
+            return '\n';
+        }
+        return *p;
+    }
+    return reader_peek_slow(r);
+}
+
+/*
+ *  Skip the rest of the line (a comment).  The newline is looked for in
+ *  the span first, so a comment line costs one memchr().
+ */
+static void
+reader_skipline(span_reader *r)
+{
+    if (r->p != NULL) {
+        const uint8_t *nl = memchr(r->p, '\n', r->end - r->p);
+        if (nl != NULL) {
+            r->p = nl + 1;
+            ++r->num_newlines;
+            return;
+        }
+    }
+    reader_release(r);
+    stream_skipline(r->s);
+    reader_respan(r);
+}
+
+/*
+ *  Store the character c in the word buffer at p, encoded as UTF-8, and
+ *  return the position after it.
+ */
+static inline uint8_t *
+word_store(uint8_t *p, char32_t c)
+{
+    if (c < 0x80) {
+        *p = (uint8_t) c;
+        return p + 1;
+    }
+    return p + utf8_encode(c, p);
+}
+
+/*
+ *  Store the character c, which was just read from r, in the current field.
+ */
+static inline void
+field_store(row_fields *rf, span_reader *r, char32_t c)
+{
+    if (rf->in_span) {
+        // r->p > r->start iff c was read from the span, at r->p - 1.
+        if (r->p > r->start) {
+            if (rf->span_end == r->p - 1) {
+                ++rf->span_end;
+                return;
+            }
+            if (rf->span_end == rf->span_start) {
+                rf->span_start = r->p - 1;
+                rf->span_end = r->p;
+                return;
+            }
+        }
+        field_to_word_buffer(rf);
+    }
+    rf->word_end = word_store(rf->word_end, c);
+}
+
+/*
+ *  Consume the plain bytes (see scan_copy()) that follow the character that
+ *  was just stored in the current field: the field's span is extended over
+ *  them, or they are copied to the word buffer.  Returns their number; the
+ *  caller advances r->p past them.
+ */
+static inline size_t
+field_scan(row_fields *rf, span_reader *r, const scan_set *set)
+{
+    size_t k;
+
+    if (rf->in_span && rf->span_end == r->p) {
+        k = scan_skip(set, r->p, r->end);
+        rf->span_end += k;
+    }
+    else {
+        k = scan_copy(set, r->p, r->end, rf->word_end,
+                      rf->word_buffer_end - rf->word_end);
+        rf->word_end += k;
+    }
+    return k;
+}
+
+/*
+ *  Skip the rest of the row, from the start of a field, without storing
+ *  its fields; they are not needed (see token_index_project()).
+ *
+ *  If the rest of the line is in the span and has no quote character, the
+ *  row ends at the next '\n', found with memchr().  Otherwise the fields
+ *  are parsed, with the rules of the tokenizer (given by `variant`), up to
+ *  the end of the row, which is on a later line if a quoted field has a
+ *  newline.
+ */
+static NOINLINE void
+skip_row(span_reader *r, token_index *tokens, parser_config *pconfig,
+         const int variant)
+{
+    char32_t cc0 = pconfig->comment[0];
+    char32_t cc1 = pconfig->comment[1];
+    char32_t sep_char = (variant & TOK_CSV) ? ',' : pconfig->delimiter;
+    char32_t quote_char = (variant & TOK_CSV) ? '"' : pconfig->quote;
+    bool ignore_leading_spaces = (variant & TOK_SPACES) &&
+                                 pconfig->ignore_leading_spaces;
+    bool allow_embedded_newline = pconfig->allow_embedded_newline;
+    int state = TOKENIZE_INIT;
+
+    if (r->p != NULL && (!(variant & TOK_QUOTE) || quote_char < 0x80)) {
+        const uint8_t *nl = memchr(r->p, '\n', r->end - r->p);
+        if (nl != NULL && (!(variant & TOK_QUOTE) ||
+                           memchr(r->p, (int) quote_char, nl - r->p) == NULL)) {
+            r->p = nl + 1;
+            ++r->num_newlines;
+            return;
+        }
+    }
+
+    while (true) {
+        char32_t c = reader_fetch(r);
+
+        if (state == TOKENIZE_QUOTED) {
+            if (c == quote_char) {
+                if (reader_peek(r) == quote_char) {
+                    reader_fetch(r);
+                }
+                else {
+                    state = TOKENIZE_UNQUOTED;
+                }
+            }
+            else if (c == STREAM_EOF || (c == '\n' && !allow_embedded_newline)) {
+                return;
+            }
+            else {
+                r->p += scan_skip(&tokens->quoted_set, r->p, r->end);
+            }
+        }
+        else if (c == '\n' || c == STREAM_EOF) {
+            return;
+        }
+        else if (IS_COMMENT_VARIANT(c, r, cc0, cc1, variant)) {
+            reader_skipline(r);
+            return;
+        }
+        else if ((variant & TOK_BLANKS) ? ISBLANK(c) : (c == sep_char)) {
+            state = TOKENIZE_INIT;
+        }
+        else if ((variant & TOK_QUOTE) && state == TOKENIZE_INIT &&
+                    c == quote_char) {
+            state = TOKENIZE_QUOTED;
+        }
+        else if (state == TOKENIZE_INIT && ignore_leading_spaces && c == ' ') {
+            // A leading space.
+        }
+        else {
+            state = TOKENIZE_UNQUOTED;
+            r->p += scan_skip(&tokens->set, r->p, r->end);
+        }
+    }
+}
 
 /*
     How parsing quoted fields works:
@@ -51,15 +691,20 @@
 /*
  *  tokenize a row of input, with an explicit field delimiter char (sep_char).
  *
- *  word_buffer must point to a block of memory with length word_buffer_size.
- *
- *  The fields are stored in word_buffer, and words is an array of
- *  pointers to the starts of the words parsed so far.
+ *  The fields are returned as (pointer, length) spans of UTF-8 bytes
+ *  (whatever the encoding of the stream); they are not nul-terminated.
+ *  A field points directly into the stream's buffer when its bytes are
+ *  there as they are; otherwise (doubled quotes, characters decoded by the
+ *  stream, or a field split across two reads) it is copied to the word
+ *  buffer of *tokens.
+ *  See row_fields.  The spans are valid until the stream is used again.
  *
  *  pconfig is in input; *pconfig is a parser_config instance.
  *
- *  Returns an array of char*.  Points to memory malloc'ed here so it
- *  must be freed by the caller.
+ *  The fields are stored in *tokens, whose arrays are grown as needed (there
+ *  is no limit on the number of fields or on the length of a row), and
+ *  tokens->fields is returned.  The array belongs to *tokens; the caller
+ *  does not free it, and it is overwritten by the next call.
  *
  *  *p_num_fields and *p_error_type are outputs.
  *  *p_num_fields is the number of fields (i.e. number of tokens) that
@@ -68,104 +713,102 @@
  *
  *  Returns NULL for several different conditions:
  *  * Reached EOF before finding *any* data to parse.
- *  * The amount of text copied to word_buffer exceeded the buffer size.
  *  * Failed to parse a single field. This is the condition field_number == 0
  *    that is checked after the main loop.  To do: double check exactly what
  *    can lead to this condition.
- *  * Out of memory: could not allocate the memory to hold the array of
- *    char pointer that the function returns.
- *  * The row has more fields than MAX_NUM_COLUMNS.
+ *  * Out of memory: could not grow the token index.
+ *
+ *  Once an unquoted field has started, the rest of its plain ASCII
+ *  characters (up to the next delimiter, quote, comment, newline or
+ *  non-ASCII byte) are consumed in bulk from the stream's buffer with
+ *  scan_skip() (or scan_copy(), if the field is in the word buffer), and only
+ *  the character that ends the run goes through the state machine.
  */
 
-static char32_t **tokenize_sep(stream *s, char32_t *word_buffer,
-                               int word_buffer_size,
-                               parser_config *pconfig,
-                               int *p_num_fields,
-                               int *p_error_type)
+static ALWAYS_INLINE int
+tokenize_sep_row(row_fields *rf, span_reader *r, token_index *tokens,
+                 parser_config *pconfig, const int variant)
 {
-    int n;
     char32_t c;
     int state;
-    char32_t *words[MAX_NUM_COLUMNS];
-    char32_t *p_word_start, *p_word_end;
-    int field_number;
-    char32_t **result;
+    int error = 0;
 
     char32_t cc0 = pconfig->comment[0];
     char32_t cc1 = pconfig->comment[1];
-    char32_t sep_char = pconfig->delimiter;
-    char32_t quote_char = pconfig->quote;
-    bool ignore_leading_spaces = pconfig->ignore_leading_spaces;
-    bool ignore_trailing_spaces = pconfig->ignore_trailing_spaces;
+    char32_t sep_char = (variant & TOK_CSV) ? ',' : pconfig->delimiter;
+    char32_t quote_char = (variant & TOK_CSV) ? '"' : pconfig->quote;
+    bool ignore_leading_spaces = (variant & TOK_SPACES) &&
+                                 pconfig->ignore_leading_spaces;
+    bool ignore_trailing_spaces = (variant & TOK_SPACES) &&
+                                  pconfig->ignore_trailing_spaces;
     bool allow_embedded_newline = pconfig->allow_embedded_newline;
     int trailing_space_count = 0;
     bool havec;
+    const scan_set *set = &tokens->set;
+    const scan_set *quoted_set = &tokens->quoted_set;
 
-    *p_error_type = 0;
+    row_begin(rf);
 
     havec = true;
-    c = stream_fetch(s);
-    while (ISCOMMENT(c, s, cc0, cc1)) {
-        stream_skipline(s);
-        c = stream_fetch(s);
+    c = reader_fetch(r);
+    while (IS_COMMENT_VARIANT(c, r, cc0, cc1, variant)) {
+        reader_skipline(r);
+        c = reader_fetch(r);
     }
 
     if (c == STREAM_EOF) {
-        *p_error_type = ERROR_NO_DATA;
-        return NULL;
+        return r->error ? reader_error_type(r) : ERROR_NO_DATA;
     }
 
     state = TOKENIZE_INIT;
-    field_number = 0;
-    p_word_start = word_buffer;
-    p_word_end = p_word_start;
+    field_begin(rf);
 
     while (true) {
-        if ((p_word_end - word_buffer) >= word_buffer_size) {
-            *p_error_type = ERROR_TOO_MANY_CHARS;
+        // There must be room for one more character and one more field.
+        if (rf->word_buffer_end - rf->word_end < UTF8_MAX_LEN &&
+                (error = row_reserve(rf, UTF8_MAX_LEN)) != 0) {
             break;
         }
-        if (field_number >= MAX_NUM_COLUMNS) {
-            *p_error_type = ERROR_TOO_MANY_FIELDS;
+        if (rf->num_fields == rf->tokens->capacity &&
+                (error = row_grow(rf)) != 0) {
             break;
         }
         if (!havec) {
-            c = stream_fetch(s);
+            c = reader_fetch(r);
         }
         else {
             havec = false;
         }
         if (state == TOKENIZE_INIT || state == TOKENIZE_UNQUOTED) {
-            if (state == TOKENIZE_INIT && c == quote_char) {
+            if ((variant & TOK_QUOTE) && state == TOKENIZE_INIT &&
+                    c == quote_char) {
                 // Opening quote. Switch state to TOKENIZE_QUOTED.
                 state = TOKENIZE_QUOTED;
             }
             else if (state == TOKENIZE_INIT && ignore_leading_spaces && c == ' ') {
                 // Ignore this leading space.
             }
-            else if ((c == sep_char) ||  ISCOMMENT(c, s, cc0, cc1) || (c == '\n') || (c == STREAM_EOF)) {
+            else if ((c == sep_char) || IS_COMMENT_VARIANT(c, r, cc0, cc1, variant) ||
+                     (c == '\n') || (c == STREAM_EOF)) {
                 // End of a field.  Save the field, and switch to state TOKENIZE_INIT.
-                if (ignore_trailing_spaces && trailing_space_count > 0) {
-                    p_word_end -= trailing_space_count;
-                }
-                *p_word_end = '\0';
-                words[field_number] = p_word_start;
-                ++field_number;
-                ++p_word_end;
-                p_word_start = p_word_end;
+                field_end(rf, ignore_trailing_spaces ? trailing_space_count : 0);
                 if (c == '\n' || c == STREAM_EOF) {
                     break;
                 }
-                else if (ISCOMMENT(c, s, cc0, cc1)) {
-                    stream_skipline(s);
+                else if (IS_COMMENT_VARIANT(c, r, cc0, cc1, variant)) {
+                    reader_skipline(r);
+                    break;
+                }
+                else if (rf->num_fields - rf->row_start == tokens->max_fields) {
+                    skip_row(r, tokens, pconfig, variant);
                     break;
                 }
                 trailing_space_count = 0;
                 state = TOKENIZE_INIT;
+                field_begin(rf);
             }
             else {
-                *p_word_end = c;
-                ++p_word_end;
+                field_store(rf, r, c);
                 if (c == ' ') {
                     ++trailing_space_count;
                 }
@@ -173,19 +816,31 @@ static char32_t **tokenize_sep(stream *s, char32_t *word_buffer,
                     trailing_space_count = 0;
                 }
                 state = TOKENIZE_UNQUOTED;
-            } 
+
+                size_t k = field_scan(rf, r, set);
+                if (k > 0) {
+                    if (ignore_trailing_spaces) {
+                        size_t j = k;
+                        while (j > 0 && r->p[j - 1] == ' ') {
+                            --j;
+                        }
+                        trailing_space_count = (j == 0) ? trailing_space_count + k
+                                                        : k - j;
+                    }
+                    r->p += k;
+                }
+            }
         }
-        else if (state == TOKENIZE_QUOTED) {
+        else if ((variant & TOK_QUOTE) && state == TOKENIZE_QUOTED) {
             if ((c != quote_char && c != '\n' && c != STREAM_EOF) || (c == '\n' && allow_embedded_newline)) {
-                *p_word_end = c;
-                ++p_word_end;
+                field_store(rf, r, c);
+                r->p += field_scan(rf, r, quoted_set);
             }
-            else if (c == quote_char && stream_peek(s)==quote_char) {
+            else if (c == quote_char && reader_peek(r) == quote_char) {
                 // Repeated quote characters; treat the pair as a single quote char.
-                *p_word_end = c;
-                ++p_word_end;
+                field_store(rf, r, c);
                 // Skip the second double-quote.
-                stream_fetch(s);
+                reader_fetch(r);
             }
             else if (c == quote_char) {
                 // Closing quote.  Switch state to TOKENIZE_UNQUOTED.
@@ -199,149 +854,142 @@ static char32_t **tokenize_sep(stream *s, char32_t *word_buffer,
                 // quotes and 'allow_embedded_newline' is 0.
                 // This could be treated as an error, but for now, we'll simply
                 // end the field (and the row).
-                *p_word_end = '\0';
-                words[field_number] = p_word_start;
-                ++field_number;
-                ++p_word_end;
-                p_word_start = p_word_end;
+                field_end(rf, 0);
                 break;
             }
         }
     }
 
-    if (*p_error_type) {
-        return NULL;
-    }
-
-    if (field_number == 0) {
-        /* XXX Is this the appropriate error type? */
-        *p_error_type = ERROR_NO_DATA;
-        return NULL;
+    if (r->error) {
+        error = reader_error_type(r);
     }
-
-    *p_num_fields = field_number;
-    result = (char32_t **) malloc(sizeof(char32_t *) * field_number);
-    if (result == NULL) {
-        *p_error_type = ERROR_OUT_OF_MEMORY;
-        return NULL;
+    else if (rf->error) {
+        error = rf->error;
     }
-
-    for (n = 0; n < field_number; ++n) {
-        result[n] = words[n];
+    else if (rf->num_fields == rf->row_start) {
+        /* XXX Is this the appropriate error type? */
+        error = ERROR_NO_DATA;
     }
-
-    return result;
+    return error;
 }
 
-
 /*
- *  XXX Currently, 'white space' is simply one or more space characters.
- *      This could be extended to sequence of spaces and tabs without too
- *      much effort.
+ *  tokenize a row of whitespace-delimited input (the delimiter is ' ' or
+ *  '\0'): the fields are separated by runs of blanks (spaces and tabs),
+ *  and the blanks at the start and at the end of a line are ignored.
+ *
+ *  A line that starts with the comment is skipped.  So is a line that has
+ *  only blanks, if pconfig->ignore_blank_lines is true; otherwise it is
+ *  returned as a row with no fields.
+ *
+ *  A run of blanks is skipped with scan_blanks(), and, as in
+ *  tokenize_sep(), the rest of an unquoted field after its first character
+ *  is consumed with scan_skip() or scan_copy().  The fields are returned
+ *  as in tokenize_sep().
  *
  *  XXX Returns NULL for several different error cases or edge cases.
  *      This needs to be refined.
  */
 
-static char32_t **tokenize_ws(stream *s, char32_t *word_buffer, int word_buffer_size,
-                              parser_config *pconfig,
-                              int *p_num_fields,
-                              int *p_error_type)
+static ALWAYS_INLINE int
+tokenize_ws_row(row_fields *rf, span_reader *r, token_index *tokens,
+                parser_config *pconfig)
 {
-    int n;
     char32_t c;
     int state;
-    char32_t *words[MAX_NUM_COLUMNS];
-    char32_t *p_word_start, *p_word_end;
-    int field_number;
-    char32_t **result;
+    int error = 0;
 
     char32_t cc0 = pconfig->comment[0];
     char32_t cc1 = pconfig->comment[1];
     char32_t quote_char = pconfig->quote;
     bool allow_embedded_newline = pconfig->allow_embedded_newline;
-
-    *p_error_type = 0;
+    bool ignore_blank_lines = pconfig->ignore_blank_lines;
+    const scan_set *set = &tokens->set;
+    const scan_set *quoted_set = &tokens->quoted_set;
 
     while (true) {
         // This is true when we enter the loop below. It becomes false
         // and remains false in subsequent iterations of the loop.
         bool havec = true;
 
-        c = stream_fetch(s);
-        while (ISCOMMENT(c, s, cc0, cc1)) {
-            stream_skipline(s);
-            c = stream_fetch(s);
+        row_begin(rf);
+
+        c = reader_fetch(r);
+        while (ISCOMMENT(c, r, cc0, cc1)) {
+            reader_skipline(r);
+            c = reader_fetch(r);
         }
 
         if (c == STREAM_EOF) {
-            *p_error_type = ERROR_NO_DATA;
-            return NULL;
+            return r->error ? reader_error_type(r) : ERROR_NO_DATA;
         }
 
         state = TOKENIZE_WHITESPACE;
-        field_number = 0;
-        p_word_start = word_buffer;
-        p_word_end = p_word_start;
 
         while (true) {
-            if ((p_word_end - word_buffer) >= word_buffer_size) {
-                *p_error_type = ERROR_TOO_MANY_CHARS;
+            if (rf->word_buffer_end - rf->word_end < UTF8_MAX_LEN &&
+                    (error = row_reserve(rf, UTF8_MAX_LEN)) != 0) {
                 break;
             }
-            if (field_number == MAX_NUM_COLUMNS) {
-                *p_error_type = ERROR_TOO_MANY_FIELDS;
+            if (rf->num_fields == rf->tokens->capacity &&
+                    (error = row_grow(rf)) != 0) {
                 break;
             }
             if (!havec) {
-                c = stream_fetch(s);
+                c = reader_fetch(r);
             }
             else {
                 havec = false;
             }
 
             if (state == TOKENIZE_WHITESPACE) {
-                if (c == quote_char) {
-                    // Opening quote.  Switch state to TOKENIZE_QUOTED
-                    state = TOKENIZE_QUOTED;
+                if (ISBLANK(c)) {
+                    // Skip the rest of the run.
+                    r->p += scan_blanks(r->p, r->end);
                 }
                 else if (c == '\n' || c == STREAM_EOF) {
                     break;
                 }
-                else if (c != ' ') {
-                    *p_word_end = c;
-                    ++p_word_end;
+                else if (c == quote_char) {
+                    // Opening quote.  Switch state to TOKENIZE_QUOTED
+                    field_begin(rf);
+                    state = TOKENIZE_QUOTED;
+                }
+                else {
+                    field_begin(rf);
+                    field_store(rf, r, c);
+                    r->p += field_scan(rf, r, set);
                     state = TOKENIZE_UNQUOTED;
                 }
             }
             else if (state == TOKENIZE_UNQUOTED) {
-                if ((c == ' ') || (c == '\n') || (c == STREAM_EOF)) {
-                    *p_word_end = '\0';
-                    words[field_number] = p_word_start;
-                    ++field_number;
-                    ++p_word_end;
-                    p_word_start = p_word_end;
+                if (ISBLANK(c) || (c == '\n') || (c == STREAM_EOF)) {
+                    field_end(rf, 0);
                     if (c == '\n' || c == STREAM_EOF) {
                         break;
                     }
+                    if (rf->num_fields - rf->row_start == tokens->max_fields) {
+                        skip_row(r, tokens, pconfig, TOK_BLANKS | TOK_QUOTE);
+                        break;
+                    }
+                    r->p += scan_blanks(r->p, r->end);
                     // Switch state to TOKENIZE_WHITESPACE.
                     state = TOKENIZE_WHITESPACE;
                 }
                 else {
-                    *p_word_end = c;
-                    ++p_word_end;
+                    field_store(rf, r, c);
+                    r->p += field_scan(rf, r, set);
                 }
             }
             else if (state == TOKENIZE_QUOTED) {
                 if ((c != quote_char && c != '\n' && c != STREAM_EOF) || (c == '\n' && allow_embedded_newline)) {
-                    *p_word_end = c;
-                    ++p_word_end;
+                    field_store(rf, r, c);
+                    r->p += field_scan(rf, r, quoted_set);
                 }
-                else if (c == quote_char && stream_peek(s) == quote_char) {
-                    *p_word_end = c;
-                    ++p_word_end;
+                else if (c == quote_char && reader_peek(r) == quote_char) {
+                    field_store(rf, r, c);
                     // Skip the second quote char.
-                    stream_fetch(s);
+                    reader_fetch(r);
                 }
                 //else if (c == quote_char && fb_peek(fb) != ' ' && fb_peek(fb) != '\n' && fb_peek(fb) != STREAM_EOF) {
                 //    // A quote, but the next character is not a space, a newline,
@@ -367,62 +1015,249 @@ static char32_t **tokenize_ws(stream *s, char32_t *word_buffer, int word_buffer_
                     // quotes and 'allow_embedded_newline' is 0.
                     // This could be treated as an error, but for now, we'll simply
                     // end the field (and the row).
-                    *p_word_end = '\0';
-                    words[field_number] = p_word_start;
-                    ++field_number;
-                    ++p_word_end;
-                    p_word_start = p_word_end;
+                    field_end(rf, 0);
                     break;
                 }
             }
         }
 
-        if (*p_error_type) {
-            return NULL;
+        if (r->error) {
+            error = reader_error_type(r);
+        }
+        else if (rf->error) {
+            error = rf->error;
+        }
+        if (error) {
+            return error;
         }
 
-        if (field_number != 0) {
+        if (rf->num_fields != rf->row_start || !ignore_blank_lines) {
             break;
         }
 
-        // If we're here, the line was blank.
-        // Currently we ignore blank lines (the configuration
-        // parameter is ignored).
+        // If we're here, the line was blank, and it is skipped.
+    }
+
+    return 0;
+}
+
+
+/*
+ *  Tokenize up to max_rows rows with the row tokenizer of the variant (see
+ *  tokenize_rows()).  The rows are read with a single span_reader, so the
+ *  fields of the rows before the current one stay in the span, and are
+ *  copied by row_materialize() with the others when the span is released.
+ */
+static ALWAYS_INLINE int
+tokenize_batch(stream *s, parser_config *pconfig, token_index *tokens,
+               int max_rows, int *p_error_type, const int variant)
+{
+    row_fields rf;
+    span_reader r;
+    int num_rows = 0;
+    int error = 0;
+
+    row_init(&rf, tokens);
+    reader_init(&r, s, &rf);
 
+    tokens->row_starts[0] = 0;
+    while (num_rows < max_rows) {
+        if (variant & TOK_WS) {
+            error = tokenize_ws_row(&rf, &r, tokens, pconfig);
+        }
+        else {
+            error = tokenize_sep_row(&rf, &r, tokens, pconfig, variant);
+        }
+        if (error != 0) {
+            break;
+        }
+        tokens->row_lines[num_rows] = stream_linenumber(s) + r.num_newlines;
+        ++num_rows;
+        tokens->row_starts[num_rows] = rf.num_fields;
     }
 
-    *p_num_fields = field_number;
+    reader_commit(&r);
+    *p_error_type = error;
+    return num_rows;
+}
 
-    result = (char32_t **) malloc(sizeof(char32_t *) * field_number);
-    if (result == NULL) {
-        *p_error_type = ERROR_OUT_OF_MEMORY;
-        return NULL;
+#define DECLARE_TOKENIZE_BATCH(name, variant)                               \
+    static int tokenize_##name(stream *s, parser_config *pconfig,           \
+                               token_index *tokens, int max_rows,           \
+                               int *p_error_type)                           \
+    {                                                                       \
+        return tokenize_batch(s, pconfig, tokens, max_rows, p_error_type,   \
+                              variant);                                     \
+    }                                                                       \
+
+DECLARE_TOKENIZE_BATCH(sep_general, TOK_GENERAL)
+DECLARE_TOKENIZE_BATCH(sep_quote_comment, TOK_QUOTE | TOK_COMMENT)
+DECLARE_TOKENIZE_BATCH(sep_quote, TOK_QUOTE)
+DECLARE_TOKENIZE_BATCH(sep_comment, TOK_COMMENT)
+DECLARE_TOKENIZE_BATCH(sep_plain, 0)
+DECLARE_TOKENIZE_BATCH(sep_csv_comment, TOK_CSV | TOK_QUOTE | TOK_COMMENT)
+DECLARE_TOKENIZE_BATCH(sep_csv, TOK_CSV | TOK_QUOTE)
+DECLARE_TOKENIZE_BATCH(ws, TOK_WS)
+
+
+/*
+ *  Choose the tokenizer for pconfig.
+ */
+static tokenize_func
+select_tokenizer(parser_config *pconfig)
+{
+    char32_t cc0 = pconfig->comment[0];
+    char32_t cc1 = pconfig->comment[1];
+
+    if ((pconfig->delimiter == '\0') || (pconfig->delimiter == ' ')) {
+        return &tokenize_ws;
+    }
+    if (pconfig->ignore_leading_spaces || pconfig->ignore_trailing_spaces ||
+            (cc0 != 0 && cc1 != 0)) {
+        return &tokenize_sep_general;
     }
+    if (pconfig->delimiter == ',' && pconfig->quote == '"') {
+        return (cc0 != 0) ? &tokenize_sep_csv_comment : &tokenize_sep_csv;
+    }
+    if (pconfig->quote != 0) {
+        return (cc0 != 0) ? &tokenize_sep_quote_comment : &tokenize_sep_quote;
+    }
+    return (cc0 != 0) ? &tokenize_sep_comment : &tokenize_sep_plain;
+}
 
-    for (n = 0; n < field_number; ++n) {
-        result[n] = words[n];
+
+void token_index_init(token_index *tokens, parser_config *pconfig)
+{
+    tokens->fields = NULL;
+    tokens->capacity = 0;
+    tokens->word_buffer = NULL;
+    tokens->word_buffer_size = 0;
+    tokens->row_starts = NULL;
+    tokens->row_lines = NULL;
+    tokens->rows_capacity = 0;
+    tokens->max_fields = 0;
+    tokens->needed = NULL;
+    tokens->tokenizer = select_tokenizer(pconfig);
+    scan_set_init(&tokens->set, pconfig->delimiter, pconfig->quote,
+                  pconfig->comment[0]);
+    // Inside quotes, only the quote character and the control characters
+    // (e.g. a newline) end a run.
+    scan_set_init(&tokens->quoted_set, '\n', pconfig->quote, '\n');
+}
+
+
+int token_index_project(token_index *tokens, const int32_t *cols,
+                        int num_cols)
+{
+    int max_fields = 0;
+    bool *needed;
+
+    for (int j = 0; j < num_cols; ++j) {
+        if (cols[j] < 0) {
+            // Counted from the end of the row, so every field is needed.
+            return 0;
+        }
+        if (cols[j] >= max_fields) {
+            max_fields = cols[j] + 1;
+        }
+    }
+    if (max_fields == 0) {
+        return 0;
+    }
+    needed = calloc(max_fields, sizeof(bool));
+    if (needed == NULL) {
+        return ERROR_OUT_OF_MEMORY;
     }
+    for (int j = 0; j < num_cols; ++j) {
+        needed[cols[j]] = true;
+    }
+    free(tokens->needed);
+    tokens->needed = needed;
+    tokens->max_fields = max_fields;
+    return 0;
+}
 
-    return result;
+
+void token_index_free(token_index *tokens)
+{
+    free(tokens->fields);
+    free(tokens->word_buffer);
+    free(tokens->row_starts);
+    free(tokens->row_lines);
+    free(tokens->needed);
+    tokens->max_fields = 0;
+    tokens->needed = NULL;
+    tokens->fields = NULL;
+    tokens->capacity = 0;
+    tokens->word_buffer = NULL;
+    tokens->word_buffer_size = 0;
+    tokens->row_starts = NULL;
+    tokens->row_lines = NULL;
+    tokens->rows_capacity = 0;
 }
 
 
-char32_t **tokenize(stream *s, char32_t *word_buffer, int word_buffer_size,
-                    parser_config *pconfig, int *p_num_fields, int *p_error_type)
+/*
+ *  Make room in the row arrays for max_rows rows.
+ *
+ *  Returns 0 or ERROR_OUT_OF_MEMORY.
+ */
+static int
+rows_reserve(token_index *tokens, int max_rows)
 {
-    char32_t **result;
+    int capacity = (tokens->rows_capacity > 0) ? tokens->rows_capacity : 1;
+    int *row_starts, *row_lines;
 
-    if ((pconfig->delimiter == '\0') || (pconfig->delimiter == ' ')) {
-        result = tokenize_ws(s, word_buffer, word_buffer_size,
-                             pconfig,
-                             p_num_fields,
-                             p_error_type);
+    if (max_rows <= tokens->rows_capacity) {
+        return 0;
     }
-    else {
-        result = tokenize_sep(s, word_buffer, word_buffer_size,
-                              pconfig,
-                              p_num_fields,
-                              p_error_type);
+    while (capacity < max_rows) {
+        capacity *= 2;
+    }
+    row_starts = realloc(tokens->row_starts, (capacity + 1) * sizeof(int));
+    if (row_starts == NULL) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    tokens->row_starts = row_starts;
+    row_lines = realloc(tokens->row_lines, capacity * sizeof(int));
+    if (row_lines == NULL) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    tokens->row_lines = row_lines;
+    tokens->rows_capacity = capacity;
+    return 0;
+}
+
+
+/*
+ *  Tokenize up to max_rows rows (at least 1) into *tokens, and return the
+ *  number of rows tokenized.  See token_index for where the rows are.  The
+ *  fields are valid until the stream is used again.
+ *
+ *  If fewer than max_rows rows are returned, *p_error_type tells why:
+ *  ERROR_NO_DATA at the end of the stream, or the error (e.g. a decoding
+ *  error) that stopped the tokenizer in the next row.  Otherwise it is 0.
+ */
+int tokenize_rows(stream *s, parser_config *pconfig, token_index *tokens,
+                  int max_rows, int *p_error_type)
+{
+    if ((*p_error_type = rows_reserve(tokens, max_rows)) != 0) {
+        return 0;
+    }
+    return tokens->tokenizer(s, pconfig, tokens, max_rows, p_error_type);
+}
+
+
+/*
+ *  Tokenize one row, and return its fields (tokens->fields), or NULL with
+ *  *p_error_type set.  *p_num_fields is the number of fields.
+ */
+field_span *tokenize(stream *s, parser_config *pconfig, token_index *tokens,
+                     int *p_num_fields, int *p_error_type)
+{
+    if (tokenize_rows(s, pconfig, tokens, 1, p_error_type) == 0) {
+        return NULL;
     }
-    return result;
+    *p_num_fields = tokens->row_starts[1];
+    return tokens->fields;
 }
@@ -2,13 +2,84 @@
 #ifndef _TOKENIZE_H_
 #define _TOKENIZE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "typedefs.h"
 #include "stream.h"
 #include "parser_config.h"
+#include "scan.h"
+
+/*
+ *  A field returned by tokenize(): len bytes of UTF-8 at p, not
+ *  nul-terminated.
+ */
+typedef struct _field_span {
+    const uint8_t *p;
+    size_t len;
+} field_span;
+
+typedef struct _token_index token_index;
+
+typedef int (*tokenize_func)(stream *s, parser_config *pconfig,
+                             token_index *tokens, int max_rows,
+                             int *p_error_type);
+
+/*
+ *  The fields of a batch of rows, filled in by tokenize_rows() (or of one
+ *  row, by tokenize()), and the buffer holding the fields that could not be
+ *  used in place.  The caller owns it, and reuses it for every batch, so
+ *  that the tokenizer does not allocate anything per row once the arrays
+ *  are large enough; they grow (by doubling) as needed.
+ *
+ *  The fields of row i of the batch are fields[row_starts[i]] up to
+ *  fields[row_starts[i + 1] - 1], so a column can be read across the batch
+ *  without going through the tokenizer again.  row_lines[i] is the line
+ *  number of the stream after row i (the value stream_linenumber() would
+ *  have had if the row had been tokenized alone).
+ *
+ *  It also holds what depends only on the parser_config: the tokenizer
+ *  variant for the configuration, and the bytes that end a run of plain
+ *  field bytes.  These are set once per read by token_index_init(), and
+ *  the same parser_config must be passed to every tokenize() call.
+ *  Release with token_index_free().
+ *
+ *  token_index_project() tells the tokenizer which fields are used.  Then
+ *  the fields after the last one used are neither stored nor returned (the
+ *  rest of the row is skipped), and the unused fields before it are not
+ *  copied (their spans may be empty).
+ */
+struct _token_index {
+    field_span *fields;
+    int capacity;
+    uint8_t *word_buffer;
+    size_t word_buffer_size;
+
+    int *row_starts;
+    int *row_lines;
+    int rows_capacity;
+
+    /* The number of fields used (0 for all of them), and which ones. */
+    int max_fields;
+    bool *needed;
+
+    tokenize_func tokenizer;
+
+    /* The bytes that end a run outside and inside a quoted field. */
+    scan_set set;
+    scan_set quoted_set;
+};
+
+void token_index_init(token_index *tokens, parser_config *pconfig);
+int token_index_project(token_index *tokens, const int32_t *cols,
+                        int num_cols);
+void token_index_free(token_index *tokens);
 
-char32_t **tokenize(stream *fb, char32_t *word_buffer, int word_buffer_size,
-                    parser_config *pconfg,
-                    int *p_num_fields,
-                    int *p_error_type);
+int tokenize_rows(stream *s, parser_config *pconfig, token_index *tokens,
+                  int max_rows, int *p_error_type);
+field_span *tokenize(stream *fb, parser_config *pconfg,
+                     token_index *tokens,
+                     int *p_num_fields,
+                     int *p_error_type);
 
 #endif
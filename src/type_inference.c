@@ -54,7 +54,8 @@ as missing data.
  *      to classify a column, not just a single field. 
  */
 
-char classify_type(char32_t *field, char32_t decimal, char32_t sci, char32_t imaginary_unit,
+char classify_type(const uint8_t *field, size_t len,
+                   char32_t decimal, char32_t sci, char32_t imaginary_unit,
                    int64_t *i, uint64_t *u,
                    char prev_type)
 {
@@ -67,26 +68,26 @@ char classify_type(char32_t *field, char32_t decimal, char32_t sci, char32_t ima
         case '*':
         case 'Q':
         case 'q':
-            *u = str_to_uint64(field, UINT64_MAX, &error);
+            *u = str_to_uint64(field, len, UINT64_MAX, &error);
             if (error == 0) {
                 return 'Q';
             }
             if (error == ERROR_MINUS_SIGN) {
-                *i = str_to_int64(field, INT64_MIN, INT64_MAX, &error);
+                *i = str_to_int64(field, len, INT64_MIN, INT64_MAX, &error);
                 if (error == 0) {
                     return 'q';
                 }
             }
             /*@fallthrough@*/
         case 'd':
-            success = to_double(field, &real, sci, decimal);
+            success = to_double(field, len, &real, sci, decimal);
             if (success) {
                 return 'd';
             }
             /*@fallthrough@*/
         case 'z':
-            success = to_complex(field, &real, &imag, sci, decimal, imaginary_unit,
-                                 ALLOW_PARENS);
+            success = to_complex(field, len, &real, &imag, sci, decimal,
+                                 imaginary_unit, ALLOW_PARENS);
             if (success) {
                 return 'z';
             }
@@ -100,10 +101,11 @@ char classify_type(char32_t *field, char32_t decimal, char32_t sci, char32_t ima
         //        return 'U';
         //    }
     }
-    while (*field == ' ') {
+    while (len > 0 && *field == ' ') {
         ++field;
+        --len;
     }
-    if (!*field) {
+    if (len == 0) {
         /* All spaces, so return prev_type */
         return prev_type;
     }